@@ -0,0 +1,593 @@
+// Load generator for the server: C connections, each keeping up to P
+// requests in flight, driven by a single poll() loop. Reports throughput
+// and latency percentiles for every test that is run.
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+typedef std::vector<uint8_t> Buffer;
+
+static void die(const char *msg) {
+    fprintf(stderr, "[%d] %s\n", errno, msg);
+    abort();
+}
+
+static uint64_t getMonotonicUs() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+// xorshift64*, cheap enough not to show up in the numbers
+static uint64_t gRng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rnd() {
+    gRng ^= gRng >> 12;
+    gRng ^= gRng << 25;
+    gRng ^= gRng >> 27;
+    return gRng * 0x2545F4914F6CDD1Dull;
+}
+
+enum {
+    TAG_NIL = 0,
+    TAG_ERR = 1,
+    TAG_INT = 2,
+    TAG_STR = 3,
+    TAG_DBL = 4,
+    TAG_ARR = 5,
+    TAG_CHUNK = 6,
+    TAG_PUSH = 7,
+};
+
+static struct {
+    const char *host = "127.0.0.1";
+    uint16_t port = 1234;
+    size_t conns = 50;
+    size_t requests = 100000;
+    size_t pipeline = 1;
+    size_t keyspace = 100000;
+    size_t dataSize = 16;
+    // Zipf exponent for key selection, 0 picks keys uniformly
+    double zipf = 0;
+    size_t batch = 10;
+    // connections subscribed to bench:ch while the tests run
+    size_t subscribers = 0;
+    std::string tests = "set,get,zadd,zscore,zquery";
+} gOpt;
+
+static void appendReq(Buffer &out, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + (uint32_t)s.size();
+    }
+    uint32_t n = (uint32_t)cmd.size();
+    size_t pos = out.size();
+    out.resize(pos + 8);
+    memcpy(&out[pos], &len, 4);
+    memcpy(&out[pos + 4], &n, 4);
+    for (const std::string &s : cmd) {
+        uint32_t size = (uint32_t)s.size();
+        out.insert(out.end(), (const uint8_t *)&size, (const uint8_t *)&size + 4);
+        out.insert(out.end(), s.begin(), s.end());
+    }
+}
+
+// cumulative Zipf distribution over the keyspace, rank 0 is the hottest
+static std::vector<double> gZipfCdf;
+
+static uint64_t pickKey() {
+    if (gOpt.zipf <= 0) {
+        return rnd() % gOpt.keyspace;
+    }
+    if (gZipfCdf.empty()) {
+        gZipfCdf.resize(gOpt.keyspace);
+        double sum = 0;
+        for (size_t i = 0; i < gOpt.keyspace; i++) {
+            sum += 1.0 / pow((double)(i + 1), gOpt.zipf);
+            gZipfCdf[i] = sum;
+        }
+        for (double &x : gZipfCdf) {
+            x /= sum;
+        }
+    }
+    double u = (double)(rnd() >> 11) * 0x1.0p-53;
+    auto it = std::lower_bound(gZipfCdf.begin(), gZipfCdf.end(), u);
+    return it == gZipfCdf.end() ? gOpt.keyspace - 1 : (uint64_t)(it - gZipfCdf.begin());
+}
+
+static std::string keyName(const char *prefix, uint64_t key) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%012llu", prefix, (unsigned long long)key);
+    return buf;
+}
+
+static std::string gValue;
+
+static void genSet(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"set", keyName("key:", key), gValue};
+}
+
+// 16-byte key, counter-sized integer value
+static void genSetInt(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"set", keyName("key:", key), std::to_string(rnd() % 100000000)};
+}
+
+static void genIncr(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"incr", keyName("cnt:", key)};
+}
+
+static void genGet(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"get", keyName("key:", key)};
+}
+
+// MGET/MSET carry the picked key plus batch-1 uniformly random ones
+static void genMGet(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"mget", keyName("key:", key)};
+    for (size_t i = 1; i < gOpt.batch; i++) {
+        cmd.push_back(keyName("key:", rnd() % gOpt.keyspace));
+    }
+}
+
+static void genMSet(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"mset", keyName("key:", key), gValue};
+    for (size_t i = 1; i < gOpt.batch; i++) {
+        cmd.push_back(keyName("key:", rnd() % gOpt.keyspace));
+        cmd.push_back(gValue);
+    }
+}
+
+static void genZAdd(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"zadd", "bench:zset", std::to_string(rnd() % 1000000), keyName("m:", key)};
+}
+
+static void genZScore(std::vector<std::string> &cmd, uint64_t key) {
+    cmd = {"zscore", "bench:zset", keyName("m:", key)};
+}
+
+static void genZQuery(std::vector<std::string> &cmd, uint64_t) {
+    cmd = {"zquery", "bench:zset", std::to_string(rnd() % 1000000), "", "0", "10"};
+}
+
+// a queue: producers RPUSH, consumers LPOP
+static void genRPush(std::vector<std::string> &cmd, uint64_t) {
+    cmd = {"rpush", "bench:list", gValue};
+}
+
+static void genLPop(std::vector<std::string> &cmd, uint64_t) {
+    cmd = {"lpop", "bench:list"};
+}
+
+static void genLRange(std::vector<std::string> &cmd, uint64_t) {
+    cmd = {"lrange", "bench:list", "0", "99"};
+}
+
+// fans out to the -S subscribers
+static void genPublish(std::vector<std::string> &cmd, uint64_t) {
+    cmd = {"publish", "bench:ch", gValue};
+}
+
+static void genMixed(std::vector<std::string> &cmd, uint64_t key) {
+    // 80% reads, the usual cache ratio
+    if (rnd() % 10 < 8) {
+        genGet(cmd, key);
+    } else {
+        genSet(cmd, key);
+    }
+}
+
+struct BenchTest {
+    const char *name;
+    void (*gen)(std::vector<std::string> &cmd, uint64_t key);
+    // cache-aside: a GET miss is followed by a SET of the same key
+    bool fillOnMiss;
+    // CLIENT TRACKING: GETs are served from a local copy until the server
+    // invalidates it
+    bool nearCache;
+};
+
+static const BenchTest k_tests[] = {
+    {"set", &genSet, false},
+    {"setint", &genSetInt, false},
+    {"incr", &genIncr, false},
+    {"get", &genGet, false},
+    {"mget", &genMGet, false},
+    {"mset", &genMSet, false},
+    {"zadd", &genZAdd, false},
+    {"zscore", &genZScore, false},
+    {"zquery", &genZQuery, false},
+    {"rpush", &genRPush, false},
+    {"lrange", &genLRange, false},
+    {"lpop", &genLPop, false},
+    {"mixed", &genMixed, false},
+    {"publish", &genPublish, false},
+    {"cache", &genGet, true},
+    {"nearcache", &genMixed, false, true},
+};
+
+struct InFlight {
+    uint64_t sentAt = 0;
+    uint64_t key = 0;
+    // the follow-up SET of a cache miss, not timed
+    bool fill = false;
+    bool get = false;
+};
+
+struct BenchConn {
+    int fd = -1;
+    Buffer outgoing;
+    size_t outPos = 0;
+    Buffer incoming;
+    // the in-flight requests, in order
+    std::deque<InFlight> sent;
+    // keys held locally for a nearCache test
+    std::unordered_set<uint64_t> cache;
+};
+
+struct BenchResult {
+    std::vector<uint32_t> lat;
+    size_t errs = 0;
+    size_t gets = 0;
+    size_t misses = 0;
+    // GETs answered by the near cache
+    size_t nearHits = 0;
+    // messages received by the subscribers
+    size_t delivered = 0;
+};
+
+static int connectServer() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(gOpt.port);
+    if (inet_pton(AF_INET, gOpt.host, &addr.sin_addr) != 1) {
+        die("bad host");
+    }
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("connect()");
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// drop complete frames, returns how many
+static size_t countFrames(Buffer &in) {
+    size_t pos = 0, n = 0;
+    while (in.size() - pos >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, &in[pos], 4);
+        if (in.size() - pos - 4 < len) {
+            break;
+        }
+        pos += 4 + len;
+        n++;
+    }
+    in.erase(in.begin(), in.begin() + pos);
+    return n;
+}
+
+// a connection that only receives messages, subscribed to bench:ch
+static int connectSubscriber() {
+    int fd = connectServer();
+    Buffer req, in;
+    appendReq(req, {"subscribe", "bench:ch"});
+    if (write(fd, req.data(), req.size()) != (ssize_t)req.size()) {
+        die("write()");
+    }
+    // wait for the ack, every subscriber is counted from the first PUBLISH
+    while (countFrames(in) == 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        uint8_t buf[256];
+        ssize_t rv = poll(&pfd, 1, 5000) > 0 ? read(fd, buf, sizeof(buf)) : 0;
+        if (rv <= 0 && errno != EAGAIN) {
+            die("subscribe");
+        }
+        if (rv > 0) {
+            in.insert(in.end(), buf, buf + rv);
+        }
+    }
+    return fd;
+}
+
+// ["invalidate", [key ...]] drops the keys, ["invalidate", nil] all of them
+static bool parseInvalidate(BenchConn &c, const uint8_t *data, uint32_t len) {
+    const uint8_t *end = data + len;
+    // tag, count 2, then "invalidate" as a string
+    const size_t head = 1 + 4 + 1 + 4 + 10;
+    if (len < head + 1) {
+        return false;
+    }
+    data += head;
+    if (data[0] == TAG_NIL) {
+        c.cache.clear();
+        return true;
+    }
+    if (data[0] != TAG_ARR || end - data < 5) {
+        return false;
+    }
+    uint32_t n = 0;
+    memcpy(&n, data + 1, 4);
+    data += 5;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t size = 0;
+        if (end - data < 5 || data[0] != TAG_STR) {
+            return false;
+        }
+        memcpy(&size, data + 1, 4);
+        data += 5;
+        if ((size_t)(end - data) < size) {
+            return false;
+        }
+        // "key:" and the number, see keyName()
+        std::string name((const char *)data, size);
+        if (name.compare(0, 4, "key:") == 0) {
+            c.cache.erase(strtoull(name.c_str() + 4, NULL, 10));
+        }
+        data += size;
+    }
+    return true;
+}
+
+// consume complete responses, returns false on a protocol error
+static bool parseResponses(const BenchTest &test, BenchConn &c, BenchResult &res) {
+    size_t pos = 0;
+    uint64_t now = getMonotonicUs();
+    std::vector<std::string> cmd;
+    while (c.incoming.size() - pos >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, &c.incoming[pos], 4);
+        if (c.incoming.size() - pos - 4 < len) {
+            break;
+        }
+        if (len > 0 && c.incoming[pos + 4] == TAG_PUSH) {
+            if (!parseInvalidate(c, &c.incoming[pos + 4], len)) {
+                return false;
+            }
+            pos += 4 + len;
+            continue;
+        }
+        if (c.sent.empty() || len == 0) {
+            return false;
+        }
+        InFlight req = c.sent.front();
+        c.sent.pop_front();
+        bool err = c.incoming[pos + 4] == TAG_ERR;
+        if (test.nearCache && req.get && !err) {
+            c.cache.insert(req.key);
+        }
+        if (test.fillOnMiss && !req.fill) {
+            res.gets++;
+            if (err) {
+                res.misses++;
+                genSet(cmd, req.key);
+                appendReq(c.outgoing, cmd);
+                c.sent.push_back(InFlight{now, req.key, true});
+            }
+        } else if (err) {
+            res.errs++;
+        }
+        if (!req.fill) {
+            res.lat.push_back((uint32_t)(now - req.sentAt));
+        }
+        pos += 4 + len;
+    }
+    c.incoming.erase(c.incoming.begin(), c.incoming.begin() + pos);
+    return true;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (double)(sorted.size() - 1));
+    return sorted[idx];
+}
+
+static void runTest(const BenchTest &test) {
+    std::vector<BenchConn> conns(gOpt.conns);
+    for (BenchConn &c : conns) {
+        c.fd = connectServer();
+        if (test.nearCache) {
+            appendReq(c.outgoing, {"client", "tracking", "on"});
+            c.sent.push_back(InFlight{getMonotonicUs(), 0, true});
+        }
+    }
+    // drained in the same poll() loop, after the request connections
+    std::vector<BenchConn> subs(gOpt.subscribers);
+    for (BenchConn &c : subs) {
+        c.fd = connectSubscriber();
+    }
+    BenchResult res;
+    std::vector<uint32_t> &lat = res.lat;
+    lat.reserve(gOpt.requests);
+    size_t issued = 0;
+    std::vector<std::string> cmd;
+    std::vector<struct pollfd> pfds(conns.size() + subs.size());
+
+    uint64_t start = getMonotonicUs();
+    while (lat.size() < gOpt.requests) {
+        for (size_t i = 0; i < conns.size(); i++) {
+            BenchConn &c = conns[i];
+            while (c.sent.size() < gOpt.pipeline && issued < gOpt.requests) {
+                uint64_t key = pickKey();
+                test.gen(cmd, key);
+                issued++;
+                bool get = cmd[0] == "get";
+                res.gets += test.nearCache && get;
+                if (test.nearCache && get && c.cache.count(key)) {
+                    res.nearHits++;
+                    lat.push_back(0);
+                    continue;
+                }
+                appendReq(c.outgoing, cmd);
+                c.sent.push_back(InFlight{getMonotonicUs(), key, false, get});
+            }
+            pfds[i] = {c.fd, POLLIN, 0};
+            if (c.outPos < c.outgoing.size()) {
+                pfds[i].events |= POLLOUT;
+            }
+        }
+        for (size_t i = 0; i < subs.size(); i++) {
+            pfds[conns.size() + i] = {subs[i].fd, POLLIN, 0};
+        }
+        if (poll(pfds.data(), (nfds_t)pfds.size(), 5000) <= 0) {
+            die("poll() timed out");
+        }
+        for (size_t i = 0; i < conns.size(); i++) {
+            BenchConn &c = conns[i];
+            if (pfds[i].revents & POLLOUT) {
+                ssize_t rv = write(c.fd, &c.outgoing[c.outPos], c.outgoing.size() - c.outPos);
+                if (rv < 0 && errno != EAGAIN) {
+                    die("write()");
+                }
+                if (rv > 0) {
+                    c.outPos += (size_t)rv;
+                }
+                if (c.outPos == c.outgoing.size()) {
+                    c.outgoing.clear();
+                    c.outPos = 0;
+                }
+            }
+            if (pfds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                uint8_t buf[64 * 1024];
+                ssize_t rv = read(c.fd, buf, sizeof(buf));
+                if (rv == 0 || (rv < 0 && errno != EAGAIN)) {
+                    die("connection lost");
+                }
+                if (rv > 0) {
+                    c.incoming.insert(c.incoming.end(), buf, buf + rv);
+                    if (!parseResponses(test, c, res)) {
+                        die("bad response");
+                    }
+                }
+            }
+        }
+        for (size_t i = 0; i < subs.size(); i++) {
+            if (pfds[conns.size() + i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                uint8_t buf[64 * 1024];
+                ssize_t rv = read(subs[i].fd, buf, sizeof(buf));
+                if (rv == 0 || (rv < 0 && errno != EAGAIN)) {
+                    die("subscriber lost");
+                }
+                if (rv > 0) {
+                    subs[i].incoming.insert(subs[i].incoming.end(), buf, buf + rv);
+                    res.delivered += countFrames(subs[i].incoming);
+                }
+            }
+        }
+    }
+    uint64_t elapsed = getMonotonicUs() - start;
+
+    for (BenchConn &c : conns) {
+        close(c.fd);
+    }
+    for (BenchConn &c : subs) {
+        close(c.fd);
+    }
+    uint64_t total = 0;
+    for (uint32_t us : lat) {
+        total += us;
+    }
+    std::sort(lat.begin(), lat.end());
+    printf("%-8s %10.0f req/s  avg %7.1f us  p50 %6u  p99 %6u  p99.9 %6u  max %7u",
+        test.name, (double)lat.size() * 1e6 / (double)(elapsed ? elapsed : 1),
+        (double)total / (double)lat.size(), percentile(lat, 50), percentile(lat, 99),
+        percentile(lat, 99.9), lat.back());
+    if (test.fillOnMiss) {
+        printf("  hit rate %.2f%%", 100.0 * (double)(res.gets - res.misses) / (double)res.gets);
+    }
+    if (test.nearCache) {
+        printf("  near-cache hits %.2f%%", 100.0 * (double)res.nearHits / (double)res.gets);
+    }
+    if (!subs.empty()) {
+        printf("  %.0f msg/s delivered", (double)res.delivered * 1e6 / (double)(elapsed ? elapsed : 1));
+    }
+    if (res.errs) {
+        printf("  (%zu errors)", res.errs);
+    }
+    printf("\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-h host] [-p port] [-c conns] [-n requests] [-P pipeline]\n"
+        "          [-r keyspace] [-d value size] [-z zipf exponent] [-b keys per mget/mset]\n"
+        "          [-S subscribers] [-t test,test,...]\n"
+        "tests:", prog);
+    for (const BenchTest &t : k_tests) {
+        fprintf(stderr, " %s", t.name);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || strlen(arg) != 2 || i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const char *val = argv[++i];
+        switch (arg[1]) {
+        case 'h': gOpt.host = val; break;
+        case 'p': gOpt.port = (uint16_t)atoi(val); break;
+        case 'c': gOpt.conns = (size_t)atol(val); break;
+        case 'n': gOpt.requests = (size_t)atol(val); break;
+        case 'P': gOpt.pipeline = (size_t)atol(val); break;
+        case 'r': gOpt.keyspace = (size_t)atol(val); break;
+        case 'd': gOpt.dataSize = (size_t)atol(val); break;
+        case 'z': gOpt.zipf = atof(val); break;
+        case 'b': gOpt.batch = (size_t)atol(val); break;
+        case 'S': gOpt.subscribers = (size_t)atol(val); break;
+        case 't': gOpt.tests = val; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (!gOpt.conns || !gOpt.pipeline || !gOpt.keyspace || !gOpt.batch) {
+        usage(argv[0]);
+    }
+    gValue.assign(gOpt.dataSize, 'x');
+
+    size_t pos = 0;
+    while (pos <= gOpt.tests.size()) {
+        size_t end = gOpt.tests.find(',', pos);
+        if (end == std::string::npos) {
+            end = gOpt.tests.size();
+        }
+        std::string name = gOpt.tests.substr(pos, end - pos);
+        pos = end + 1;
+        const BenchTest *test = NULL;
+        for (const BenchTest &t : k_tests) {
+            if (name == t.name) {
+                test = &t;
+            }
+        }
+        if (!test) {
+            fprintf(stderr, "unknown test: %s\n", name.c_str());
+            usage(argv[0]);
+        }
+        runTest(*test);
+    }
+    return 0;
+}
@@ -50,6 +50,8 @@ static int32_t write_all(int fd, const char *buf, size_t n) {
 }
 
 const size_t k_max_msg = 4096; 
+// the server's limit on a reply
+const size_t k_max_reply = 32 << 20;
 
 // the `query` function was simply splited into `send_req` and `read_res`.
 static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
@@ -83,6 +85,10 @@ enum {
     TAG_STR = 3,
     TAG_DBL = 4,
     TAG_ARR = 5,
+    // part of an array, the rest is in the next reply
+    TAG_CHUNK = 6,
+    // not a reply: a message from the server, e.g. an invalidation
+    TAG_PUSH = 7,
 };
 static int32_t printResponse(const uint8_t *data, size_t size) {
     if (size < 1) {
@@ -148,14 +154,18 @@ static int32_t printResponse(const uint8_t *data, size_t size) {
             return 9;
         }
         
-        case TAG_ARR: {
+        case TAG_ARR:
+        case TAG_CHUNK:
+        case TAG_PUSH: {
             if (size < 5) {
                 msg("bad response");
                 return -1;
             }
+            const char *kind = data[0] == TAG_ARR ? "arr"
+                : data[0] == TAG_CHUNK ? "chunk" : "push";
             uint32_t len = 0; 
             memcpy(&len, &data[1], 4);
-            printf("(arr) len=%u\n", len);
+            printf("(%s) len=%u\n", kind, len);
             size_t arr_bytes = 1 + 4;
             for (uint32_t i = 0; i < len; ++i) {
                 int32_t rv = printResponse(&data[arr_bytes], size - arr_bytes);
@@ -164,7 +174,7 @@ static int32_t printResponse(const uint8_t *data, size_t size) {
                 }
                 arr_bytes += (size_t)rv;
             }
-            printf("(arr) end\n");
+            printf("(%s) end\n", kind);
             return (int32_t)arr_bytes;
         }
         
@@ -174,11 +184,11 @@ static int32_t printResponse(const uint8_t *data, size_t size) {
     }
 }
 
-static int32_t read_res(int fd) {
+static int32_t read_one(int fd, std::vector<char> &rbuf) {
     // 4 bytes header
-    char rbuf[4 + k_max_msg];
+    char header[4];
     errno = 0;
-    int32_t err = read_full(fd, rbuf, 4);
+    int32_t err = read_full(fd, header, 4);
     if (err) {
         if (errno == 0) {
             msg("EOF");
@@ -189,21 +199,22 @@ static int32_t read_res(int fd) {
     }
 
     uint32_t len = 0;
-    memcpy(&len, rbuf, 4);  // assume little endian
-    if (len > k_max_msg) {
+    memcpy(&len, header, 4);  // assume little endian
+    if (len > k_max_reply) {
         msg("too long");
         return -1;
     }
 
     // reply body
-    err = read_full(fd, &rbuf[4], len);
+    rbuf.resize(len);
+    err = read_full(fd, rbuf.data(), len);
     if (err) {
         msg("read() error");
         return err;
     }
 
     // print the result
-    int32_t rv = printResponse((uint8_t *)&rbuf[4], len);
+    int32_t rv = printResponse((uint8_t *)rbuf.data(), len);
     if (rv < 0) {
         msg("bad response");
         rv = -1;
@@ -211,7 +222,34 @@ static int32_t read_res(int fd) {
     return rv;
 }
 
+// a streamed reply goes on until a message that is not a TAG_CHUNK
+static int32_t read_res(int fd) {
+    std::vector<char> rbuf;
+    int32_t rv = 0;
+    do {
+        rv = read_one(fd, rbuf);
+    } while (rv >= 0 && rbuf[0] == TAG_CHUNK);
+    return rv;
+}
+
+// client [-p port] [-r extra replies] cmd args...
+// -r reads that many more replies after the first, e.g. the messages of a
+// SUBSCRIBE; -1 reads until the server closes the connection.
 int main(int argc, char **argv) {
+    int port = 1234;
+    int64_t extra = 0;
+    int argi = 1;
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (!strcmp(argv[argi], "-p")) {
+            port = atoi(argv[argi + 1]);
+        } else if (!strcmp(argv[argi], "-r")) {
+            extra = atoll(argv[argi + 1]);
+        } else {
+            break;
+        }
+        argi += 2;
+    }
+
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         die("socket()");
@@ -219,7 +257,7 @@ int main(int argc, char **argv) {
 
     struct sockaddr_in addr = {};
     addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
+    addr.sin_port = ntohs((uint16_t)port);
     addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);  // 127.0.0.1
     int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
     if (rv) {
@@ -227,19 +265,21 @@ int main(int argc, char **argv) {
     }
 
     std::vector<std::string> cmd;
-    for (int i = 1; i < argc; ++i) {
+    for (int i = argi; i < argc; ++i) {
         cmd.push_back(argv[i]);
     }
     int32_t err = send_req(fd, cmd);
     if (err) {
         goto L_DONE;
     }
+    // read_res() returns the size of what it printed
     err = read_res(fd);
-    if (err) {
-        goto L_DONE;
+    for (int64_t i = 0; err >= 0 && (extra < 0 || i < extra); i++) {
+        fflush(stdout);
+        err = read_res(fd);
     }
 
 L_DONE:
     close(fd);
     return 0;
-}
\ No newline at end of file
+}
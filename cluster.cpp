@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+// proj
+#include "cluster.h"
+
+// CRC16-CCITT (XMODEM): polynomial 0x1021, initial value 0, the variant
+// Redis Cluster hashes keys with
+struct Crc16Table {
+    uint16_t t[256];
+    constexpr Crc16Table() : t() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+            t[i] = crc;
+        }
+    }
+};
+
+static constexpr Crc16Table k_crc16;
+
+uint16_t crc16(const char *buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 8) ^ k_crc16.t[((crc >> 8) ^ (uint8_t)buf[i]) & 0xff]);
+    }
+    return crc;
+}
+
+uint32_t keyHashSlot(const char *key, size_t len) {
+    const char *open = (const char *)memchr(key, '{', len);
+    if (open) {
+        size_t start = (size_t)(open - key) + 1;
+        const char *close = (const char *)memchr(open + 1, '}', len - start);
+        // "{}" hashes the whole key
+        if (close && close != open + 1) {
+            return crc16(open + 1, (size_t)(close - open - 1)) & (k_cluster_slots - 1);
+        }
+    }
+    return crc16(key, len) & (k_cluster_slots - 1);
+}
+
+void clusterInit(Cluster *cl, const std::string &self) {
+    cl->nodes.assign(1, self);
+    cl->slots.assign(k_cluster_slots, ClusterSlot());
+}
+
+int32_t clusterNode(Cluster *cl, const std::string &addr) {
+    for (size_t i = 0; i < cl->nodes.size(); i++) {
+        if (cl->nodes[i] == addr) {
+            return (int32_t)i;
+        }
+    }
+    cl->nodes.push_back(addr);
+    return (int32_t)cl->nodes.size() - 1;
+}
+
+bool clusterParseAddr(const std::string &addr, std::string &host, uint16_t &port) {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon + 1 == addr.size()) {
+        return false;
+    }
+    host = addr.substr(0, colon);
+    struct in_addr tmp;
+    if (inet_pton(AF_INET, host.c_str(), &tmp) != 1) {
+        return false;
+    }
+    char *endp = NULL;
+    long n = strtol(addr.c_str() + colon + 1, &endp, 10);
+    if (*endp != '\0' || n <= 0 || n > 65535) {
+        return false;
+    }
+    port = (uint16_t)n;
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// The keyspace split of Redis Cluster: 16384 hash slots, a key goes to
+// CRC16(key) % 16384. If the key has a non-empty `{...}`, only the part
+// between the first '{' and the next '}' is hashed, so related keys can
+// be kept in one slot and used together.
+const uint32_t k_cluster_slots = 16384;
+
+uint16_t crc16(const char *buf, size_t len);
+uint32_t keyHashSlot(const char *key, size_t len);
+
+const int32_t k_no_node = -1;
+
+struct ClusterSlot {
+    // index into Cluster::nodes, k_no_node while unassigned
+    int32_t owner = k_no_node;
+    // during a move, the node keys go to (on the owner) or come from
+    int32_t migrating = k_no_node;
+    int32_t importing = k_no_node;
+};
+
+// Who serves which slot, as this node knows it. There is no gossip: every
+// node is told the whole map with CLUSTER ADDSLOTSRANGE / SETSLOT.
+struct Cluster {
+    // "host:port" of the nodes, [0] is this one
+    std::vector<std::string> nodes;
+    std::vector<ClusterSlot> slots;
+};
+
+void clusterInit(Cluster *cl, const std::string &self);
+// index of the node at `addr`, added if new
+int32_t clusterNode(Cluster *cl, const std::string &addr);
+// "host:port" with a numeric IPv4 host
+bool clusterParseAddr(const std::string &addr, std::string &host, uint16_t &port);
@@ -0,0 +1,40 @@
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include "cluster.h"
+
+static uint32_t slotOf(const char *key) {
+    return keyHashSlot(key, strlen(key));
+}
+
+int main() {
+    // the standard CRC-16/XMODEM check value
+    assert(crc16("123456789", 9) == 0x31C3);
+    assert(slotOf("foo") == 12182);
+    assert(slotOf("somekey") == 11058);
+
+    // only the first non-empty {...} is hashed
+    assert(slotOf("{user1000}.following") == slotOf("user1000"));
+    assert(slotOf("{user1000}.followers") == slotOf("user1000"));
+    assert(slotOf("foo{bar}{zap}") == slotOf("bar"));
+    assert(slotOf("foo{}{bar}") == crc16("foo{}{bar}", 10) % k_cluster_slots);
+    assert(slotOf("foo{{bar}}zap") == slotOf("{bar"));
+    assert(slotOf("foo{bar") == crc16("foo{bar", 7) % k_cluster_slots);
+    assert(slotOf("") == 0);
+
+    Cluster cl;
+    clusterInit(&cl, "127.0.0.1:7001");
+    assert(cl.slots.size() == k_cluster_slots && cl.slots[0].owner == k_no_node);
+    assert(clusterNode(&cl, "127.0.0.1:7001") == 0);
+    assert(clusterNode(&cl, "127.0.0.1:7002") == 1);
+    assert(clusterNode(&cl, "127.0.0.1:7002") == 1);
+
+    std::string host;
+    uint16_t port = 0;
+    assert(clusterParseAddr("127.0.0.1:7002", host, port) && host == "127.0.0.1" && port == 7002);
+    assert(!clusterParseAddr("127.0.0.1", host, port));
+    assert(!clusterParseAddr("127.0.0.1:", host, port));
+    assert(!clusterParseAddr("127.0.0.1:70000", host, port));
+    assert(!clusterParseAddr("localhost:7002", host, port));
+    return 0;
+}
@@ -1,9 +1,11 @@
+#pragma once
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 // FNV hash
-static uint64_t strHash(const uint8_t *data, size_t len) {
+static inline uint64_t strHash(const uint8_t *data, size_t len) {
     uint32_t h = 0x811C9DC5;
     for (size_t i = 0; i < len; i++) {
         h = (h + data[i]) * 0x01000193;
@@ -15,3 +17,52 @@ static uint64_t strHash(const uint8_t *data, size_t len) {
 #define container_of(ptr, type, member) ({                  \
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
     (type *)( (char *)__mptr - offsetof(type, member) );})
+
+// Only accepts the canonical decimal form of an int64 (no sign other
+// than '-', no leading zeros, no spaces), so int2str() gives back the
+// same bytes.
+static inline bool str2intExact(const char *s, size_t len, int64_t &out) {
+    if (len == 0 || len > 20) {
+        return false;
+    }
+    bool neg = s[0] == '-';
+    size_t i = neg ? 1 : 0;
+    if (i == len || (s[i] == '0' && (neg || len > 1))) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        uint64_t d = (uint64_t)(s[i] - '0');
+        if (v > (UINT64_MAX - d) / 10) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    if (v > (uint64_t)INT64_MAX + (neg ? 1 : 0)) {
+        return false;
+    }
+    out = neg ? (int64_t)(0 - v) : (int64_t)v;
+    return true;
+}
+
+// writes the decimal form of `v` to `buf` (at least 21 bytes), returns the length
+static inline size_t int2str(int64_t v, char *buf) {
+    char tmp[24];
+    size_t n = 0;
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    size_t len = 0;
+    if (v < 0) {
+        buf[len++] = '-';
+    }
+    while (n) {
+        buf[len++] = tmp[--n];
+    }
+    return len;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdlib.h>
+#include <coroutine>
+
+// A command handler that can pause. The coroutine starts running as soon
+// as it is called; a `co_await` that suspends returns to the caller with
+// the task not done(), and whoever holds the task resume()s it later.
+// Move-only, destroying a paused task destroys its frame and locals.
+struct CoTask {
+    struct promise_type {
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        // kept until the owner sees done()
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+
+    CoTask() = default;
+    explicit CoTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+    CoTask(CoTask &&other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+    CoTask &operator=(CoTask &&other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+    ~CoTask() { reset(); }
+
+    // paused at a co_await, not finished
+    bool paused() const { return handle && !handle.done(); }
+    void resume() { handle.resume(); }
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
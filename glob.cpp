@@ -0,0 +1,277 @@
+#include <string.h>
+#include "glob.h"
+
+// matches one [...] class at pat[0] == '[' against `c`; returns the
+// length of the class, or 0 if it is not terminated
+static size_t matchClass(const char *pat, size_t plen, char c, bool *hit) {
+    size_t i = 1;
+    bool negate = i < plen && pat[i] == '^';
+    if (negate) {
+        i++;
+    }
+    bool found = false;
+    for (; i < plen && pat[i] != ']'; i++) {
+        if (pat[i] == '\\' && i + 1 < plen) {
+            i++;
+            found |= pat[i] == c;
+        } else if (i + 2 < plen && pat[i + 1] == '-' && pat[i + 2] != ']') {
+            char lo = pat[i], hi = pat[i + 2];
+            if (lo > hi) {
+                char t = lo;
+                lo = hi;
+                hi = t;
+            }
+            found |= c >= lo && c <= hi;
+            i += 2;
+        } else {
+            found |= pat[i] == c;
+        }
+    }
+    if (i >= plen) {
+        return 0;
+    }
+    *hit = found != negate;
+    return i + 1;
+}
+
+bool globMatch(const char *pat, size_t plen, const char *str, size_t slen) {
+    while (plen > 0) {
+        switch (pat[0]) {
+        case '*':
+            // collapse runs of stars, then try every suffix
+            while (plen > 1 && pat[1] == '*') {
+                pat++;
+                plen--;
+            }
+            if (plen == 1) {
+                return true;
+            }
+            for (size_t i = 0; i <= slen; i++) {
+                if (globMatch(pat + 1, plen - 1, str + i, slen - i)) {
+                    return true;
+                }
+            }
+            return false;
+        case '?':
+            if (slen == 0) {
+                return false;
+            }
+            break;
+        case '[': {
+            if (slen == 0) {
+                return false;
+            }
+            bool hit = false;
+            size_t n = matchClass(pat, plen, str[0], &hit);
+            if (n == 0) {
+                // unterminated, a literal '['
+                if (str[0] != '[') {
+                    return false;
+                }
+                break;
+            }
+            if (!hit) {
+                return false;
+            }
+            pat += n;
+            plen -= n;
+            str++;
+            slen--;
+            continue;
+        }
+        case '\\':
+            if (plen > 1) {
+                pat++;
+                plen--;
+            }
+            // fallthrough
+        default:
+            if (slen == 0 || pat[0] != str[0]) {
+                return false;
+            }
+            break;
+        }
+        pat++;
+        plen--;
+        str++;
+        slen--;
+    }
+    return slen == 0;
+}
+
+static void segAppend(GlobSegment *seg, int16_t kind, char c) {
+    seg->kinds.push_back(kind);
+    seg->lit.push_back(c);
+    if (kind != GLOB_LIT) {
+        seg->literal = false;
+    } else if (seg->anchor < 0) {
+        seg->anchor = (int32_t)seg->lit.size() - 1;
+    }
+}
+
+void globCompile(GlobPattern *gp, const char *pat, size_t plen) {
+    *gp = GlobPattern();
+    GlobSegment seg;
+    size_t i = 0;
+    while (i < plen) {
+        char c = pat[i];
+        gp->starEnd = c == '*';
+        if (c == '*') {
+            gp->hasStar = true;
+            if (i == 0) {
+                gp->starStart = true;
+            }
+            if (!seg.kinds.empty()) {
+                gp->segs.push_back(std::move(seg));
+                seg = GlobSegment();
+            }
+            i++;
+            continue;
+        }
+        if (c == '?') {
+            segAppend(&seg, GLOB_ANY, 0);
+            i++;
+            continue;
+        }
+        if (c == '[') {
+            // the same class semantics as globMatch(), byte by byte
+            GlobClass cls = {};
+            size_t n = 0;
+            for (int b = 0; b < 256; b++) {
+                bool hit = false;
+                n = matchClass(pat + i, plen - i, (char)b, &hit);
+                if (n && hit) {
+                    cls.bits[b >> 6] |= (uint64_t)1 << (b & 63);
+                }
+            }
+            if (n == 0) {
+                // unterminated, a literal '['
+                segAppend(&seg, GLOB_LIT, '[');
+                i++;
+                continue;
+            }
+            gp->classes.push_back(cls);
+            segAppend(&seg, (int16_t)(gp->classes.size() - 1), 0);
+            i += n;
+            continue;
+        }
+        if (c == '\\' && i + 1 < plen) {
+            i++;
+            c = pat[i];
+        }
+        segAppend(&seg, GLOB_LIT, c);
+        i++;
+    }
+    if (!seg.kinds.empty()) {
+        gp->segs.push_back(std::move(seg));
+    }
+    for (const GlobSegment &s : gp->segs) {
+        gp->minLen += s.kinds.size();
+    }
+    if (!gp->starStart && !gp->segs.empty()) {
+        const GlobSegment &first = gp->segs[0];
+        size_t n = 0;
+        while (n < first.kinds.size() && first.kinds[n] == GLOB_LIT) {
+            n++;
+        }
+        gp->prefix = first.lit.substr(0, n);
+    }
+}
+
+static bool classHas(const GlobClass &cls, uint8_t c) {
+    return (cls.bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static bool segMatchAt(const GlobPattern *gp, const GlobSegment &seg, const char *str) {
+    if (seg.literal) {
+        return memcmp(seg.lit.data(), str, seg.lit.size()) == 0;
+    }
+    for (size_t i = 0; i < seg.kinds.size(); i++) {
+        int16_t kind = seg.kinds[i];
+        if (kind == GLOB_LIT) {
+            if (str[i] != seg.lit[i]) {
+                return false;
+            }
+        } else if (kind != GLOB_ANY && !classHas(gp->classes[kind], (uint8_t)str[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the leftmost position in [lo, hi - len] where `seg` matches, or -1
+static ptrdiff_t segFind(const GlobPattern *gp, const GlobSegment &seg,
+    const char *str, size_t lo, size_t hi)
+{
+    size_t len = seg.kinds.size();
+    if (hi - lo < len) {
+        return -1;
+    }
+    size_t last = hi - len;
+    if (seg.anchor < 0) {
+        for (size_t pos = lo; pos <= last; pos++) {
+            if (segMatchAt(gp, seg, str + pos)) {
+                return (ptrdiff_t)pos;
+            }
+        }
+        return -1;
+    }
+    // candidates have the anchor byte in place
+    size_t k = (size_t)seg.anchor;
+    char c = seg.lit[k];
+    size_t pos = lo;
+    while (pos <= last) {
+        const char *hit = (const char *)memchr(str + pos + k, c, last - pos + 1);
+        if (!hit) {
+            return -1;
+        }
+        pos = (size_t)(hit - str) - k;
+        if (segMatchAt(gp, seg, str + pos)) {
+            return (ptrdiff_t)pos;
+        }
+        pos++;
+    }
+    return -1;
+}
+
+bool globMatchCompiled(const GlobPattern *gp, const char *str, size_t slen) {
+    if (slen < gp->minLen) {
+        return false;
+    }
+    size_t nseg = gp->segs.size();
+    if (gp->hasStar && nseg == 0) {
+        return true;
+    }
+    if (!gp->hasStar) {
+        return slen == gp->minLen && (nseg == 0 || segMatchAt(gp, gp->segs[0], str));
+    }
+    size_t first = 0, end = nseg;
+    size_t lo = 0, hi = slen;
+    if (!gp->starStart) {
+        const GlobSegment &seg = gp->segs[0];
+        if (!segMatchAt(gp, seg, str)) {
+            return false;
+        }
+        lo = seg.kinds.size();
+        first = 1;
+    }
+    if (!gp->starEnd) {
+        const GlobSegment &seg = gp->segs[nseg - 1];
+        size_t len = seg.kinds.size();
+        if (hi - lo < len || !segMatchAt(gp, seg, str + hi - len)) {
+            return false;
+        }
+        hi -= len;
+        end--;
+    }
+    // fixed-length pieces between stars: the leftmost fit leaves the
+    // most room for the rest
+    for (size_t i = first; i < end; i++) {
+        ptrdiff_t pos = segFind(gp, gp->segs[i], str, lo, hi);
+        if (pos < 0) {
+            return false;
+        }
+        lo = (size_t)pos + gp->segs[i].kinds.size();
+    }
+    return true;
+}
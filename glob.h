@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Redis-style glob: `*`, `?`, `[abc]`, `[^a-z]` and `\` escapes.
+bool globMatch(const char *pat, size_t plen, const char *str, size_t slen);
+
+// A pattern compiled for matching many strings, e.g. every key for KEYS.
+// The stars cut it into fixed-length segments: the first and last are
+// anchored to the ends of the string unless the pattern starts or ends
+// with a star, the others are found leftmost in order. Matches exactly
+// what globMatch() does.
+struct GlobSegment {
+    // per position: GLOB_LIT for the byte of `lit` there, GLOB_ANY for
+    // `?`, or an index into GlobPattern::classes
+    std::vector<int16_t> kinds;
+    std::string lit;
+    // only literal bytes, compared with memcmp()
+    bool literal = true;
+    // the first literal position, candidates are found with memchr() on
+    // it; -1 if there is none
+    int32_t anchor = -1;
+};
+
+const int16_t GLOB_LIT = -1;
+const int16_t GLOB_ANY = -2;
+
+// the bytes a `[...]` matches
+struct GlobClass {
+    uint64_t bits[4];
+};
+
+struct GlobPattern {
+    std::vector<GlobSegment> segs;
+    std::vector<GlobClass> classes;
+    bool starStart = false;
+    bool starEnd = false;
+    bool hasStar = false;
+    // the shortest string that can match
+    size_t minLen = 0;
+    // literal bytes every match starts with
+    std::string prefix;
+};
+
+void globCompile(GlobPattern *gp, const char *pat, size_t plen);
+bool globMatchCompiled(const GlobPattern *gp, const char *str, size_t slen);
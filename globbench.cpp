@@ -0,0 +1,108 @@
+// Times pattern matching over a set of keys, globMatch() against a
+// pattern compiled once with globCompile().
+//
+//   ./globbench [-n keys] [-r rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "glob.h"
+
+static uint64_t getMonotonicNs() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// xorshift64*
+static uint64_t gRng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rnd() {
+    gRng ^= gRng >> 12;
+    gRng ^= gRng << 25;
+    gRng ^= gRng >> 27;
+    return gRng * 0x2545F4914F6CDD1Dull;
+}
+
+// key shapes seen in practice
+static std::string randKey() {
+    char buf[96];
+    switch (rnd() % 4) {
+    case 0:
+        snprintf(buf, sizeof(buf), "user:%llu:session", (unsigned long long)(rnd() % 10000000));
+        break;
+    case 1:
+        snprintf(buf, sizeof(buf), "user:%llu:profile:%s", (unsigned long long)(rnd() % 10000000),
+            rnd() % 2 ? "name" : "email");
+        break;
+    case 2:
+        snprintf(buf, sizeof(buf), "cache:page:/articles/%llu/comments?page=%llu",
+            (unsigned long long)(rnd() % 100000), (unsigned long long)(rnd() % 50));
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "key:%012llu", (unsigned long long)(rnd() % 100000000));
+    }
+    return buf;
+}
+
+static const char *const k_patterns[] = {
+    "user:123*",
+    "*:session",
+    "user:*:profile:email",
+    "cache:page:*comments?page=4?",
+    "*[0-9][0-9]:session",
+    "*a*e*i*o*u*",
+    "key:0000000?????",
+    "*",
+};
+
+int main(int argc, char **argv) {
+    size_t n = 1000000, rounds = 3;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) {
+            n = (size_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-r")) {
+            rounds = (size_t)atol(argv[i + 1]);
+        }
+    }
+    std::vector<std::string> keys(n);
+    for (std::string &k : keys) {
+        k = randKey();
+    }
+    printf("%zu keys, best of %zu rounds, ns per key\n", n, rounds);
+    printf("%-32s %10s %10s %8s %10s\n", "pattern", "globMatch", "compiled", "speedup", "matches");
+    for (const char *pat : k_patterns) {
+        size_t plen = strlen(pat);
+        uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+        size_t hits[2] = {0, 0};
+        for (size_t r = 0; r < rounds; r++) {
+            uint64_t t0 = getMonotonicNs();
+            size_t h = 0;
+            for (const std::string &k : keys) {
+                h += globMatch(pat, plen, k.data(), k.size());
+            }
+            uint64_t t1 = getMonotonicNs();
+            // compiling is part of the cost, once per request
+            GlobPattern gp;
+            globCompile(&gp, pat, plen);
+            size_t hc = 0;
+            for (const std::string &k : keys) {
+                hc += globMatchCompiled(&gp, k.data(), k.size());
+            }
+            uint64_t t2 = getMonotonicNs();
+            best[0] = std::min(best[0], t1 - t0);
+            best[1] = std::min(best[1], t2 - t1);
+            hits[0] = h;
+            hits[1] = hc;
+        }
+        if (hits[0] != hits[1]) {
+            fprintf(stderr, "%s: %zu vs %zu matches\n", pat, hits[0], hits[1]);
+            return 1;
+        }
+        printf("%-32s %10.1f %10.1f %7.1fx %10zu\n", pat, (double)best[0] / (double)n,
+            (double)best[1] / (double)n, (double)best[0] / (double)best[1], hits[0]);
+    }
+    return 0;
+}
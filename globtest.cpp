@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "glob.h"
+
+static bool compiled(const std::string &pat, const std::string &str) {
+    GlobPattern gp;
+    globCompile(&gp, pat.data(), pat.size());
+    return globMatchCompiled(&gp, str.data(), str.size());
+}
+
+static bool naive(const std::string &pat, const std::string &str) {
+    return globMatch(pat.data(), pat.size(), str.data(), str.size());
+}
+
+static uint64_t gRng = 1;
+
+static uint64_t rnd() {
+    gRng ^= gRng << 13;
+    gRng ^= gRng >> 7;
+    gRng ^= gRng << 17;
+    return gRng;
+}
+
+static std::string randStr(const char *chars, size_t maxLen) {
+    std::string s;
+    size_t n = rnd() % (maxLen + 1);
+    size_t nchars = strlen(chars);
+    for (size_t i = 0; i < n; i++) {
+        s += chars[rnd() % nchars];
+    }
+    return s;
+}
+
+int main() {
+    assert(compiled("", "") && !compiled("", "a"));
+    assert(compiled("*", "") && compiled("*", "anything"));
+    assert(compiled("user:*", "user:1") && !compiled("user:*", "use"));
+    assert(compiled("*:session", "u:1:session") && !compiled("*:session", "u:1:sessions"));
+    assert(compiled("a*b*c", "abc") && compiled("a*b*c", "axxbyyc") && !compiled("a*b*c", "acb"));
+    assert(compiled("a*a", "aa") && !compiled("a*a", "a"));
+    assert(compiled("h?llo", "hello") && !compiled("h?llo", "hllo"));
+    assert(compiled("h[ae]llo", "hallo") && !compiled("h[ae]llo", "hillo"));
+    assert(compiled("h[^e]llo", "hallo") && !compiled("h[^e]llo", "hello"));
+    assert(compiled("h[a-b]llo", "hbllo") && !compiled("h[a-b]llo", "hcllo"));
+    assert(compiled("\\*x", "*x") && !compiled("\\*x", "ax"));
+    assert(compiled("a\\*", "a*") && !compiled("a\\*", "ab"));
+    assert(compiled("[abc", "[abc") && compiled("x\\", "x\\"));
+    assert(compiled("*\xff*", "a\xff") && compiled("[\x80-\xff]", "\x90"));
+
+    GlobPattern gp;
+    globCompile(&gp, "user:1[0-9]*", 12);
+    assert(gp.prefix == "user:1");
+    globCompile(&gp, "a\\*b*", 5);
+    assert(gp.prefix == "a*b");
+    globCompile(&gp, "*a", 2);
+    assert(gp.prefix.empty());
+
+    // the same answers as globMatch() on random patterns
+    for (int i = 0; i < 2000000; i++) {
+        std::string pat = randStr("ab*?[]^-\\", 8);
+        std::string str = randStr("ab[]^-\\*", 8);
+        assert(compiled(pat, str) == naive(pat, str));
+    }
+    return 0;
+}
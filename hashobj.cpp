@@ -0,0 +1,242 @@
+#include <assert.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+// proj
+#include "hashobj.h"
+#include "hashtable.hpp"
+#include "common.hpp"
+
+static size_t loadLen(const char *p) {
+    return (uint8_t)*p;
+}
+
+// Packed records: [u8 flen][field][u8 vlen][value]. Returns the offset
+// of the record holding `field`, or hobj->used if there is none.
+static size_t packedFind(HashObj *hobj, const char *field, size_t flen) {
+    size_t pos = 0;
+    while (pos < hobj->used) {
+        size_t fl = loadLen(hobj->buf + pos);
+        size_t vl = loadLen(hobj->buf + pos + 1 + fl);
+        if (fl == flen && memcmp(hobj->buf + pos + 1, field, flen) == 0) {
+            return pos;
+        }
+        pos += 2 + fl + vl;
+    }
+    return pos;
+}
+
+static size_t packedRecordLen(HashObj *hobj, size_t pos) {
+    size_t fl = loadLen(hobj->buf + pos);
+    return 2 + fl + loadLen(hobj->buf + pos + 1 + fl);
+}
+
+// Replace buf[pos, pos + oldLen) with `newLen` bytes, returns where to write them.
+static char *packedSplice(HashObj *hobj, size_t pos, size_t oldLen, size_t newLen) {
+    size_t tail = hobj->used - pos - oldLen;
+    size_t used = hobj->used - oldLen + newLen;
+    // Grow to fit, the allocator's rounding is the only slack. The packed
+    // form is capped, so the copies are bounded; memory is what it is for.
+    if (newLen > oldLen && used > malloc_usable_size(hobj->buf)) {
+        hobj->buf = (char *)realloc(hobj->buf, used);
+        assert(hobj->buf);
+    }
+    memmove(hobj->buf + pos + newLen, hobj->buf + pos + oldLen, tail);
+    hobj->used = (uint32_t)used;
+    return hobj->buf + pos;
+}
+
+struct HFieldKey {
+    HNode node;
+    const char *field = NULL;
+    size_t flen = 0;
+};
+
+static bool fieldEq(HNode *node, HNode *key) {
+    HashField *hf = container_of(node, HashField, node);
+    HFieldKey *hkey = container_of(key, HFieldKey, node);
+    return hf->flen == hkey->flen && memcmp(hf->field, hkey->field, hf->flen) == 0;
+}
+
+static HashField *tableLookup(HashObj *hobj, const char *field, size_t flen) {
+    HFieldKey key;
+    key.node.hcode = strHash((const uint8_t *)field, flen);
+    key.field = field;
+    key.flen = flen;
+    HNode *node = hmLookup(&hobj->table->map, &key.node, &fieldEq);
+    return node ? container_of(node, HashField, node) : NULL;
+}
+
+static void fieldSetVal(HashObj *hobj, HashField *hf, const char *val, size_t vlen) {
+    hobj->table->fieldBytes -= hf->vlen;
+    free(hf->val);
+    hf->val = (char *)malloc(vlen ? vlen : 1);
+    assert(hf->val);
+    memcpy(hf->val, val, vlen);
+    hf->vlen = (uint32_t)vlen;
+    hobj->table->fieldBytes += vlen;
+}
+
+static void tableAdd(HashObj *hobj, const char *field, size_t flen, const char *val, size_t vlen) {
+    HashField *hf = (HashField *)malloc(sizeof(HashField) + flen);
+    assert(hf);
+    hf->node.next = NULL;
+    hf->node.hcode = strHash((const uint8_t *)field, flen);
+    hf->val = NULL;
+    hf->vlen = 0;
+    hf->flen = (uint32_t)flen;
+    memcpy(hf->field, field, flen);
+    hobj->table->fieldBytes += sizeof(HashField) + flen;
+    fieldSetVal(hobj, hf, val, vlen);
+    hmInsert(&hobj->table->map, &hf->node);
+}
+
+static void fieldDel(HashObj *hobj, HashField *hf) {
+    hobj->table->fieldBytes -= sizeof(HashField) + hf->flen + hf->vlen;
+    free(hf->val);
+    free(hf);
+}
+
+// one way: a hash that got big once is likely to stay big
+static void convertToTable(HashObj *hobj) {
+    char *buf = hobj->buf;
+    size_t used = hobj->used;
+    hobj->table = new HashTable();
+    hobj->used = 0;
+    hobj->encoding = HASH_TABLE;
+    size_t pos = 0;
+    while (pos < used) {
+        const char *p = buf + pos;
+        size_t fl = loadLen(p);
+        size_t vl = loadLen(p + 1 + fl);
+        tableAdd(hobj, p + 1, fl, p + 2 + fl, vl);
+        pos += 2 + fl + vl;
+    }
+    free(buf);
+}
+
+bool hobjGet(HashObj *hobj, const char *field, size_t flen, const char **val, size_t *vlen) {
+    if (hobj->encoding == HASH_TABLE) {
+        HashField *hf = tableLookup(hobj, field, flen);
+        if (!hf) {
+            return false;
+        }
+        *val = hf->val;
+        *vlen = hf->vlen;
+        return true;
+    }
+    size_t pos = packedFind(hobj, field, flen);
+    if (pos == hobj->used) {
+        return false;
+    }
+    const char *p = hobj->buf + pos + 1 + flen;
+    *vlen = loadLen(p);
+    *val = p + 1;
+    return true;
+}
+
+bool hobjSet(HashObj *hobj, const char *field, size_t flen, const char *val, size_t vlen) {
+    if (hobj->encoding == HASH_PACKED) {
+        size_t pos = packedFind(hobj, field, flen);
+        bool added = pos == hobj->used;
+        if (flen > k_hash_packed_max_value || vlen > k_hash_packed_max_value
+            || (added && hobj->len >= k_hash_packed_max_fields)) {
+            convertToTable(hobj);
+        } else {
+            size_t oldLen = added ? 0 : packedRecordLen(hobj, pos);
+            char *p = packedSplice(hobj, pos, oldLen, 2 + flen + vlen);
+            p[0] = (char)flen;
+            memcpy(p + 1, field, flen);
+            p[1 + flen] = (char)vlen;
+            memcpy(p + 2 + flen, val, vlen);
+            hobj->len += added;
+            return added;
+        }
+    }
+    HashField *hf = tableLookup(hobj, field, flen);
+    if (hf) {
+        fieldSetVal(hobj, hf, val, vlen);
+        return false;
+    }
+    tableAdd(hobj, field, flen, val, vlen);
+    hobj->len++;
+    return true;
+}
+
+bool hobjDel(HashObj *hobj, const char *field, size_t flen) {
+    if (hobj->encoding == HASH_TABLE) {
+        HFieldKey key;
+        key.node.hcode = strHash((const uint8_t *)field, flen);
+        key.field = field;
+        key.flen = flen;
+        HNode *node = hmDelete(&hobj->table->map, &key.node, &fieldEq);
+        if (!node) {
+            return false;
+        }
+        fieldDel(hobj, container_of(node, HashField, node));
+        hobj->len--;
+        return true;
+    }
+    size_t pos = packedFind(hobj, field, flen);
+    if (pos == hobj->used) {
+        return false;
+    }
+    packedSplice(hobj, pos, packedRecordLen(hobj, pos), 0);
+    hobj->len--;
+    return true;
+}
+
+struct ForEachArg {
+    bool (*cb)(const char *, size_t, const char *, size_t, void *);
+    void *arg;
+};
+
+static bool cbField(HNode *node, void *arg) {
+    HashField *hf = container_of(node, HashField, node);
+    ForEachArg *fa = (ForEachArg *)arg;
+    return fa->cb(hf->field, hf->flen, hf->val, hf->vlen, fa->arg);
+}
+
+void hobjForEach(HashObj *hobj,
+    bool (*cb)(const char *field, size_t flen, const char *val, size_t vlen, void *arg),
+    void *arg)
+{
+    if (hobj->encoding == HASH_TABLE) {
+        ForEachArg fa = {cb, arg};
+        hmForEach(&hobj->table->map, &cbField, &fa);
+        return;
+    }
+    size_t pos = 0;
+    while (pos < hobj->used) {
+        const char *p = hobj->buf + pos;
+        size_t fl = loadLen(p);
+        size_t vl = loadLen(p + 1 + fl);
+        if (!cb(p + 1, fl, p + 2 + fl, vl, arg)) {
+            return;
+        }
+        pos += 2 + fl + vl;
+    }
+}
+
+static bool cbFree(HNode *node, void *arg) {
+    fieldDel((HashObj *)arg, container_of(node, HashField, node));
+    return true;
+}
+
+void hobjClear(HashObj *hobj) {
+    if (hobj->encoding == HASH_TABLE) {
+        hmForEach(&hobj->table->map, &cbFree, hobj);
+        hmClear(&hobj->table->map);
+        delete hobj->table;
+    } else {
+        free(hobj->buf);
+    }
+    *hobj = HashObj{};
+}
+
+size_t hobjMemUsage(HashObj *hobj) {
+    if (hobj->encoding == HASH_PACKED) {
+        return hobj->buf ? malloc_usable_size(hobj->buf) : 0;
+    }
+    return sizeof(HashTable) + hobj->table->fieldBytes + hmMemUsage(&hobj->table->map);
+}
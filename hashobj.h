@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.hpp"
+
+// A field -> value map. Small hashes are a packed array of
+// (u8 flen, field, u8 vlen, value) records searched linearly; once
+// they outgrow the limits below they convert, one way, to an HMap.
+enum {
+    HASH_PACKED = 0,
+    HASH_TABLE = 1,
+};
+
+const size_t k_hash_packed_max_fields = 128;
+const size_t k_hash_packed_max_value = 64;
+static_assert(k_hash_packed_max_value <= 255, "packed lengths are one byte");
+
+struct HashTable {
+    HMap map;
+    // bytes allocated for the fields
+    size_t fieldBytes = 0;
+};
+
+// 16 bytes, so it lives inside the Entry; most hashes never leave the
+// packed form. Zero-initialize (`HashObj h = {}`) for an empty hash.
+struct HashObj {
+    uint32_t encoding : 1;
+    // number of fields
+    uint32_t len : 31;
+    // HASH_PACKED bytes in use
+    uint32_t used;
+    union {
+        char *buf;
+        HashTable *table;
+    };
+};
+
+struct HashField {
+    HNode node;
+    char *val = NULL;
+    uint32_t vlen = 0;
+    uint32_t flen = 0;
+    char field[0];
+};
+
+// Values returned by hobjGet() point into the object and are valid
+// until it is next modified.
+bool hobjGet(HashObj *hobj, const char *field, size_t flen, const char **val, size_t *vlen);
+// returns true if the field was added
+bool hobjSet(HashObj *hobj, const char *field, size_t flen, const char *val, size_t vlen);
+bool hobjDel(HashObj *hobj, const char *field, size_t flen);
+void hobjForEach(HashObj *hobj,
+    bool (*cb)(const char *field, size_t flen, const char *val, size_t vlen, void *arg),
+    void *arg);
+void hobjClear(HashObj *hobj);
+size_t hobjMemUsage(HashObj *hobj);
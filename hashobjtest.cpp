@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <map>
+#include <string>
+#include "hashobj.h"
+
+typedef std::map<std::string, std::string> Ref;
+
+static bool cbCollect(const char *field, size_t flen, const char *val, size_t vlen, void *arg) {
+    Ref &seen = *(Ref *)arg;
+    bool fresh = seen.emplace(std::string(field, flen), std::string(val, vlen)).second;
+    assert(fresh);
+    return true;
+}
+
+static void verify(HashObj &h, const Ref &ref) {
+    assert(h.len == ref.size());
+    for (auto &kv : ref) {
+        const char *val = NULL;
+        size_t vlen = 0;
+        assert(hobjGet(&h, kv.first.data(), kv.first.size(), &val, &vlen));
+        assert(std::string(val, vlen) == kv.second);
+    }
+    Ref seen;
+    hobjForEach(&h, &cbCollect, &seen);
+    assert(seen == ref);
+}
+
+static void set(HashObj &h, Ref &ref, const std::string &f, const std::string &v) {
+    bool added = hobjSet(&h, f.data(), f.size(), v.data(), v.size());
+    assert(added == (ref.count(f) == 0));
+    ref[f] = v;
+}
+
+static void del(HashObj &h, Ref &ref, const std::string &f) {
+    bool deleted = hobjDel(&h, f.data(), f.size());
+    assert(deleted == (ref.erase(f) == 1));
+}
+
+static void test_packed() {
+    HashObj h = {};
+    Ref ref;
+    verify(h, ref);
+    set(h, ref, "name", "alice");
+    set(h, ref, "age", "30");
+    set(h, ref, "name", "bob");      // shrink in place
+    set(h, ref, "age", "3000000");   // grow in place
+    set(h, ref, "", "");
+    verify(h, ref);
+    del(h, ref, "name");
+    del(h, ref, "name");
+    del(h, ref, "");
+    verify(h, ref);
+    assert(h.encoding == HASH_PACKED);
+    hobjClear(&h);
+    assert(h.len == 0 && !h.buf);
+}
+
+static void test_convert_by_count() {
+    HashObj h = {};
+    Ref ref;
+    for (size_t i = 0; i < k_hash_packed_max_fields; i++) {
+        set(h, ref, "f" + std::to_string(i), std::to_string(i));
+    }
+    assert(h.encoding == HASH_PACKED);
+    // updating a field does not convert
+    set(h, ref, "f0", "x");
+    assert(h.encoding == HASH_PACKED);
+    set(h, ref, "one-more", "v");
+    assert(h.encoding == HASH_TABLE);
+    verify(h, ref);
+    for (size_t i = 0; i < 1000; i++) {
+        set(h, ref, "g" + std::to_string(i), std::string(i % 100, 'v'));
+        if (i % 3 == 0) {
+            del(h, ref, "f" + std::to_string(i % k_hash_packed_max_fields));
+        }
+    }
+    verify(h, ref);
+    assert(h.table->fieldBytes > 0);
+    hobjClear(&h);
+    assert(h.len == 0 && h.encoding == HASH_PACKED && !h.buf);
+}
+
+static void test_convert_by_size() {
+    HashObj h = {};
+    Ref ref;
+    set(h, ref, "small", "v");
+    set(h, ref, "big", std::string(k_hash_packed_max_value + 1, 'x'));
+    assert(h.encoding == HASH_TABLE);
+    verify(h, ref);
+    hobjClear(&h);
+
+    ref.clear();
+    set(h, ref, std::string(k_hash_packed_max_value + 1, 'f'), "v");
+    assert(h.encoding == HASH_TABLE);
+    verify(h, ref);
+    hobjClear(&h);
+}
+
+int main() {
+    test_packed();
+    test_convert_by_count();
+    test_convert_by_size();
+    return 0;
+}
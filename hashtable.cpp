@@ -104,28 +104,131 @@ size_t hmSize(HMap *hmap) {
 }
 
 void hmForEach(HMap *hmap, bool(*cb)(HNode *, void *), void *arg) {
-    for (size_t i = 0; i < hmap->newer.size; i++) {
-        HNode *node = hmap->newer.tab[i];
-        while (node) {
-            if (!cb(node, arg)) {
-                return;
-            }
-            node = node->next;
+    // walk every slot, not just `size` of them; `next` is read before
+    // the callback so it may free the node
+    HTab *tabs[2] = {&hmap->newer, &hmap->older};
+    for (HTab *htab : tabs) {
+        if (!htab->tab) {
+            continue;
         }
-    }
-    for (size_t i = 0; i < hmap->older.size; i++) {
-        HNode *node = hmap->older.tab[i];
-        while (node) {
-            if (!cb(node, arg)) {
-                return;
+        for (size_t i = 0; i <= htab->mask; i++) {
+            HNode *node = htab->tab[i];
+            while (node) {
+                HNode *next = node->next;
+                if (!cb(node, arg)) {
+                    return;
+                }
+                node = next;
             }
-            node = node->next;
         }
     }
 }
 
+static void scanSlot(HTab *htab, size_t pos, void (*cb)(HNode *, void *), void *arg) {
+    for (HNode *node = htab->tab[pos]; node; node = node->next) {
+        cb(node, arg);
+    }
+}
+
+static size_t bitReverse(size_t v) {
+    size_t r = 0;
+    for (size_t i = 0; i < sizeof(v) * 8; i++, v >>= 1) {
+        r = (r << 1) | (v & 1);
+    }
+    return r;
+}
+
+// increment the slot bits of `cursor` from the top down
+static size_t scanNext(size_t cursor, size_t mask) {
+    cursor |= ~mask;
+    return bitReverse(bitReverse(cursor) + 1);
+}
+
+// The cursor walks slots in bit-reversed order, the scheme of Redis'
+// dictScan(). When a table doubles, slot i splits into i and i + n; both
+// sort right after where i was, so a slot scanned before the resize has
+// its halves scanned too and the ones after it are yet to come. During
+// rehashing a step covers an older slot together with every newer slot
+// it migrates to.
+size_t hmScan(HMap *hmap, size_t cursor, void (*cb)(HNode *, void *), void *arg) {
+    if (!hmap->newer.tab) {
+        return 0;
+    }
+    if (!hmap->older.tab) {
+        scanSlot(&hmap->newer, cursor & hmap->newer.mask, cb, arg);
+        return scanNext(cursor, hmap->newer.mask);
+    }
+    // the older table is the smaller one
+    size_t m0 = hmap->older.mask, m1 = hmap->newer.mask;
+    scanSlot(&hmap->older, cursor & m0, cb, arg);
+    do {
+        scanSlot(&hmap->newer, cursor & m1, cb, arg);
+        cursor = scanNext(cursor, m1);
+    } while (cursor & (m0 ^ m1));
+    return cursor;
+}
+
 void hmClear(HMap *hmap) {
     free(hmap->newer.tab);
     free(hmap->older.tab);
     *hmap = HMap{};
+}
+
+// Batched lookups hash all keys first, then hmPrefetch() every slot,
+// then hmPrefetchHead() every chain head (the slots are cached by now),
+// and only then probe, so the cache misses overlap.
+void hmPrefetch(HMap *hmap, uint64_t hcode) {
+    if (hmap->newer.tab) {
+        __builtin_prefetch(&hmap->newer.tab[hcode & hmap->newer.mask]);
+    }
+    if (hmap->older.tab) {
+        __builtin_prefetch(&hmap->older.tab[hcode & hmap->older.mask]);
+    }
+}
+
+void hmPrefetchHead(HMap *hmap, uint64_t hcode) {
+    if (hmap->newer.tab) {
+        __builtin_prefetch(hmap->newer.tab[hcode & hmap->newer.mask]);
+    }
+    if (hmap->older.tab) {
+        __builtin_prefetch(hmap->older.tab[hcode & hmap->older.mask]);
+    }
+}
+
+// Collect up to n nodes from consecutive slots beginning at `start`
+// (taken modulo the table size). Callers pass a random start to get an
+// approximate sample without walking the whole table.
+size_t hmSample(HMap *hmap, size_t start, HNode **out, size_t n) {
+    size_t got = 0;
+    HTab *tabs[2] = {&hmap->newer, &hmap->older};
+    for (HTab *ht : tabs) {
+        if (!ht->tab || ht->size == 0) {
+            continue;
+        }
+        // a sparse table may need many empty slots skipped, but stop
+        // early once something has been found
+        size_t slots = ht->mask + 1;
+        for (size_t i = 0; i < slots && got < n; i++) {
+            if (got > 0 && i >= n * 10) {
+                break;
+            }
+            HNode *node = ht->tab[(start + i) & ht->mask];
+            for (; node && got < n; node = node->next) {
+                out[got++] = node;
+            }
+        }
+    }
+    return got;
+}
+
+// bytes held by the slot arrays
+size_t hmMemUsage(HMap *hmap) {
+    size_t slots = 0;
+    if (hmap->newer.tab) {
+        slots += hmap->newer.mask + 1;
+    }
+    if (hmap->older.tab) {
+        slots += hmap->older.mask + 1;
+    }
+    return slots * sizeof(HNode *);
 }
\ No newline at end of file
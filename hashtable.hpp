@@ -27,4 +27,13 @@ void hmInsert(HMap *hmap, HNode *node);
 HNode *hmDelete(HMap *hmap, HNode *key, bool(*eq)(HNode *, HNode *));
 size_t hmSize(HMap *hmap);
 void hmForEach(HMap *hmap, bool(*cb)(HNode *, void *), void *arg);
-void hmClear(HMap *hmap);
\ No newline at end of file
+// Visits one or more slots, returns the cursor for the next call, 0 when
+// done. Start from 0. Nodes present for the whole scan are visited
+// exactly once, even if the map grows in between; `cb` must not modify
+// the map.
+size_t hmScan(HMap *hmap, size_t cursor, void (*cb)(HNode *, void *), void *arg);
+void hmClear(HMap *hmap);
+void hmPrefetch(HMap *hmap, uint64_t hcode);
+void hmPrefetchHead(HMap *hmap, uint64_t hcode);
+size_t hmSample(HMap *hmap, size_t start, HNode **out, size_t n);
+size_t hmMemUsage(HMap *hmap);
\ No newline at end of file
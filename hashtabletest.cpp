@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <map>
+#include <vector>
+#include "hashtable.hpp"
+#include "common.hpp"
+
+struct Item {
+    HNode node;
+    uint64_t val = 0;
+};
+
+static bool itemEq(HNode *a, HNode *b) {
+    return container_of(a, Item, node)->val == container_of(b, Item, node)->val;
+}
+
+static void add(HMap &map, std::vector<Item *> &items, uint64_t val) {
+    Item *it = new Item();
+    it->val = val;
+    // poor hash codes on purpose, they make long chains
+    it->node.hcode = val * 0x9E3779B97F4A7C15ull >> 7;
+    hmInsert(&map, &it->node);
+    items.push_back(it);
+}
+
+static void cbCount(HNode *node, void *arg) {
+    std::map<uint64_t, int> &seen = *(std::map<uint64_t, int> *)arg;
+    seen[container_of(node, Item, node)->val]++;
+}
+
+// keys present for the whole scan come out exactly once, with the map
+// growing and rehashing between the steps
+static void test_scan_while_growing(size_t initial, size_t addPerStep) {
+    HMap map;
+    std::vector<Item *> items;
+    for (uint64_t i = 0; i < initial; i++) {
+        add(map, items, i);
+    }
+    std::map<uint64_t, int> seen;
+    uint64_t next = initial;
+    size_t cursor = 0;
+    do {
+        cursor = hmScan(&map, cursor, &cbCount, &seen);
+        // bounded, a map growing faster than the scan would never end
+        for (size_t i = 0; i < addPerStep && next < initial * 8 + 64; i++) {
+            add(map, items, next++);
+        }
+    } while (cursor != 0);
+    for (uint64_t i = 0; i < initial; i++) {
+        assert(seen[i] == 1);
+    }
+    for (auto &kv : seen) {
+        assert(kv.second == 1);
+    }
+    hmClear(&map);
+    for (Item *it : items) {
+        delete it;
+    }
+}
+
+static void test_scan_with_deletes() {
+    HMap map;
+    std::vector<Item *> items;
+    for (uint64_t i = 0; i < 1000; i++) {
+        add(map, items, i);
+    }
+    std::map<uint64_t, int> seen;
+    size_t cursor = 0;
+    uint64_t victim = 1;
+    do {
+        cursor = hmScan(&map, cursor, &cbCount, &seen);
+        // odd keys go away during the scan, the even ones must all show
+        if (victim < 1000) {
+            Item key;
+            key.val = victim;
+            key.node.hcode = victim * 0x9E3779B97F4A7C15ull >> 7;
+            assert(hmDelete(&map, &key.node, &itemEq));
+            victim += 2;
+        }
+    } while (cursor != 0);
+    for (uint64_t i = 0; i < 1000; i += 2) {
+        assert(seen[i] == 1);
+    }
+    hmClear(&map);
+    for (Item *it : items) {
+        delete it;
+    }
+}
+
+int main() {
+    HMap empty;
+    assert(hmScan(&empty, 0, &cbCount, NULL) == 0);
+    test_scan_while_growing(0, 1);
+    test_scan_while_growing(1, 0);
+    test_scan_while_growing(100, 0);
+    test_scan_while_growing(100, 7);
+    test_scan_while_growing(10000, 3);
+    test_scan_while_growing(10000, 200);
+    test_scan_with_deletes();
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <assert.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+// proj
+#include "intset.h"
+
+static int64_t loadAt(const IntSet *is, size_t i) {
+    if (is->width == 4) {
+        int32_t v = 0;
+        memcpy(&v, is->data + i * 4, 4);
+        return v;
+    }
+    int64_t v = 0;
+    memcpy(&v, is->data + i * 8, 8);
+    return v;
+}
+
+static void storeAt(IntSet *is, size_t i, int64_t v) {
+    if (is->width == 4) {
+        int32_t v32 = (int32_t)v;
+        memcpy(is->data + i * 4, &v32, 4);
+    } else {
+        memcpy(is->data + i * 8, &v, 8);
+    }
+}
+
+// index of `v`, or of where it would be inserted
+static size_t search(const IntSet *is, int64_t v, bool *found) {
+    size_t lo = 0, hi = is->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int64_t cur = loadAt(is, mid);
+        if (cur < v) {
+            lo = mid + 1;
+        } else if (cur > v) {
+            hi = mid;
+        } else {
+            *found = true;
+            return mid;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+static IntSet *resize(IntSet *is, uint32_t width, size_t len) {
+    is = (IntSet *)realloc(is, sizeof(IntSet) + width * len);
+    assert(is);
+    return is;
+}
+
+bool intsetFind(const IntSet *is, int64_t v) {
+    if (!is || (is->width == 4 && (v < INT32_MIN || v > INT32_MAX))) {
+        return false;
+    }
+    bool found = false;
+    search(is, v, &found);
+    return found;
+}
+
+IntSet *intsetAdd(IntSet *is, int64_t v, bool *added) {
+    bool wide = v < INT32_MIN || v > INT32_MAX;
+    if (!is) {
+        is = resize(NULL, wide ? 8 : 4, 1);
+        is->width = wide ? 8 : 4;
+        is->len = 1;
+        storeAt(is, 0, v);
+        *added = true;
+        return is;
+    }
+    if (wide && is->width == 4) {
+        // widen in place, back to front; the new value goes to an end
+        is = resize(is, 8, is->len + 1);
+        for (size_t i = is->len; i-- > 0;) {
+            int32_t v32 = 0;
+            memcpy(&v32, is->data + i * 4, 4);
+            int64_t v64 = v32;
+            memcpy(is->data + (i + (v < 0)) * 8, &v64, 8);
+        }
+        is->width = 8;
+        storeAt(is, v < 0 ? 0 : is->len, v);
+        is->len++;
+        *added = true;
+        return is;
+    }
+    bool found = false;
+    size_t pos = search(is, v, &found);
+    *added = !found;
+    if (found) {
+        return is;
+    }
+    // the allocator's slack absorbs most of the reallocs
+    size_t need = sizeof(IntSet) + is->width * (is->len + 1);
+    if (need > malloc_usable_size(is)) {
+        is = resize(is, is->width, is->len + 1);
+    }
+    memmove(is->data + (pos + 1) * is->width, is->data + pos * is->width,
+        (is->len - pos) * is->width);
+    storeAt(is, pos, v);
+    is->len++;
+    return is;
+}
+
+IntSet *intsetRemove(IntSet *is, int64_t v, bool *removed) {
+    *removed = false;
+    if (!intsetFind(is, v)) {
+        return is;
+    }
+    bool found = false;
+    size_t pos = search(is, v, &found);
+    memmove(is->data + pos * is->width, is->data + (pos + 1) * is->width,
+        (is->len - pos - 1) * is->width);
+    is->len--;
+    *removed = true;
+    if (is->len == 0) {
+        free(is);
+        return NULL;
+    }
+    return is;
+}
+
+int64_t intsetGet(const IntSet *is, size_t i) {
+    return loadAt(is, i);
+}
+
+size_t intsetLen(const IntSet *is) {
+    return is ? is->len : 0;
+}
+
+size_t intsetMemUsage(const IntSet *is) {
+    return is ? malloc_usable_size((void *)is) : 0;
+}
+
+size_t intersectScalar32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+
+// Block-wise merge: compare a block of `a` against every rotation of a
+// block of `b`, so each element of the a-block is tested against each of
+// the b-block. Matching lanes are copied out, then whichever block has the
+// smaller maximum is advanced (both on a tie). The tail is merged scalar.
+size_t intersectSSE32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (mask) {
+            out[n++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int32_t amax = a[i + 3], bmax = b[j + 3];
+        i += amax <= bmax ? 4 : 0;
+        j += bmax <= amax ? 4 : 0;
+    }
+    return n + intersectScalar32(a + i, na - i, b + j, nb - j, out + n);
+}
+
+// the same with 8x8 blocks: 3 in-lane rotations, a lane swap, 3 more
+__attribute__((target("avx2")))
+size_t intersectAVX2_32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+        __m256i vs = _mm256_permute2x128_si256(vb, vb, 1);
+        __m256i eq0 = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi32(va, vb),
+                _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm256_or_si256(_mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        __m256i eq1 = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi32(va, vs),
+                _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm256_or_si256(_mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(1, 0, 3, 2))),
+                _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(2, 1, 0, 3)))));
+        uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(eq0, eq1)));
+        while (mask) {
+            out[n++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int32_t amax = a[i + 7], bmax = b[j + 7];
+        i += amax <= bmax ? 8 : 0;
+        j += bmax <= amax ? 8 : 0;
+    }
+    return n + intersectSSE32(a + i, na - i, b + j, nb - j, out + n);
+}
+
+bool intsetHaveAVX2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#else
+
+size_t intersectSSE32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    return intersectScalar32(a, na, b, nb, out);
+}
+
+size_t intersectAVX2_32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    return intersectScalar32(a, na, b, nb, out);
+}
+
+bool intsetHaveAVX2() {
+    return false;
+}
+
+#endif
+
+size_t intset32Intersect(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out) {
+    if (intsetHaveAVX2()) {
+        return intersectAVX2_32(a, na, b, nb, out);
+    }
+    return intersectSSE32(a, na, b, nb, out);
+}
+
+// sizes this lopsided are faster to probe than to merge
+const size_t k_probe_ratio = 32;
+
+void intsetIntersect(const IntSet *a, const IntSet *b, std::vector<int64_t> &out) {
+    if (!a || !b) {
+        return;
+    }
+    if (a->len > b->len) {
+        std::swap(a, b);
+    }
+    if (a->len * k_probe_ratio < b->len) {
+        for (size_t i = 0; i < a->len; i++) {
+            int64_t v = loadAt(a, i);
+            if (intsetFind(b, v)) {
+                out.push_back(v);
+            }
+        }
+        return;
+    }
+    if (a->width == 4 && b->width == 4) {
+        std::vector<int32_t> tmp(a->len);
+        size_t n = intset32Intersect((const int32_t *)a->data, a->len,
+            (const int32_t *)b->data, b->len, tmp.data());
+        out.insert(out.end(), tmp.begin(), tmp.begin() + n);
+        return;
+    }
+    size_t i = 0, j = 0;
+    while (i < a->len && j < b->len) {
+        int64_t x = loadAt(a, i), y = loadAt(b, j);
+        if (x < y) {
+            i++;
+        } else if (x > y) {
+            j++;
+        } else {
+            out.push_back(x);
+            i++;
+            j++;
+        }
+    }
+}
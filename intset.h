@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A sorted array of unique integers in one allocation with its header.
+// Elements are int32 until a value needs 64 bits, then the whole set is
+// widened. Functions that may reallocate return the new pointer; NULL
+// is a valid empty set.
+struct IntSet {
+    // bytes per element, 4 or 8
+    uint32_t width;
+    uint32_t len;
+    char data[0];
+};
+
+bool intsetFind(const IntSet *is, int64_t v);
+IntSet *intsetAdd(IntSet *is, int64_t v, bool *added);
+IntSet *intsetRemove(IntSet *is, int64_t v, bool *removed);
+int64_t intsetGet(const IntSet *is, size_t i);
+size_t intsetLen(const IntSet *is);
+size_t intsetMemUsage(const IntSet *is);
+// appends a ∩ b to `out`, ascending
+void intsetIntersect(const IntSet *a, const IntSet *b, std::vector<int64_t> &out);
+
+// Intersection kernels for sorted, unique int32 arrays. `out` has room
+// for min(na, nb) values; they return how many were written. Exposed
+// for intsettest and intsetbench, the server goes through intset32Intersect().
+size_t intersectScalar32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+size_t intersectSSE32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+size_t intersectAVX2_32(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+// the widest kernel the CPU supports
+size_t intset32Intersect(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+bool intsetHaveAVX2();
@@ -0,0 +1,98 @@
+// Times the SINTER kernels on sorted int32 arrays.
+//
+//   ./intsetbench [-n elements] [-d density percent] [-r rounds]
+//
+// Both inputs have n elements drawn from a range of n * 100 / density
+// values, so the density sets how much they overlap.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "intset.h"
+
+static uint64_t getMonotonicNs() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// xorshift64*
+static uint64_t gRng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rnd() {
+    gRng ^= gRng >> 12;
+    gRng ^= gRng << 25;
+    gRng ^= gRng >> 27;
+    return gRng * 0x2545F4914F6CDD1Dull;
+}
+
+static std::vector<int32_t> sample(size_t n, size_t range) {
+    std::vector<int32_t> v;
+    v.reserve(n * 2);
+    while (v.size() < n) {
+        for (size_t i = v.size(); i < n; i++) {
+            v.push_back((int32_t)(rnd() % range));
+        }
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+    return v;
+}
+
+typedef size_t (*Kernel)(const int32_t *, size_t, const int32_t *, size_t, int32_t *);
+
+int main(int argc, char **argv) {
+    size_t n = 100000, density = 50, rounds = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) {
+            n = (size_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-d")) {
+            density = (size_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-r")) {
+            rounds = (size_t)atol(argv[i + 1]);
+        } else {
+            fprintf(stderr, "usage: %s [-n elements] [-d density percent] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!n || !density || density > 100 || !rounds) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+    size_t range = n * 100 / density;
+    std::vector<int32_t> a = sample(n, range), b = sample(n, range);
+    std::vector<int32_t> out(n);
+
+    struct {
+        const char *name;
+        Kernel fn;
+    } kernels[] = {
+        {"scalar", &intersectScalar32},
+        {"sse", &intersectSSE32},
+        {"avx2", &intersectAVX2_32},
+    };
+    size_t expect = intersectScalar32(a.data(), n, b.data(), n, out.data());
+    printf("n=%zu density=%zu%% matches=%zu\n", n, density, expect);
+    for (auto &k : kernels) {
+        if (k.fn == &intersectAVX2_32 && !intsetHaveAVX2()) {
+            printf("%-8s unsupported on this CPU\n", k.name);
+            continue;
+        }
+        uint64_t best = (uint64_t)-1;
+        for (size_t r = 0; r < rounds; r++) {
+            uint64_t start = getMonotonicNs();
+            size_t got = k.fn(a.data(), n, b.data(), n, out.data());
+            uint64_t elapsed = getMonotonicNs() - start;
+            if (got != expect) {
+                fprintf(stderr, "%s: %zu matches, expected %zu\n", k.name, got, expect);
+                return 1;
+            }
+            best = std::min(best, elapsed);
+        }
+        printf("%-8s %8.1f us  %6.2f ns/element\n", k.name,
+            (double)best / 1e3, (double)best / (double)(2 * n));
+    }
+    return 0;
+}
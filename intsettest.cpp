@@ -0,0 +1,124 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <vector>
+#include "intset.h"
+
+static void verify(const IntSet *is, const std::set<int64_t> &ref) {
+    assert(intsetLen(is) == ref.size());
+    size_t i = 0;
+    for (int64_t v : ref) {
+        assert(intsetGet(is, i++) == v);
+        assert(intsetFind(is, v));
+    }
+}
+
+static void test_add_remove(uint32_t seed) {
+    srand(seed);
+    IntSet *is = NULL;
+    std::set<int64_t> ref;
+    for (int i = 0; i < 3000; i++) {
+        int64_t v = rand() % 1000 - 500;
+        bool added = false, removed = false;
+        if (i == 2000 && seed % 2) {
+            // widen halfway through, at either end
+            v = (seed % 4 == 1) ? INT64_MIN : (int64_t)1 << 40;
+            is = intsetAdd(is, v, &added);
+            assert(added && ref.insert(v).second);
+            assert(is->width == 8);
+        } else if (rand() % 3) {
+            is = intsetAdd(is, v, &added);
+            assert(added == ref.insert(v).second);
+        } else {
+            is = intsetRemove(is, v, &removed);
+            assert(removed == (ref.erase(v) == 1));
+        }
+        assert(!intsetFind(is, 100000));
+        if (i % 100 == 0) {
+            verify(is, ref);
+        }
+    }
+    verify(is, ref);
+    free(is);
+}
+
+static std::vector<int32_t> sortedSample(size_t n, int32_t range) {
+    std::set<int32_t> s;
+    while (s.size() < n) {
+        s.insert(rand() % range - range / 2);
+    }
+    return std::vector<int32_t>(s.begin(), s.end());
+}
+
+typedef size_t (*Kernel)(const int32_t *, size_t, const int32_t *, size_t, int32_t *);
+
+static void test_kernels(uint32_t seed) {
+    srand(seed);
+    Kernel kernels[] = {&intersectScalar32, &intersectSSE32, &intset32Intersect};
+    size_t na = rand() % 300, nb = rand() % 300;
+    int32_t range = 1 + rand() % 1000;
+    if ((int32_t)na > range) na = range;
+    if ((int32_t)nb > range) nb = range;
+    std::vector<int32_t> a = sortedSample(na, range), b = sortedSample(nb, range);
+    std::vector<int32_t> expect;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expect));
+    for (Kernel k : kernels) {
+        std::vector<int32_t> out(std::min(na, nb) + 1);
+        size_t n = k(a.data(), na, b.data(), nb, out.data());
+        out.resize(n);
+        assert(out == expect);
+    }
+    if (intsetHaveAVX2()) {
+        std::vector<int32_t> out(std::min(na, nb) + 1);
+        out.resize(intersectAVX2_32(a.data(), na, b.data(), nb, out.data()));
+        assert(out == expect);
+    }
+}
+
+static void test_intersect_mixed() {
+    IntSet *a = NULL, *b = NULL;
+    bool added = false;
+    std::vector<int64_t> expect;
+    for (int64_t v = -1000; v < 1000; v++) {
+        a = intsetAdd(a, v * 3, &added);
+        b = intsetAdd(b, v * 5, &added);
+        if (v * 3 % 5 == 0 && v * 3 >= -5000 && v * 3 < 5000) {
+            expect.push_back(v * 3);
+        }
+    }
+    std::vector<int64_t> out;
+    intsetIntersect(a, b, out);
+    assert(out == expect);
+    // one side wide: the generic merge
+    b = intsetAdd(b, (int64_t)1 << 40, &added);
+    assert(b->width == 8);
+    out.clear();
+    intsetIntersect(a, b, out);
+    assert(out == expect);
+    // lopsided: probing
+    IntSet *c = NULL;
+    c = intsetAdd(c, 15, &added);
+    c = intsetAdd(c, 16, &added);
+    out.clear();
+    intsetIntersect(b, c, out);
+    assert(out == std::vector<int64_t>{15});
+    out.clear();
+    intsetIntersect(NULL, c, out);
+    assert(out.empty());
+    free(a);
+    free(b);
+    free(c);
+}
+
+int main() {
+    for (uint32_t i = 0; i < 20; ++i) {
+        test_add_remove(i);
+    }
+    for (uint32_t i = 0; i < 500; ++i) {
+        test_kernels(i);
+    }
+    test_intersect_mixed();
+    return 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Benchmarks the server's event-loop backends against each other.
+#
+#   ./iobench.sh [builddir] [bench args...]
+#
+# Starts the server from <builddir> (default _gate_build) once per backend
+# (poll, uring) and runs the same bench workload against each. A kernel
+# without io_uring makes the server fall back to poll(), which it logs.
+set -e
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+BUILD=$(cd "${1:-$SRC/_gate_build}" && pwd)
+[ $# -gt 0 ] && shift
+PORT=${IOBENCH_PORT:-12346}
+ARGS=${*:-"-n 300000 -c 50 -P 1 -t set,get"}
+
+for backend in poll uring; do
+    echo "== $backend"
+    "$BUILD/server" --port "$PORT" --io-backend "$backend" 2>/dev/null &
+    pid=$!
+    sleep 0.5
+    # the pipelined run shows batching, the unpipelined one syscall cost
+    "$BUILD/bench" -p "$PORT" $ARGS
+    "$BUILD/bench" -p "$PORT" $ARGS -P 16
+    kill -TERM $pid
+    wait $pid
+done
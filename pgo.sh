@@ -0,0 +1,56 @@
+#!/bin/sh
+# Two-stage profile-guided build of the server.
+#
+#   ./pgo.sh [outdir]
+#
+# 1. builds an instrumented server in <outdir>/gen
+# 2. trains it with the bench workload, profiles land in <outdir>/profile
+# 3. rebuilds the server with the profile in <outdir>/use
+# 4. benchmarks a plain Release build against the PGO build
+#
+# Extra cmake flags (e.g. -DENABLE_LTO=ON -DSERVER_MARCH=native) can be
+# passed through PGO_CMAKE_FLAGS.
+set -e
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+OUT=$(mkdir -p "${1:-$SRC/_pgo}" && cd "${1:-$SRC/_pgo}" && pwd)
+PROFILE=$OUT/profile
+PORT=${PGO_PORT:-12345}
+TRAIN="-n 200000 -c 32 -P 4 -t set,get,zadd,zscore,zquery,mixed"
+MEASURE="-n 300000 -c 32 -P 4 -t set,get,zadd,zscore,zquery,mixed"
+
+configure() {
+    cmake -S "$SRC" -B "$OUT/$1" -DCMAKE_BUILD_TYPE=Release \
+        -DPGO_DIR="$PROFILE" $PGO_CMAKE_FLAGS "$@" >/dev/null
+    cmake --build "$OUT/$1" -j"$(nproc)" --target server bench >/dev/null
+}
+
+# run_bench <server binary> <bench args...>
+run_bench() {
+    server=$1
+    shift
+    "$server" --port "$PORT" 2>/dev/null &
+    pid=$!
+    sleep 0.5
+    "$OUT/gen/bench" -p "$PORT" "$@"
+    kill -TERM $pid
+    wait $pid
+}
+
+echo "== stage 1: instrumented build"
+rm -rf "$PROFILE"
+configure gen -DPGO=GENERATE
+run_bench "$OUT/gen/server" $TRAIN >/dev/null
+
+if command -v llvm-profdata >/dev/null && ls "$PROFILE"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -o "$PROFILE/default.profdata" "$PROFILE"/*.profraw
+fi
+
+echo "== stage 2: optimized build"
+configure use -DPGO=USE
+configure release -DPGO=OFF
+
+echo "== release"
+run_bench "$OUT/release/server" $MEASURE
+echo "== pgo"
+run_bench "$OUT/use/server" $MEASURE
@@ -0,0 +1,180 @@
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+// proj
+#include "quicklist.h"
+#include "common.hpp"
+
+const size_t k_rec_overhead = 8;
+
+static uint32_t loadU32(const char *p) {
+    uint32_t v = 0;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void storeU32(char *p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+static QLBlock *blockOf(DList *link) {
+    return container_of(link, QLBlock, link);
+}
+
+static QLBlock *blockNew(QuickList *ql, size_t cap) {
+    QLBlock *b = (QLBlock *)malloc(sizeof(QLBlock) + cap);
+    assert(b);
+    b->count = 0;
+    b->head = b->tail = 0;
+    b->cap = (uint32_t)cap;
+    ql->bytes += sizeof(QLBlock) + cap;
+    return b;
+}
+
+static void blockFree(QuickList *ql, QLBlock *b) {
+    ql->bytes -= sizeof(QLBlock) + b->cap;
+    dlistDetach(&b->link);
+    free(b);
+}
+
+// Room for `need` bytes at one end of the end block, or NULL if the
+// caller should start a new block. A block with room below the limit
+// is moved to a bigger allocation with its records packed against the
+// far end, leaving the free space on the side being pushed.
+static QLBlock *blockReserve(QuickList *ql, bool front, size_t need) {
+    if (dlistEmpty(&ql->blocks)) {
+        return NULL;
+    }
+    QLBlock *b = blockOf(front ? ql->blocks.next : ql->blocks.prev);
+    if (front ? b->head >= need : b->cap - b->tail >= need) {
+        return b;
+    }
+    size_t used = b->tail - b->head;
+    if (used + need > k_ql_block_max) {
+        return NULL;
+    }
+    size_t cap = b->cap * 2;
+    if (cap > k_ql_block_max) {
+        cap = k_ql_block_max;
+    }
+    if (cap < used + need) {
+        cap = used + need;
+    }
+    QLBlock *nb = blockNew(ql, cap);
+    nb->count = b->count;
+    nb->head = front ? (uint32_t)(cap - used) : 0;
+    nb->tail = nb->head + (uint32_t)used;
+    memcpy(nb->data + nb->head, b->data + b->head, used);
+    dlistInsertBefore(&b->link, &nb->link);
+    blockFree(ql, b);
+    return nb;
+}
+
+void qlPush(QuickList *ql, bool front, const char *val, size_t len) {
+    size_t need = len + k_rec_overhead;
+    QLBlock *b = blockReserve(ql, front, need);
+    if (!b) {
+        // big values get a block of their own
+        b = blockNew(ql, need);
+        b->head = b->tail = front ? (uint32_t)need : 0;
+        dlistInsertBefore(front ? ql->blocks.next : &ql->blocks, &b->link);
+    }
+    char *p = NULL;
+    if (front) {
+        b->head -= (uint32_t)need;
+        p = b->data + b->head;
+    } else {
+        p = b->data + b->tail;
+        b->tail += (uint32_t)need;
+    }
+    storeU32(p, (uint32_t)len);
+    memcpy(p + 4, val, len);
+    storeU32(p + 4 + len, (uint32_t)len);
+    b->count++;
+    ql->len++;
+}
+
+bool qlPop(QuickList *ql, bool front, std::string &out) {
+    if (dlistEmpty(&ql->blocks)) {
+        return false;
+    }
+    QLBlock *b = blockOf(front ? ql->blocks.next : ql->blocks.prev);
+    if (front) {
+        uint32_t len = loadU32(b->data + b->head);
+        out.assign(b->data + b->head + 4, len);
+        b->head += len + (uint32_t)k_rec_overhead;
+    } else {
+        uint32_t len = loadU32(b->data + b->tail - 4);
+        out.assign(b->data + b->tail - 4 - len, len);
+        b->tail -= len + (uint32_t)k_rec_overhead;
+    }
+    b->count--;
+    ql->len--;
+    if (b->count == 0) {
+        blockFree(ql, b);
+    }
+    return true;
+}
+
+bool qlIndex(QuickList *ql, int64_t idx, QLIter *it) {
+    if (idx < 0) {
+        idx += (int64_t)ql->len;
+    }
+    if (idx < 0 || (uint64_t)idx >= ql->len) {
+        return false;
+    }
+    // skip whole blocks, from whichever end is closer
+    size_t i = (size_t)idx;
+    QLBlock *b = NULL;
+    if (i < ql->len / 2) {
+        b = blockOf(ql->blocks.next);
+        while (i >= b->count) {
+            i -= b->count;
+            b = blockOf(b->link.next);
+        }
+    } else {
+        size_t back = ql->len - 1 - i;
+        b = blockOf(ql->blocks.prev);
+        while (back >= b->count) {
+            back -= b->count;
+            b = blockOf(b->link.prev);
+        }
+        i = b->count - 1 - back;
+    }
+    uint32_t pos = b->head;
+    while (i--) {
+        pos += loadU32(b->data + pos) + (uint32_t)k_rec_overhead;
+    }
+    it->ql = ql;
+    it->block = b;
+    it->pos = pos;
+    return true;
+}
+
+bool qlNext(QLIter *it, const char **val, size_t *len) {
+    if (!it->block) {
+        return false;
+    }
+    QLBlock *b = it->block;
+    uint32_t n = loadU32(b->data + it->pos);
+    *val = b->data + it->pos + 4;
+    *len = n;
+    it->pos += n + (uint32_t)k_rec_overhead;
+    if (it->pos == b->tail) {
+        DList *next = b->link.next;
+        it->block = next == &it->ql->blocks ? NULL : blockOf(next);
+        it->pos = it->block ? it->block->head : 0;
+    }
+    return true;
+}
+
+void qlClear(QuickList *ql) {
+    while (!dlistEmpty(&ql->blocks)) {
+        blockFree(ql, blockOf(ql->blocks.next));
+    }
+    ql->len = 0;
+}
+
+size_t qlMemUsage(QuickList *ql) {
+    return ql->bytes;
+}
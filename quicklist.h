@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "list.h"
+
+// A deque of strings kept in a linked list of packed blocks, so pushes
+// and pops at either end are O(1) and a range read walks contiguous
+// memory. Records are [u32 len][bytes][u32 len]; the trailing length
+// lets the tail be popped without scanning the block.
+//
+// Blocks grow by doubling up to k_ql_block_max bytes of records. A block
+// made by a push at the front fills downwards from its end, one made at
+// the back fills upwards from its start, so both ends stay O(1).
+const size_t k_ql_block_max = 4096;
+
+struct QLBlock {
+    DList link;
+    // number of records
+    uint32_t count;
+    // data[head, tail) holds the records
+    uint32_t head;
+    uint32_t tail;
+    uint32_t cap;
+    char data[0];
+};
+
+struct QuickList {
+    // QLBlock::link, front to back
+    DList blocks;
+    size_t len = 0;
+    // bytes allocated for the blocks
+    size_t bytes = 0;
+
+    QuickList() { dlistInit(&blocks); }
+};
+
+// position of a record, for walking a range
+struct QLIter {
+    QuickList *ql = NULL;
+    QLBlock *block = NULL;
+    uint32_t pos = 0;
+};
+
+void qlPush(QuickList *ql, bool front, const char *val, size_t len);
+bool qlPop(QuickList *ql, bool front, std::string &out);
+// negative indices count from the back
+bool qlIndex(QuickList *ql, int64_t idx, QLIter *it);
+// Reads the record at `it` and advances it. The data points into the
+// list and is valid until it is next modified.
+bool qlNext(QLIter *it, const char **val, size_t *len);
+void qlClear(QuickList *ql);
+size_t qlMemUsage(QuickList *ql);
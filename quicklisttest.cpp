@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <deque>
+#include <string>
+#include "quicklist.h"
+
+typedef std::deque<std::string> Ref;
+
+static void verify(QuickList &ql, const Ref &ref) {
+    assert(ql.len == ref.size());
+    // the whole list in one walk
+    QLIter it;
+    if (ref.empty()) {
+        assert(!qlIndex(&ql, 0, &it));
+        assert(dlistEmpty(&ql.blocks));
+        return;
+    }
+    assert(qlIndex(&ql, 0, &it));
+    const char *val = NULL;
+    size_t len = 0;
+    for (const std::string &s : ref) {
+        assert(qlNext(&it, &val, &len));
+        assert(std::string(val, len) == s);
+    }
+    assert(!qlNext(&it, &val, &len));
+    // random access from both ends
+    for (size_t i = 0; i < ref.size(); i += 1 + ref.size() / 17) {
+        assert(qlIndex(&ql, (int64_t)i, &it));
+        assert(qlNext(&it, &val, &len));
+        assert(std::string(val, len) == ref[i]);
+        assert(qlIndex(&ql, (int64_t)i - (int64_t)ref.size(), &it));
+        assert(qlNext(&it, &val, &len));
+        assert(std::string(val, len) == ref[i]);
+    }
+    assert(!qlIndex(&ql, (int64_t)ref.size(), &it));
+    assert(!qlIndex(&ql, -(int64_t)ref.size() - 1, &it));
+}
+
+static std::string value(uint32_t seed) {
+    // mostly small, sometimes bigger than a block
+    size_t len = seed % 97 == 0 ? k_ql_block_max + seed % 1000 : seed % 40;
+    std::string s(len, 'a' + seed % 26);
+    if (!s.empty()) {
+        s[0] = (char)seed;
+    }
+    return s;
+}
+
+static void test_case(uint32_t seed) {
+    srand(seed);
+    QuickList ql;
+    Ref ref;
+    for (int round = 0; round < 2000; round++) {
+        int op = rand() % 10;
+        bool front = rand() % 2;
+        if (op < 6) {
+            std::string s = value((uint32_t)rand());
+            qlPush(&ql, front, s.data(), s.size());
+            if (front) {
+                ref.push_front(s);
+            } else {
+                ref.push_back(s);
+            }
+        } else {
+            std::string out;
+            bool ok = qlPop(&ql, front, out);
+            assert(ok == !ref.empty());
+            if (ok) {
+                assert(out == (front ? ref.front() : ref.back()));
+                if (front) {
+                    ref.pop_front();
+                } else {
+                    ref.pop_back();
+                }
+            }
+        }
+        if (round % 100 == 0) {
+            verify(ql, ref);
+        }
+    }
+    verify(ql, ref);
+    // drain from one end
+    std::string out;
+    size_t popped = 0;
+    while (qlPop(&ql, seed % 2, out)) {
+        popped++;
+    }
+    assert(popped == ref.size());
+    ref.clear();
+    verify(ql, ref);
+    assert(ql.bytes == 0);
+
+    qlPush(&ql, false, "x", 1);
+    qlClear(&ql);
+    assert(ql.len == 0 && ql.bytes == 0);
+}
+
+int main() {
+    for (uint32_t i = 0; i < 50; ++i) {
+        test_case(i);
+    }
+    return 0;
+}
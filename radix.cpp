@@ -0,0 +1,334 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <string>
+#include <vector>
+// proj
+#include "radix.h"
+
+// The header is followed by the edge bytes, the children's first bytes,
+// padding to pointer alignment, then the child pointers. A child's edge
+// starts with its label byte. Only the root may have an empty edge, and
+// a node that is not a key has at least 2 children (except the root).
+struct RadixNode {
+    void *val;
+    uint32_t elen;
+    uint16_t nchild;
+    uint8_t isKey;
+    uint8_t pad;
+    char data[0];
+};
+
+static char *nodeEdge(RadixNode *node) {
+    return node->data;
+}
+
+static uint8_t *nodeLabels(RadixNode *node) {
+    return (uint8_t *)node->data + node->elen;
+}
+
+static size_t childOffset(uint32_t elen, uint32_t nchild) {
+    size_t off = sizeof(RadixNode) + elen + nchild;
+    return (off + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+static RadixNode **nodeChildren(RadixNode *node) {
+    return (RadixNode **)((char *)node + childOffset(node->elen, node->nchild));
+}
+
+static RadixNode *nodeNew(RadixTree *tree, const char *edge, size_t elen, size_t nchild) {
+    size_t size = childOffset((uint32_t)elen, (uint32_t)nchild) + nchild * sizeof(RadixNode *);
+    RadixNode *node = (RadixNode *)malloc(size);
+    assert(node);
+    node->val = NULL;
+    node->elen = (uint32_t)elen;
+    node->nchild = (uint16_t)nchild;
+    node->isKey = 0;
+    node->pad = 0;
+    memcpy(nodeEdge(node), edge, elen);
+    tree->nodes++;
+    tree->mem += malloc_usable_size(node);
+    return node;
+}
+
+static void nodeFree(RadixTree *tree, RadixNode *node) {
+    tree->nodes--;
+    tree->mem -= malloc_usable_size(node);
+    free(node);
+}
+
+// a copy of `node` with edge bytes [skip, elen) and room for `nchild`
+// children; the first min(nchild, node->nchild) children are copied
+static RadixNode *nodeResize(RadixTree *tree, RadixNode *node, size_t skip, size_t nchild) {
+    RadixNode *copy = nodeNew(tree, nodeEdge(node) + skip, node->elen - skip, nchild);
+    copy->val = node->val;
+    copy->isKey = node->isKey;
+    size_t n = nchild < node->nchild ? nchild : node->nchild;
+    memcpy(nodeLabels(copy), nodeLabels(node), n);
+    memcpy(nodeChildren(copy), nodeChildren(node), n * sizeof(RadixNode *));
+    return copy;
+}
+
+// index of the child starting with `c`, or where it would go
+static size_t childFind(RadixNode *node, uint8_t c, bool *found) {
+    uint8_t *labels = nodeLabels(node);
+    size_t lo = 0, hi = node->nchild;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (labels[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < node->nchild && labels[lo] == c;
+    return lo;
+}
+
+// replaces *slot with a copy that has `child` added
+static RadixNode *nodeAddChild(RadixTree *tree, RadixNode **slot, RadixNode *child) {
+    RadixNode *node = *slot;
+    uint8_t c = (uint8_t)nodeEdge(child)[0];
+    bool found = false;
+    size_t pos = childFind(node, c, &found);
+    assert(!found);
+    RadixNode *copy = nodeResize(tree, node, 0, node->nchild + 1);
+    uint8_t *labels = nodeLabels(copy);
+    RadixNode **children = nodeChildren(copy);
+    memmove(labels + pos + 1, labels + pos, node->nchild - pos);
+    labels[pos] = c;
+    memcpy(children, nodeChildren(node), pos * sizeof(RadixNode *));
+    children[pos] = child;
+    memcpy(children + pos + 1, nodeChildren(node) + pos,
+        (node->nchild - pos) * sizeof(RadixNode *));
+    nodeFree(tree, node);
+    *slot = copy;
+    return copy;
+}
+
+// replaces *slot with a copy that has the child at `pos` removed
+static RadixNode *nodeDelChild(RadixTree *tree, RadixNode **slot, size_t pos) {
+    RadixNode *node = *slot;
+    RadixNode *copy = nodeResize(tree, node, 0, node->nchild - 1);
+    uint8_t *labels = nodeLabels(copy);
+    RadixNode **children = nodeChildren(copy);
+    memcpy(labels + pos, nodeLabels(node) + pos + 1, node->nchild - pos - 1);
+    memcpy(children + pos, nodeChildren(node) + pos + 1,
+        (node->nchild - pos - 1) * sizeof(RadixNode *));
+    nodeFree(tree, node);
+    *slot = copy;
+    return copy;
+}
+
+// a non-key node with a single child becomes one node with both edges
+static void nodeMerge(RadixTree *tree, RadixNode **slot) {
+    RadixNode *node = *slot;
+    RadixNode *child = nodeChildren(node)[0];
+    std::string edge(nodeEdge(node), node->elen);
+    edge.append(nodeEdge(child), child->elen);
+    RadixNode *merged = nodeNew(tree, edge.data(), edge.size(), child->nchild);
+    merged->val = child->val;
+    merged->isKey = child->isKey;
+    memcpy(nodeLabels(merged), nodeLabels(child), child->nchild);
+    memcpy(nodeChildren(merged), nodeChildren(child), child->nchild * sizeof(RadixNode *));
+    nodeFree(tree, node);
+    nodeFree(tree, child);
+    *slot = merged;
+}
+
+void radixInit(RadixTree *tree) {
+    *tree = RadixTree();
+    tree->root = nodeNew(tree, "", 0, 0);
+}
+
+static size_t commonLen(const char *a, size_t alen, const char *b, size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+bool radixInsert(RadixTree *tree, const char *key, size_t len, void *val) {
+    RadixNode **slot = &tree->root;
+    size_t pos = 0;
+    while (true) {
+        RadixNode *node = *slot;
+        size_t c = commonLen(nodeEdge(node), node->elen, key + pos, len - pos);
+        if (c < node->elen) {
+            // the key leaves the edge halfway: split it at `c`
+            RadixNode *upper = nodeNew(tree, nodeEdge(node), c, 1);
+            RadixNode *lower = nodeResize(tree, node, c, node->nchild);
+            nodeLabels(upper)[0] = (uint8_t)nodeEdge(lower)[0];
+            nodeChildren(upper)[0] = lower;
+            nodeFree(tree, node);
+            *slot = upper;
+            if (pos + c == len) {
+                upper->isKey = 1;
+                upper->val = val;
+            } else {
+                RadixNode *leaf = nodeNew(tree, key + pos + c, len - pos - c, 0);
+                leaf->isKey = 1;
+                leaf->val = val;
+                nodeAddChild(tree, slot, leaf);
+            }
+            tree->size++;
+            return true;
+        }
+        pos += c;
+        if (pos == len) {
+            bool added = !node->isKey;
+            node->isKey = 1;
+            node->val = val;
+            tree->size += added;
+            return added;
+        }
+        bool found = false;
+        size_t i = childFind(node, (uint8_t)key[pos], &found);
+        if (!found) {
+            RadixNode *leaf = nodeNew(tree, key + pos, len - pos, 0);
+            leaf->isKey = 1;
+            leaf->val = val;
+            nodeAddChild(tree, slot, leaf);
+            tree->size++;
+            return true;
+        }
+        slot = &nodeChildren(node)[i];
+    }
+}
+
+void *radixFind(RadixTree *tree, const char *key, size_t len) {
+    RadixNode *node = tree->root;
+    size_t pos = 0;
+    while (true) {
+        if (len - pos < node->elen || memcmp(nodeEdge(node), key + pos, node->elen) != 0) {
+            return NULL;
+        }
+        pos += node->elen;
+        if (pos == len) {
+            return node->isKey ? node->val : NULL;
+        }
+        bool found = false;
+        size_t i = childFind(node, (uint8_t)key[pos], &found);
+        if (!found) {
+            return NULL;
+        }
+        node = nodeChildren(node)[i];
+    }
+}
+
+void *radixRemove(RadixTree *tree, const char *key, size_t len) {
+    // the slots from the root down, and the child index taken at each
+    std::vector<RadixNode **> path;
+    std::vector<size_t> idx;
+    RadixNode **slot = &tree->root;
+    size_t pos = 0;
+    while (true) {
+        RadixNode *node = *slot;
+        if (len - pos < node->elen || memcmp(nodeEdge(node), key + pos, node->elen) != 0) {
+            return NULL;
+        }
+        pos += node->elen;
+        if (pos == len) {
+            break;
+        }
+        bool found = false;
+        size_t i = childFind(node, (uint8_t)key[pos], &found);
+        if (!found) {
+            return NULL;
+        }
+        path.push_back(slot);
+        idx.push_back(i);
+        slot = &nodeChildren(node)[i];
+    }
+    RadixNode *node = *slot;
+    if (!node->isKey) {
+        return NULL;
+    }
+    void *val = node->val;
+    node->isKey = 0;
+    node->val = NULL;
+    tree->size--;
+    if (node == tree->root) {
+        return val;
+    }
+    if (node->nchild == 1) {
+        nodeMerge(tree, slot);
+    } else if (node->nchild == 0) {
+        nodeFree(tree, node);
+        RadixNode **pslot = path.back();
+        RadixNode *parent = nodeDelChild(tree, pslot, idx.back());
+        if (parent != tree->root && !parent->isKey && parent->nchild == 1) {
+            nodeMerge(tree, pslot);
+        }
+    }
+    return val;
+}
+
+struct WalkCtx {
+    const char *start;
+    size_t slen;
+    bool (*cb)(const char *key, size_t len, void *val, void *arg);
+    void *arg;
+    std::string key;
+};
+
+// `bounded`: the key so far equals the start of `start`, keys below it
+// are skipped. Returns false once the callback asked to stop.
+static bool walkNode(WalkCtx *ctx, RadixNode *node, bool bounded) {
+    size_t base = ctx->key.size();
+    ctx->key.append(nodeEdge(node), node->elen);
+    size_t klen = ctx->key.size();
+    bool ok = true;
+    size_t first = 0;
+    if (bounded) {
+        size_t n = klen < ctx->slen ? klen : ctx->slen;
+        int cmp = memcmp(ctx->key.data() + base, ctx->start + base, n - base);
+        if (cmp < 0) {
+            goto L_DONE;
+        }
+        if (cmp > 0 || klen >= ctx->slen) {
+            bounded = false;
+        } else {
+            // the node's own key is a proper prefix of `start`, too small
+            bool found = false;
+            first = childFind(node, (uint8_t)ctx->start[klen], &found);
+            for (size_t i = first; ok && i < node->nchild; i++) {
+                ok = walkNode(ctx, nodeChildren(node)[i], found && i == first);
+            }
+            goto L_DONE;
+        }
+    }
+    if (node->isKey) {
+        ok = ctx->cb(ctx->key.data(), klen, node->val, ctx->arg);
+    }
+    for (size_t i = 0; ok && i < node->nchild; i++) {
+        ok = walkNode(ctx, nodeChildren(node)[i], false);
+    }
+L_DONE:
+    ctx->key.resize(base);
+    return ok;
+}
+
+void radixWalk(RadixTree *tree, const char *start, size_t slen,
+    bool (*cb)(const char *key, size_t len, void *val, void *arg), void *arg)
+{
+    WalkCtx ctx = {start, slen, cb, arg, std::string()};
+    walkNode(&ctx, tree->root, true);
+}
+
+static void freeNodes(RadixTree *tree, RadixNode *node) {
+    for (size_t i = 0; i < node->nchild; i++) {
+        freeNodes(tree, nodeChildren(node)[i]);
+    }
+    nodeFree(tree, node);
+}
+
+void radixClear(RadixTree *tree) {
+    if (tree->root) {
+        freeNodes(tree, tree->root);
+    }
+    *tree = RadixTree();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// An ordered map from byte strings to pointers: a compressed radix tree.
+// Each node holds the bytes of its edge (the whole run of a chain that
+// does not branch) and its children sorted by first byte, in a single
+// allocation. Keys compare as unsigned bytes, shorter first.
+struct RadixNode;
+
+struct RadixTree {
+    // never freed while the tree lives, its edge stays empty
+    RadixNode *root = NULL;
+    size_t size = 0;
+    size_t nodes = 0;
+    // bytes allocated for the nodes
+    size_t mem = 0;
+};
+
+void radixInit(RadixTree *tree);
+// returns false if the key was there, its value is replaced
+bool radixInsert(RadixTree *tree, const char *key, size_t len, void *val);
+// returns the value of the removed key, NULL if there was none
+void *radixRemove(RadixTree *tree, const char *key, size_t len);
+void *radixFind(RadixTree *tree, const char *key, size_t len);
+// Calls `cb` for the keys >= `start` in order, until it returns false.
+// The key passed to `cb` is only valid during the call. The tree must
+// not change during the walk.
+void radixWalk(RadixTree *tree, const char *start, size_t slen,
+    bool (*cb)(const char *key, size_t len, void *val, void *arg), void *arg);
+void radixClear(RadixTree *tree);
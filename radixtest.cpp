@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "radix.h"
+
+struct WalkOut {
+    std::vector<std::string> keys;
+    size_t limit;
+};
+
+static bool collect(const char *key, size_t len, void *val, void *arg) {
+    WalkOut *out = (WalkOut *)arg;
+    out->keys.emplace_back(key, len);
+    assert(val == (void *)(uintptr_t)std::hash<std::string>()(out->keys.back()));
+    return out->keys.size() < out->limit;
+}
+
+static void *valOf(const std::string &key) {
+    return (void *)(uintptr_t)std::hash<std::string>()(key);
+}
+
+static void verifyWalk(RadixTree *tree, const std::map<std::string, void *> &ref,
+    const std::string &start, size_t limit)
+{
+    WalkOut out = {{}, limit};
+    radixWalk(tree, start.data(), start.size(), &collect, &out);
+    auto it = ref.lower_bound(start);
+    for (const std::string &key : out.keys) {
+        assert(it != ref.end() && it->first == key);
+        ++it;
+    }
+    assert(out.keys.size() == limit || it == ref.end());
+}
+
+static void verify(RadixTree *tree, const std::map<std::string, void *> &ref) {
+    assert(tree->size == ref.size());
+    verifyWalk(tree, ref, "", (size_t)-1);
+}
+
+static uint64_t gRng = 1;
+
+static uint64_t rnd() {
+    gRng ^= gRng << 13;
+    gRng ^= gRng >> 7;
+    gRng ^= gRng << 17;
+    return gRng;
+}
+
+// short keys from a small alphabet, so that edges split and merge a lot
+static std::string randKey() {
+    static const char k_chars[] = {'a', 'b', 'c', '\0', '\xff'};
+    std::string key;
+    size_t len = rnd() % 7;
+    for (size_t i = 0; i < len; i++) {
+        key += k_chars[rnd() % sizeof(k_chars)];
+    }
+    return key;
+}
+
+int main() {
+    RadixTree tree;
+    radixInit(&tree);
+    std::map<std::string, void *> ref;
+    // the empty key and edge splits
+    assert(radixInsert(&tree, "", 0, valOf("")));
+    assert(radixInsert(&tree, "user:1", 6, valOf("user:1")));
+    assert(radixInsert(&tree, "user:12", 7, valOf("user:12")));
+    assert(radixInsert(&tree, "user:2", 6, valOf("user:2")));
+    assert(radixInsert(&tree, "use", 3, valOf("use")));
+    assert(!radixInsert(&tree, "user:1", 6, valOf("user:1")));
+    for (const char *k : {"", "user:1", "user:12", "user:2", "use"}) {
+        ref[k] = valOf(k);
+        assert(radixFind(&tree, k, strlen(k)) == valOf(k));
+    }
+    assert(!radixFind(&tree, "user", 4) && !radixFind(&tree, "user:", 5));
+    assert(!radixFind(&tree, "user:3", 6) && !radixFind(&tree, "user:123", 8));
+    verify(&tree, ref);
+    verifyWalk(&tree, ref, "user:", 2);
+    verifyWalk(&tree, ref, "user:10", 10);
+    verifyWalk(&tree, ref, "v", 10);
+    assert(!radixRemove(&tree, "user", 4));
+    assert(radixRemove(&tree, "user:1", 6) == valOf("user:1"));
+    ref.erase("user:1");
+    assert(radixRemove(&tree, "", 0) == valOf(""));
+    ref.erase("");
+    verify(&tree, ref);
+    size_t mem = tree.mem;
+    radixClear(&tree);
+    assert(mem > 0 && tree.mem == 0 && tree.nodes == 0);
+
+    // random operations against std::map
+    radixInit(&tree);
+    ref.clear();
+    for (int i = 0; i < 200000; i++) {
+        std::string key = randKey();
+        if (rnd() % 3) {
+            bool added = radixInsert(&tree, key.data(), key.size(), valOf(key));
+            assert(added == (ref.count(key) == 0));
+            ref[key] = valOf(key);
+        } else {
+            void *val = radixRemove(&tree, key.data(), key.size());
+            assert(val == (ref.count(key) ? valOf(key) : NULL));
+            ref.erase(key);
+        }
+        if (i % 1000 == 0) {
+            verify(&tree, ref);
+            verifyWalk(&tree, ref, randKey(), 1 + rnd() % 20);
+        }
+    }
+    for (auto &kv : ref) {
+        assert(radixFind(&tree, kv.first.data(), kv.first.size()) == kv.second);
+    }
+    // empty again, only the root is left
+    std::vector<std::string> keys;
+    for (auto &kv : ref) {
+        keys.push_back(kv.first);
+    }
+    for (const std::string &key : keys) {
+        assert(radixRemove(&tree, key.data(), key.size()) == valOf(key));
+    }
+    assert(tree.size == 0 && tree.nodes == 1);
+    radixClear(&tree);
+
+    // the overhead on keys like the server's
+    radixInit(&tree);
+    size_t bytes = 0;
+    char buf[64];
+    for (uint64_t i = 0; i < 1000000; i++) {
+        int len = snprintf(buf, sizeof(buf), "user:%llu:session", (unsigned long long)(i * 7919 % 1000003));
+        radixInsert(&tree, buf, (size_t)len, NULL);
+        bytes += (size_t)len;
+    }
+    printf("1M keys, %zu key bytes: %zu nodes, %zu bytes (%.1f per key)\n",
+        bytes, tree.nodes, tree.mem, (double)tree.mem / (double)tree.size);
+    radixClear(&tree);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <string.h>
+#include <algorithm>
+#include <random>
+// proj
+#include "repl.h"
+
+void backlogInit(ReplBacklog *bl, size_t size) {
+    bl->buf.assign(size, 0);
+    bl->head = 0;
+    bl->len = 0;
+}
+
+void backlogAppend(ReplBacklog *bl, const uint8_t *data, size_t n) {
+    bl->offset += n;
+    size_t size = bl->buf.size();
+    if (size == 0) {
+        return;
+    }
+    // only the last `size` bytes survive
+    if (n > size) {
+        data += n - size;
+        n = size;
+    }
+    size_t first = std::min(n, size - bl->head);
+    memcpy(bl->buf.data() + bl->head, data, first);
+    memcpy(bl->buf.data(), data + first, n - first);
+    bl->head = (bl->head + n) % size;
+    bl->len = std::min(bl->len + n, size);
+}
+
+bool backlogRead(const ReplBacklog *bl, uint64_t offset, std::string &out) {
+    if (offset > bl->offset || bl->offset - offset > bl->len) {
+        return false;
+    }
+    size_t n = (size_t)(bl->offset - offset);
+    size_t size = bl->buf.size();
+    // `head` is where the stream ends
+    size_t start = (bl->head + size - n) % (size ? size : 1);
+    size_t first = std::min(n, size - start);
+    out.assign((const char *)bl->buf.data() + start, first);
+    out.append((const char *)bl->buf.data(), n - first);
+    return true;
+}
+
+std::string replNewId() {
+    static const char k_hex[] = "0123456789abcdef";
+    std::random_device rd;
+    std::string id(40, '0');
+    for (char &c : id) {
+        c = k_hex[rd() & 15];
+    }
+    return id;
+}
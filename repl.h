@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// The tail of the replication stream a primary keeps, so that a replica
+// that lost its link can pick up where it left off (a partial resync)
+// instead of loading a whole snapshot again. A fixed-size ring: appends
+// overwrite the oldest bytes.
+struct ReplBacklog {
+    std::vector<uint8_t> buf;
+    // where the next byte goes, and how many of the last bytes are held
+    size_t head = 0;
+    size_t len = 0;
+    // bytes of the stream so far, the replication offset
+    uint64_t offset = 0;
+};
+
+// (re)allocates the ring, empty; the offset carries on
+void backlogInit(ReplBacklog *bl, size_t size);
+void backlogAppend(ReplBacklog *bl, const uint8_t *data, size_t n);
+// the stream from `offset` on, false if the ring no longer holds all of it
+bool backlogRead(const ReplBacklog *bl, uint64_t offset, std::string &out);
+
+// 40 random hex digits naming a replication history
+std::string replNewId();
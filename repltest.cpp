@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include "repl.h"
+
+static void append(ReplBacklog *bl, const char *s) {
+    backlogAppend(bl, (const uint8_t *)s, strlen(s));
+}
+
+int main() {
+    ReplBacklog bl;
+    std::string out;
+    // no ring yet: only the offset moves
+    append(&bl, "abc");
+    assert(bl.offset == 3 && bl.len == 0);
+    assert(backlogRead(&bl, 3, out) && out.empty());
+    assert(!backlogRead(&bl, 0, out));
+
+    backlogInit(&bl, 8);
+    assert(bl.offset == 3);
+    append(&bl, "hello");
+    assert(backlogRead(&bl, 3, out) && out == "hello");
+    assert(backlogRead(&bl, 6, out) && out == "lo");
+    assert(backlogRead(&bl, 8, out) && out.empty());
+    assert(!backlogRead(&bl, 2, out));
+    assert(!backlogRead(&bl, 9, out));
+
+    // wraps around, the oldest bytes go
+    append(&bl, "world");
+    assert(bl.offset == 13 && bl.len == 8);
+    assert(backlogRead(&bl, 5, out) && out == "lloworld");
+    assert(backlogRead(&bl, 6, out) && out == "loworld");
+    assert(!backlogRead(&bl, 4, out));
+
+    // more than the whole ring at once
+    append(&bl, "0123456789");
+    assert(bl.offset == 23);
+    assert(backlogRead(&bl, 15, out) && out == "23456789");
+    assert(!backlogRead(&bl, 14, out));
+
+    std::string a = replNewId(), b = replNewId();
+    assert(a.size() == 40 && a.find_first_not_of("0123456789abcdef") == std::string::npos);
+    assert(a != b);
+    return 0;
+}
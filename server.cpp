@@ -6,24 +6,42 @@
 #include <stdio.h>
 #include <errno.h>
 #include <math.h>
+#include <ctype.h>
 // system
 #include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <signal.h>
 #include <time.h>
+#include <malloc.h>
+#include <stdarg.h>
 // C++
+#include <algorithm>
+#include <deque>
 #include <string>
 #include <vector>
 // proj
 #include "hashtable.hpp"
 #include "zset.hpp"
+#include "hashobj.h"
+#include "quicklist.h"
+#include "setobj.h"
+#include "glob.h"
+#include "cluster.h"
+#include "repl.h"
+#include "radix.h"
+#include "coro.h"
+#include "uring.h"
 #include "common.hpp"
 #include "list.h"
 #include "heap.h"
 #include "threadpool.h"
+#include "stats.h"
 #include <iostream>
 
 typedef std::vector<uint8_t> Buffer;
@@ -47,6 +65,22 @@ static uint64_t getMonotonicMs() {
     return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
 }
 
+static uint64_t getMonotonicNs() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// xorshift64*, for sampling; not for anything that needs to be unpredictable
+static uint64_t gRng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rnd() {
+    gRng ^= gRng >> 12;
+    gRng ^= gRng << 25;
+    gRng ^= gRng >> 27;
+    return gRng * 0x2545F4914F6CDD1Dull;
+}
+
 static void fd_set_nb(int fd) {
     errno = 0;
     int flags = fcntl(fd, F_GETFL, 0);
@@ -70,7 +104,9 @@ static void bufAppend(Buffer &buf, const uint8_t *data, size_t len) {
         return;
     }
     assert(data != nullptr);
-    buf.insert(buf.end(), data, data + len);
+    size_t size = buf.size();
+    buf.resize(size + len);
+    memcpy(&buf[size], data, len);
 }
 // remove from the front
 static void bufConsume(Buffer &buf, size_t n) {
@@ -79,26 +115,266 @@ static void bufConsume(Buffer &buf, size_t n) {
 
 const size_t k_max_msg = 32 << 20;  // likely larger than the kernel buffer
 
+// A reference-counted byte string that can sit in the output of many
+// connections at once, e.g. a published message serialized once.
+struct SharedBuf {
+    uint32_t refs;
+    size_t len;
+    uint8_t data[0];
+};
+
+static SharedBuf *sharedNew(const uint8_t *data, size_t len) {
+    SharedBuf *buf = (SharedBuf *)malloc(sizeof(SharedBuf) + len);
+    assert(buf);
+    buf->refs = 1;
+    buf->len = len;
+    memcpy(buf->data, data, len);
+    return buf;
+}
+
+static void sharedUnref(SharedBuf *buf) {
+    if (--buf->refs == 0) {
+        free(buf);
+    }
+}
+
+// a shared buffer to be sent after Conn::outgoing[0, pos)
+struct OutRef {
+    size_t pos;
+    SharedBuf *buf;
+};
+
+// a piece of output ready for writev(), see connSeal()
+struct OutChunk {
+    Buffer own;
+    // the data instead of `own` when set
+    SharedBuf *shared = NULL;
+
+    const uint8_t *data() const { return shared ? shared->data : own.data(); }
+    size_t size() const { return shared ? shared->len : own.size(); }
+};
+
 const uint64_t k_idle_timeout_ms = 5 * 1000;
 
+struct Conn;
+struct Entry;
+struct BlockedKey;
+struct Subscription;
+
+// Conn::repl, the connections that carry a replication stream
+enum {
+    REPL_CONN_NONE = 0,
+    // primary: PSYNC was answered, the stream goes out after the reply
+    REPL_CONN_SYNC = 1,
+    // primary: a replica, fed every write, see replFeed()
+    REPL_CONN_REPLICA = 2,
+    // replica: the link to the primary, waiting for the PSYNC reply
+    REPL_CONN_HANDSHAKE = 3,
+    // replica: the link to the primary, running its stream
+    REPL_CONN_MASTER = 4,
+};
+
+// one key a blocked client waits on, linked into BlockedKey::waiters
+struct BlockWait {
+    DList node;
+    Conn *conn = NULL;
+    BlockedKey *bk = NULL;
+};
+
 struct Conn {
     int fd = -1;
     // state of conn for the event loop
     bool wantRead = false;
     bool wantWrite = false;
     bool wantClose = false;
-    // buffers containing I/O of conn
+    // buffers containing I/O of conn; inHead bytes of incoming are
+    // parsed, they are dropped in bulk, see handleData()
     Buffer incoming;
+    size_t inHead = 0;
+    // Handlers append responses here. Shared buffers are not copied in,
+    // outRefs says where they go; connSeal() cuts both into outq.
     Buffer outgoing;
+    std::vector<OutRef> outRefs;
+    size_t outRefsBytes = 0;
+    // sealed output, oldest first; outHead bytes of the front are written
+    std::deque<OutChunk> outq;
+    size_t outHead = 0;
+    size_t outqBytes = 0;
     // timers
     uint64_t lastActiveMs = 0;
     DList idleNode;
+    // BLPOP/BRPOP: parked until a push or the timeout, see connBlock()
+    bool blocked = false;
+    bool blockFront = false;
+    size_t blockHeapIdx = (size_t)-1;
+    std::vector<BlockWait> blockWaits;
+    // in gData.pending: requests or a close left for the end of the
+    // event-loop iteration, see processPending()
+    DList pendingNode;
+    bool deferred = false;
+    // past the soft output limit, see connThrottle()
+    bool throttled = false;
+    uint64_t throttleCount = 0;
+    // io_uring backend: requests in flight, a connDestroy()ed conn is
+    // freed by the last completion; the iovecs of the pending writev
+    uint32_t ioPending = 0;
+    bool sending = false;
+    bool dead = false;
+    // the multishot recv is armed; it is canceled while throttled
+    bool recvArmed = false;
+    bool recvCanceling = false;
+    std::vector<struct iovec> sendIov;
+    // pub/sub, see doSubscribe()
+    std::vector<Subscription *> channels;
+    std::vector<Subscription *> patterns;
+    // a command paused half way, see SlicedArr; later requests wait for
+    // it. replyHeader is where its current reply message starts.
+    CoTask task;
+    size_t replyHeader = 0;
+    bool taskWaitsDrain = false;
+    // MULTI: the queued commands, and whether one was refused, which
+    // makes EXEC fail; inExec while EXEC runs them, see doExec()
+    bool inMulti = false;
+    bool multiError = false;
+    bool inExec = false;
+    std::vector<std::vector<std::string>> multiCmds;
+    // WATCH: keys and their Entry::version then, 0 for a missing key;
+    // watchDirty once a command wrote one of them, see keyTouch()
+    std::vector<std::pair<std::string, uint32_t>> watched;
+    bool watchDirty = false;
+    // cluster mode: ASKING came right before this command; the slot of
+    // the queued commands, a transaction stays in one
+    bool asking = false;
+    int32_t multiSlot = -1;
+    // replication, see doPsync() and replConnect(). replSync is what
+    // follows the PSYNC reply. The requests of a MULTI from the primary
+    // count toward the offset once its EXEC ran, see replApplied().
+    uint8_t repl = REPL_CONN_NONE;
+    Buffer replSync;
+    uint64_t replPendingBytes = 0;
+    // unique for the life of the process
+    uint64_t id = 0;
+    // CLIENT TRACKING: on, in broadcast mode for the prefixes, and not
+    // for its own writes with NOLOOP; the keys to invalidate next
+    bool tracking = false;
+    bool trackingBcast = false;
+    bool trackingNoloop = false;
+    std::vector<std::string> trackingPrefixes;
+    std::vector<std::string> invalidated;
+    bool invalidateAll = false;
 };
 
+// bytes received and not parsed yet, at connInData()
+static size_t connInBytes(Conn *conn) {
+    return conn->incoming.size() - conn->inHead;
+}
+
+static const uint8_t *connInData(Conn *conn) {
+    return conn->incoming.data() + conn->inHead;
+}
+
+// done with the first `n` unparsed bytes
+static void connInConsume(Conn *conn, size_t n) {
+    conn->inHead += n;
+    if (conn->inHead == conn->incoming.size()) {
+        conn->incoming.clear();
+        conn->inHead = 0;
+    }
+}
+
+// bytes waiting to be written
+static size_t connOutBytes(Conn *conn) {
+    return conn->outgoing.size() + conn->outRefsBytes + conn->outqBytes - conn->outHead;
+}
+
+// queue a shared buffer after what is already in the output
+static void connPushShared(Conn *conn, SharedBuf *buf) {
+    buf->refs++;
+    conn->outRefs.push_back(OutRef{conn->outgoing.size(), buf});
+    conn->outRefsBytes += buf->len;
+    conn->wantWrite = true;
+}
+
+static void outqPushOwn(Conn *conn, Buffer &&data) {
+    conn->outqBytes += data.size();
+    conn->outq.emplace_back();
+    conn->outq.back().own = std::move(data);
+}
+
+// Move everything in outgoing/outRefs to outq. Only the bytes between
+// shared buffers are copied; with no shared buffer outgoing is moved.
+static void connSeal(Conn *conn) {
+    size_t start = 0;
+    for (OutRef &ref : conn->outRefs) {
+        if (ref.pos > start) {
+            outqPushOwn(conn, Buffer(conn->outgoing.begin() + start, conn->outgoing.begin() + ref.pos));
+            start = ref.pos;
+        }
+        conn->outqBytes += ref.buf->len;
+        conn->outq.emplace_back();
+        conn->outq.back().shared = ref.buf;
+    }
+    conn->outRefs.clear();
+    conn->outRefsBytes = 0;
+    if (start == 0 && !conn->outgoing.empty()) {
+        outqPushOwn(conn, std::move(conn->outgoing));
+        conn->outgoing = Buffer();
+    } else if (start < conn->outgoing.size()) {
+        outqPushOwn(conn, Buffer(conn->outgoing.begin() + start, conn->outgoing.end()));
+    }
+    conn->outgoing.clear();
+}
+
+// drop `n` written bytes from the front of outq
+static void outqConsume(Conn *conn, size_t n) {
+    n += conn->outHead;
+    while (!conn->outq.empty() && n >= conn->outq.front().size()) {
+        OutChunk &chunk = conn->outq.front();
+        n -= chunk.size();
+        conn->outqBytes -= chunk.size();
+        if (chunk.shared) {
+            sharedUnref(chunk.shared);
+        } else if (conn->outgoing.capacity() == 0) {
+            // recycle the allocation for the next responses
+            conn->outgoing.swap(chunk.own);
+            conn->outgoing.clear();
+        }
+        conn->outq.pop_front();
+    }
+    conn->outHead = n;
+}
+
+static void connOutClear(Conn *conn) {
+    connSeal(conn);
+    outqConsume(conn, conn->outqBytes - conn->outHead);
+}
+
+// point `iov` at up to `max` chunks of sealed output
+static size_t connOutIov(Conn *conn, struct iovec *iov, size_t max) {
+    size_t n = 0;
+    for (OutChunk &chunk : conn->outq) {
+        if (n == max) {
+            break;
+        }
+        size_t skip = n == 0 ? conn->outHead : 0;
+        iov[n].iov_base = (void *)(chunk.data() + skip);
+        iov[n].iov_len = chunk.size() - skip;
+        n++;
+    }
+    return n;
+}
+
 enum {
     ERR_UNKNOWN = 1,
     ERR_TOO_BIG = 2,
     ERR_BAD_ARG = 3,
+    ERR_OOM = 4,
+    // cluster mode: "MOVED <slot> <host:port>", the slot lives there now;
+    // "ASK <slot> <host:port>", this key is there, ask it with ASKING
+    // first; a multi-key request found some keys moved, retry later
+    ERR_MOVED = 5,
+    ERR_ASK = 6,
+    ERR_TRYAGAIN = 7,
 };
 
 bool readUInt32(const uint8_t *&curr, const uint8_t *end, uint32_t &out) {
@@ -119,7 +395,7 @@ bool readStr(const uint8_t *&curr, const uint8_t *end, size_t size, std::string
     return true;
 }
 
-uint32_t parseRequest(const uint8_t *data, size_t size, std::vector<std::string> &out) {
+int32_t parseRequest(const uint8_t *data, size_t size, std::vector<std::string> &out) {
     const uint8_t *end = data + size;
     uint32_t nStr = 0;
     if (!readUInt32(data, end, nStr)) {
@@ -151,6 +427,11 @@ enum {
     TAG_STR = 3,
     TAG_DBL = 4,
     TAG_ARR = 5,
+    // the first elements of an array, the rest follow in the next message
+    TAG_CHUNK = 6,
+    // an array the client did not ask for, between replies, e.g. the
+    // invalidations of CLIENT TRACKING
+    TAG_PUSH = 7,
 };
 
 // help functions for the serialization
@@ -199,6 +480,76 @@ static void outArr(Buffer &out, size_t size) {
     bufAppendU32(out, (uint32_t)size);
 }
 
+// values at least this big are referenced by the reply, not copied
+const size_t k_out_ref_min = 16 << 10;
+
+// a paused command's reply goes out in messages of about this many bytes,
+// and it pauses while k_stream_ahead bytes are unsent, see SlicedArr
+const size_t k_stream_chunk = 16 << 10;
+const size_t k_stream_ahead = 64 << 10;
+
+// a string reply straight from a SharedBuf, see connSeal()
+static void outStrShared(Conn *conn, Buffer &out, SharedBuf *buf) {
+    if (buf->len < k_out_ref_min || &out != &conn->outgoing) {
+        return outStr(out, (const char *)buf->data, buf->len);
+    }
+    bufAppendU8(out, TAG_STR);
+    bufAppendU32(out, (uint32_t)buf->len);
+    connPushShared(conn, buf);
+}
+
+static void responseBegin(Buffer &out, size_t *headerPos) {
+    *headerPos = out.size();
+    bufAppendU32(out, 0);
+}
+
+static size_t responseSize(Buffer &out, size_t header) {
+    return out.size() - header - 4;
+}
+
+static void responseEnd(Buffer &out, size_t header) {
+    size_t size = responseSize(out, header);
+    if (size > k_max_msg) {
+        out.resize(header + 4);
+        outErr(out, ERR_TOO_BIG, "response is too big");
+        size = responseSize(out, header);
+    }
+    // message header
+    uint32_t len = (uint32_t)size;
+    memcpy(&out[header], &len, 4);   
+}
+
+// unref the shared buffers queued from outRefs[first] on
+static void connDropRefs(Conn *conn, size_t first) {
+    for (size_t i = first; i < conn->outRefs.size(); i++) {
+        conn->outRefsBytes -= conn->outRefs[i].buf->len;
+        sharedUnref(conn->outRefs[i].buf);
+    }
+    conn->outRefs.resize(first);
+}
+
+// responseEnd() for conn->outgoing, also counting the shared buffers the
+// response references from outRefs[firstRef] on
+static void connResponseEnd(Conn *conn, size_t header, size_t firstRef) {
+    size_t refBytes = 0;
+    for (size_t i = firstRef; i < conn->outRefs.size(); i++) {
+        refBytes += conn->outRefs[i].buf->len;
+    }
+    Buffer &out = conn->outgoing;
+    if (refBytes == 0) {
+        return responseEnd(out, header);
+    }
+    if (responseSize(out, header) + refBytes > k_max_msg) {
+        // the headers of the referenced strings go too
+        connDropRefs(conn, firstRef);
+        out.resize(header + 4);
+        outErr(out, ERR_TOO_BIG, "response is too big");
+        return responseEnd(out, header);
+    }
+    uint32_t len = (uint32_t)(responseSize(out, header) + refBytes);
+    memcpy(&out[header], &len, 4);
+}
+
 static bool str2dbl(const std::string &s, double &out) {
     char *endp = NULL;
     out = strtod(s.c_str(), &endp);
@@ -211,6 +562,106 @@ static bool str2int(const std::string &s, int64_t &out) {
     return endp == s.c_str() + s.size();
 }
 
+enum {
+    EVICT_NONE = 0,
+    EVICT_ALLKEYS_LRU = 1,
+    EVICT_ALLKEYS_LFU = 2,
+    EVICT_ALLKEYS_RANDOM = 3,
+    EVICT_VOLATILE_LRU = 4,
+    EVICT_VOLATILE_LFU = 5,
+};
+
+static const char *const k_evict_policy_names[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "allkeys-random",
+    "volatile-lru", "volatile-lfu", NULL,
+};
+
+// how the event loop waits for sockets, see runPollLoop()/runUringLoop()
+enum {
+    IO_POLL = 0,
+    // falls back to poll() when the kernel cannot do it
+    IO_URING = 1,
+};
+
+static const char *const k_io_backend_names[] = {"poll", "uring", NULL};
+
+// client classes for the output buffer limits, see connClass()
+enum {
+    CLIENT_NORMAL = 0,
+    CLIENT_PUBSUB = 1,
+    CLIENT_CLASSES = 2,
+};
+
+static const char *const k_client_class_names[] = {"normal", "pubsub"};
+
+static const char *const k_yes_no_names[] = {"no", "yes", NULL};
+
+// keyspace notifications: the channels to publish on, then the classes
+// of events, see notifyKeyspaceEvent()
+enum {
+    // __keyspace@0__:<key>, the message is the event
+    NOTIFY_KEYSPACE = 1 << 0,
+    // __keyevent@0__:<event>, the message is the key
+    NOTIFY_KEYEVENT = 1 << 1,
+    // DEL
+    NOTIFY_GENERIC = 1 << 2,
+    // SET
+    NOTIFY_STRING = 1 << 3,
+    // ZADD
+    NOTIFY_ZSET = 1 << 4,
+    // a TTL ran out
+    NOTIFY_EXPIRED = 1 << 5,
+    // dropped by maxmemory
+    NOTIFY_EVICTED = 1 << 6,
+};
+
+// one letter per bit, as in `notify-keyspace-events Ex`
+static const char *const k_notify_flag_names[] = {"K", "E", "g", "$", "z", "x", "e", NULL};
+
+// Runtime configuration: `--name value` on the command line and
+// CONFIG GET/SET while running. See k_config_params for the names.
+static struct {
+    int64_t port = 1234;
+    // commands running at least this long are logged, -1 disables
+    int64_t slowlogSlowerThanUs = 10000;
+    int64_t slowlogMaxLen = 128;
+    // bytes of data before write commands start evicting, 0 is unlimited
+    int64_t maxmemory = 0;
+    int64_t maxmemoryPolicy = EVICT_NONE;
+    int64_t maxmemorySamples = 5;
+    int64_t lfuLogFactor = 10;
+    // minutes for an LFU counter to decay by one
+    int64_t lfuDecayTime = 1;
+    int64_t ioBackend = IO_POLL;
+    // output buffer bytes per client class, 0 is unlimited. Past the soft
+    // limit requests wait, past the hard one the client is disconnected.
+    int64_t outputSoftLimit[CLIENT_CLASSES] = {1 << 20, 8 << 20};
+    int64_t outputHardLimit[CLIENT_CLASSES] = {0, 32 << 20};
+    // requests and microseconds a client may use per event-loop
+    // iteration before yielding to the others, 0 is unlimited
+    int64_t requestBudget = 64;
+    int64_t requestBudgetUs = 1000;
+    // serve only the hash slots assigned to this node, see clusterRoute()
+    int64_t clusterEnabled = 0;
+    // bytes of the replication stream kept for replicas that reconnect
+    int64_t replBacklogSize = 1 << 20;
+    // keys remembered for CLIENT TRACKING, 0 is unlimited
+    int64_t trackingTableMaxKeys = 1000000;
+    // NOTIFY_* bits, none by default
+    int64_t notifyKeyspaceEvents = 0;
+    // keep gData.keyIndex, for KEYS by prefix and in order
+    int64_t keyIndex = 0;
+} gConfig;
+
+const size_t k_evict_pool_size = 16;
+
+struct EvictCandidate {
+    // higher is evicted first
+    uint64_t score = 0;
+    // looked up again before evicting, the entry may be gone by then
+    std::string key;
+};
+
 static struct {
     HMap db;
     // a map of all client connections
@@ -219,9 +670,103 @@ static struct {
     DList idleList;
     // timers for TTLs
     std::vector<HeapItem> heap;
+    // BlockedKey by key name, and the timeouts of the blocked clients
+    HMap blockingKeys;
+    std::vector<HeapItem> blockHeap;
+    size_t blockedClients;
+    // Conn::pendingNode; clients out of budget wait in `deferred` for the
+    // next iteration, see connRunRequests()
+    DList pending;
+    DList deferred;
+    // clients over their soft output limit
+    size_t throttledClients;
+    // PubsubTopic by channel name, and the list of subscribed patterns
+    HMap channels;
+    DList patterns;
+    size_t npatterns;
     ThreadPool threadPool;
+    // estimated bytes held by the entries, see entryMemUsage()
+    size_t dataMemory;
+    // refreshed once per event-loop iteration, feeds the LRU/LFU clocks
+    uint64_t clockMs;
+    // best eviction candidates seen so far, ascending by score
+    EvictCandidate evictPool[k_evict_pool_size];
+    size_t evictPoolLen;
+    // set while the io_uring loop runs
+    Uring *uring;
+    // the last Entry::version handed out, the keys WATCHed by all
+    // clients and WatchedKey by key name
+    uint32_t keyVersion;
+    size_t watchedKeys;
+    HMap watching;
+    // cluster mode: the slot map, and the keys by slot
+    Cluster cluster;
+    std::vector<std::vector<Entry *>> slotKeys;
+    // key-index: every key in order, see keyIndexAdd()
+    RadixTree keyIndex;
+    // replication, see replFeed(): the history the offset counts bytes
+    // of, and the ring of its tail, allocated for the first replica
+    std::string replid;
+    ReplBacklog backlog;
+    std::vector<Conn *> replicas;
+    // what the running write command feeds instead of or after itself,
+    // see replInstead()/replAlso(); EXEC wraps its writes in MULTI
+    bool replSkipCmd;
+    std::vector<std::vector<std::string>> replOps;
+    uint8_t replTxn;
+    // replica: the primary, the link to it and when to retry it, and the
+    // snapshot bytes still to load, which the offset does not count
+    std::string masterHost;
+    uint16_t masterPort;
+    Conn *masterConn;
+    uint64_t replRetryMs;
+    uint64_t replSnapshotLeft;
+    // the last Conn::id handed out
+    uint64_t lastConnId;
+    // CLIENT TRACKING: TrackedKey by key name, the clients with tracking
+    // on, and those of them in broadcast mode
+    HMap tracking;
+    size_t trackingClients;
+    std::vector<Conn *> bcastClients;
 } gData;
 
+// Server counters. Only the event-loop thread updates them, so they are
+// plain thread_local integers: no atomics, no shared cache lines with the
+// worker threads. Per-command counters live next to the command table.
+static thread_local struct {
+    uint64_t startMs = 0;
+    uint64_t connsAccepted = 0;
+    uint64_t connsCurrent = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t unknownCmds = 0;
+    uint64_t keyspaceHits = 0;
+    uint64_t keyspaceMisses = 0;
+    uint64_t evictedKeys = 0;
+    // times a client went over its soft / hard output limit
+    uint64_t outputThrottled = 0;
+    uint64_t outputDisconnects = 0;
+    // times a client ran out of its per-iteration budget
+    uint64_t budgetExhausted = 0;
+    // times a command paused half way, see SlicedArr
+    uint64_t commandYields = 0;
+    // PSYNCs answered with a snapshot, with the backlog, and the ones for
+    // this history the backlog no longer covered
+    uint64_t syncFull = 0;
+    uint64_t syncPartialOk = 0;
+    uint64_t syncPartialErr = 0;
+    // keys sent to CLIENT TRACKING clients, and keys the tracking table
+    // forgot to stay under tracking-table-max-keys
+    uint64_t trackingInvalidations = 0;
+    uint64_t trackingEvictedKeys = 0;
+    // time spent handling events per loop iteration
+    Histogram loopNs;
+    // time blocked in poll()
+    Histogram pollNs;
+} gStats;
+
+static Conn *connNew(int connfd, const struct sockaddr_in &client_addr);
+
 static Conn *handleAccept(int fd) {
     // accept
     struct sockaddr_in client_addr = {};
@@ -231,6 +776,10 @@ static Conn *handleAccept(int fd) {
         msg_errno("accept() error");
         return NULL;
     }
+    return connNew(connfd, client_addr);
+}
+
+static Conn *connNew(int connfd, const struct sockaddr_in &client_addr) {
     uint32_t ip = client_addr.sin_addr.s_addr;
     fprintf(stderr, "new client from %u.%u.%u.%u:%u\n",
         ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, ip >> 24,
@@ -239,63 +788,149 @@ static Conn *handleAccept(int fd) {
 
     // set the new connection fd to nonblocking mode
     fd_set_nb(connfd);
+    // a reply must not wait behind an unacknowledged push, see trackingFlush()
+    int val = 1;
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 
     // create a `struct Conn`
     Conn *conn = new Conn();
     conn->fd = connfd;
     conn->wantRead = true;
     conn->lastActiveMs = getMonotonicMs();
+    conn->id = ++gData.lastConnId;
     dlistInsertBefore(&gData.idleList, &conn->idleNode);
+    dlistInit(&conn->pendingNode);
+    gStats.connsAccepted++;
+    gStats.connsCurrent++;
+    if (gData.fd2conn.size() <= (size_t)conn->fd) {
+        gData.fd2conn.resize(conn->fd + 1);
+    }
+    assert(!gData.fd2conn[conn->fd]);
+    gData.fd2conn[conn->fd] = conn;
     return conn;
 }
 
+static void connUnblock(Conn *conn);
+static void pubsubUnsubscribeAll(Conn *conn);
+static void unwatchAll(Conn *conn);
+static void replDetach(Conn *conn);
+static void trackingOff(Conn *conn);
+
+// work for processPending() at the end of this iteration
+static void connQueuePending(Conn *conn) {
+    dlistDetach(&conn->pendingNode);
+    dlistInsertBefore(&gData.pending, &conn->pendingNode);
+}
+
+// work for the next iteration, see resumeDeferred()
+static void connDefer(Conn *conn) {
+    conn->deferred = true;
+    dlistDetach(&conn->pendingNode);
+    dlistInsertBefore(&gData.deferred, &conn->pendingNode);
+}
+
+static void connUnthrottle(Conn *conn) {
+    if (conn->throttled) {
+        conn->throttled = false;
+        gData.throttledClients--;
+    }
+}
+
+static void connFree(Conn *conn) {
+    connOutClear(conn);
+    delete conn;
+}
+
 static void connDestroy(Conn *conn) {
+    if (conn->ioPending > 0) {
+        // ends the in-flight recv and writev, their completions free it
+        (void)shutdown(conn->fd, SHUT_RDWR);
+    }
     (void)close(conn->fd);
     gData.fd2conn[conn->fd] = NULL;
+    if (conn->blocked) {
+        connUnblock(conn);
+    }
+    pubsubUnsubscribeAll(conn);
+    unwatchAll(conn);
+    replDetach(conn);
+    trackingOff(conn);
+    connUnthrottle(conn);
     dlistDetach(&conn->idleNode);
-    delete conn;
+    dlistDetach(&conn->pendingNode);
+    gStats.connsCurrent--;
+    conn->dead = true;
+    if (conn->ioPending == 0) {
+        connFree(conn);
+    }
 }
 
 enum {
     T_INIT = 0,
     T_STR  = 1,
     T_ZSET = 2,
+    T_HASH = 3,
+    T_LIST = 4,
+    T_SET  = 5,
 };
 
+// encodings of T_STR values
+enum {
+    // int64 in Entry::ival, for strings that print back unchanged
+    ENC_INT = 0,
+    // stored in the entry's allocation right after the key
+    ENC_EMBSTR = 1,
+    // a SharedBuf, so that replies can reference it instead of copying
+    ENC_RAW = 2,
+};
+
+// new string entries embed values up to this size
+const size_t k_embstr_max = 64;
+
+// One malloc() holds the header, the key and an embedded string value,
+// like the name tail of ZNode. See entryNew().
 struct Entry {
     struct HNode node;
-    std::string key;
     // for TTL
-    size_t heapIdx = -1;
+    size_t heapIdx;
+    // set when created, a WATCH sees the key expired or evicted and
+    // recreated; writes by commands are seen by keyTouch()
+    uint32_t version;
+    // cluster mode, the index in gData.slotKeys, see slotKeysAdd()
+    uint32_t slotPos;
     // value
-    uint32_t type = 0;
+    uint32_t type : 4;
+    uint32_t encoding : 4;
+    // LRU clock or LFU counter, see entryTouch()
+    uint32_t lru : 24;
+    uint32_t klen;
     union {
-        std::string str;
-        ZSet zset;
+        int64_t ival;
+        // ENC_EMBSTR length
+        size_t elen;
+        // ENC_RAW, the entry holds one reference
+        SharedBuf *raw;
+        ZSet *zset;
+        HashObj hash;
+        QuickList *list;
+        SetObj set;
     };
-
-    explicit Entry(uint32_t type) : type(type) {
-        if (type == T_ZSET) {
-            new (&zset) ZSet;
-        } else if (type == T_STR) {
-            new (&str) std::string;
-        }
-    }
-
-    ~Entry() {
-        if (type == T_ZSET) {
-            zsetClear(&zset);
-        } else if (type == T_STR) {
-            str.~basic_string();
-        }
-    }
+    char key[0];
 };
 
+// borrows the key bytes, so lookups leave the request arguments intact
 struct LookupKey {
     struct HNode node;
-    std::string key;
+    const char *key = NULL;
+    size_t len = 0;
 };
 
+static void lookupKeyInit(LookupKey *key, const std::string &name) {
+    key->key = name.data();
+    key->len = name.size();
+    key->node.hcode = strHash((uint8_t *)name.data(), name.size());
+}
+
 static void heapUpsert(std::vector<HeapItem> &a, size_t pos, HeapItem t) {
     if (pos < a.size()) {
         a[pos] = t;
@@ -328,17 +963,210 @@ static void entrySetTTL(Entry *ent, int64_t ttlMs) {
     } 
 }
 
-static Entry *entryNew(uint32_t type) {
-    Entry *ent = new Entry(type);
+const uint32_t k_lru_max = (1 << 24) - 1;
+const uint32_t k_lfu_init_val = 5;
+
+static bool policyIsLFU() {
+    return gConfig.maxmemoryPolicy == EVICT_ALLKEYS_LFU
+        || gConfig.maxmemoryPolicy == EVICT_VOLATILE_LFU;
+}
+
+// seconds, wraps after ~194 days
+static uint32_t lruClock() {
+    return (uint32_t)(gData.clockMs / 1000) & k_lru_max;
+}
+
+static uint32_t lfuMinutes() {
+    return (uint32_t)(gData.clockMs / 60000) & 0xFFFF;
+}
+
+// The LFU field holds the minute of the last decrement (16 bits) above
+// a logarithmic access counter (8 bits). Returns the decayed counter.
+static uint32_t lfuDecay(uint32_t lru) {
+    uint32_t counter = lru & 255;
+    uint32_t elapsed = (lfuMinutes() - (lru >> 8)) & 0xFFFF;
+    uint32_t periods = gConfig.lfuDecayTime ? elapsed / (uint32_t)gConfig.lfuDecayTime : 0;
+    return periods > counter ? 0 : counter - periods;
+}
+
+// increments get less likely as the counter grows, so 8 bits cover
+// about a million accesses with the default log factor
+static uint32_t lfuLogIncr(uint32_t counter) {
+    if (counter == 255) {
+        return counter;
+    }
+    double r = (double)(rnd() >> 11) * 0x1.0p-53;
+    uint32_t base = counter > k_lfu_init_val ? counter - k_lfu_init_val : 0;
+    double p = 1.0 / ((double)base * (double)gConfig.lfuLogFactor + 1);
+    return r < p ? counter + 1 : counter;
+}
+
+// record an access for the eviction policy
+static void entryTouch(Entry *ent) {
+    if (policyIsLFU()) {
+        ent->lru = (lfuMinutes() << 8) | lfuLogIncr(lfuDecay(ent->lru));
+    } else {
+        ent->lru = lruClock();
+    }
+}
+
+// Wraps; 0 stands for a missing key. A WATCH misses a write only if
+// exactly a multiple of 2^32 versions were handed out in between.
+static uint32_t nextKeyVersion() {
+    if (++gData.keyVersion == 0) {
+        ++gData.keyVersion;
+    }
+    return gData.keyVersion;
+}
+
+// `tail` reserves room for an embedded string value after the key
+static Entry *entryNew(uint32_t type, const std::string &key, size_t tail) {
+    Entry *ent = (Entry *)malloc(sizeof(Entry) + key.size() + tail);
+    assert(ent);
+    ent->node.next = NULL;
+    ent->node.hcode = 0;
+    ent->heapIdx = (size_t)-1;
+    ent->version = nextKeyVersion();
+    ent->slotPos = 0;
     ent->type = type;
+    ent->encoding = ENC_EMBSTR;
+    ent->lru = policyIsLFU() ? (lfuMinutes() << 8) | k_lfu_init_val : lruClock();
+    ent->klen = (uint32_t)key.size();
+    memcpy(ent->key, key.data(), key.size());
+    ent->elen = 0;
+    if (type == T_ZSET) {
+        ent->zset = new ZSet();
+    } else if (type == T_HASH) {
+        ent->hash = HashObj{};
+    } else if (type == T_LIST) {
+        ent->list = new QuickList();
+    } else if (type == T_SET) {
+        ent->set = SetObj{};
+    }
+    return ent;
+}
+
+static char *entryEmbStr(Entry *ent) {
+    return ent->key + ent->klen;
+}
+
+// room for an embedded value, including the allocator's slack
+static size_t entryEmbCap(Entry *ent) {
+    return malloc_usable_size(ent) - sizeof(Entry) - ent->klen;
+}
+
+const size_t k_int_str_max = 24;
+
+// bytes of a T_STR value, ENC_INT is formatted into `buf`
+static const char *entryStr(Entry *ent, char *buf, size_t *len) {
+    if (ent->encoding == ENC_INT) {
+        *len = int2str(ent->ival, buf);
+        return buf;
+    } else if (ent->encoding == ENC_EMBSTR) {
+        *len = ent->elen;
+        return entryEmbStr(ent);
+    }
+    *len = ent->raw->len;
+    return (const char *)ent->raw->data;
+}
+
+static void outEntryStr(Conn *conn, Buffer &out, Entry *ent) {
+    if (ent->encoding == ENC_RAW) {
+        return outStrShared(conn, out, ent->raw);
+    }
+    char buf[k_int_str_max];
+    size_t len = 0;
+    const char *val = entryStr(ent, buf, &len);
+    outStr(out, val, len);
+}
+
+// Picks the smallest encoding that fits. The entry is never reallocated
+// since the hashtable, the TTL heap and the eviction pool refer to it.
+static void entrySetStr(Entry *ent, const char *data, size_t len) {
+    int64_t ival = 0;
+    if (str2intExact(data, len, ival)) {
+        if (ent->encoding == ENC_RAW) {
+            sharedUnref(ent->raw);
+        }
+        ent->encoding = ENC_INT;
+        ent->ival = ival;
+    } else if (len <= entryEmbCap(ent)) {
+        if (ent->encoding == ENC_RAW) {
+            sharedUnref(ent->raw);
+        }
+        ent->encoding = ENC_EMBSTR;
+        ent->elen = len;
+        memcpy(entryEmbStr(ent), data, len);
+    } else if (ent->encoding == ENC_RAW && ent->raw->refs == 1
+        && malloc_usable_size(ent->raw) >= sizeof(SharedBuf) + len)
+    {
+        // not pinned by any output, overwrite in place
+        ent->raw->len = len;
+        memcpy(ent->raw->data, data, len);
+    } else {
+        if (ent->encoding == ENC_RAW) {
+            sharedUnref(ent->raw);
+        }
+        ent->encoding = ENC_RAW;
+        ent->raw = sharedNew((const uint8_t *)data, len);
+    }
+}
+
+static Entry *entryNewStr(const std::string &key, const std::string &val) {
+    int64_t ival = 0;
+    bool embed = val.size() <= k_embstr_max && !str2intExact(val.data(), val.size(), ival);
+    Entry *ent = entryNew(T_STR, key, embed ? val.size() : 0);
+    entrySetStr(ent, val.data(), val.size());
     return ent;
 }
 
+// Bytes owned by an entry, as the allocator sees them. Kept in
+// gData.dataMemory: entries are counted when inserted and uncounted in
+// entryDel(), and commands that resize a value report the difference
+// with dbMemAdjust().
+static size_t entryMemUsage(Entry *ent) {
+    size_t n = malloc_usable_size(ent);
+    if (ent->type == T_STR && ent->encoding == ENC_RAW) {
+        n += malloc_usable_size(ent->raw);
+    } else if (ent->type == T_ZSET) {
+        n += sizeof(ZSet) + zsetMemUsage(ent->zset);
+    } else if (ent->type == T_HASH) {
+        n += hobjMemUsage(&ent->hash);
+    } else if (ent->type == T_LIST) {
+        n += sizeof(QuickList) + qlMemUsage(ent->list);
+    } else if (ent->type == T_SET) {
+        n += sobjMemUsage(&ent->set);
+    }
+    return n;
+}
+
+static void dbMemAdjust(size_t before, size_t after) {
+    gData.dataMemory += after - before;
+}
+
+// what maxmemory is compared against
+static size_t usedMemory() {
+    return gData.dataMemory + hmMemUsage(&gData.db)
+        + gData.heap.capacity() * sizeof(HeapItem) + gData.keyIndex.mem;
+}
+
 static void entryDelSync(Entry *ent) {
     if (ent->type == T_ZSET) {
-        zsetClear(&ent->zset);
+        zsetClear(ent->zset);
+        delete ent->zset;
+    } else if (ent->type == T_HASH) {
+        hobjClear(&ent->hash);
+    } else if (ent->type == T_LIST) {
+        qlClear(ent->list);
+        delete ent->list;
+    } else if (ent->type == T_SET) {
+        sobjClear(&ent->set);
+    } else if (ent->type == T_STR && ent->encoding == ENC_RAW) {
+        // strings are always freed here on the event loop, which owns
+        // the (non-atomic) reference counts
+        sharedUnref(ent->raw);
     }
-    delete ent;
+    free(ent);
 }
 
 static void entryDelFunc(void *arg) {
@@ -346,9 +1174,19 @@ static void entryDelFunc(void *arg) {
 }
 
 static void entryDel(Entry *ent) {
+    gData.dataMemory -= entryMemUsage(ent);
     entrySetTTL(ent, -1);
     // Run destructor in thread pool for large data structures
-    size_t setSize = (ent->type == T_ZSET) ? hmSize(&ent->zset.hmap) : 0;
+    size_t setSize = 0;
+    if (ent->type == T_ZSET) {
+        setSize = hmSize(&ent->zset->hmap);
+    } else if (ent->type == T_HASH) {
+        setSize = ent->hash.len;
+    } else if (ent->type == T_LIST) {
+        setSize = ent->list->len;
+    } else if (ent->type == T_SET) {
+        setSize = sobjLen(&ent->set);
+    }
     const size_t largeContainerSize = 1000;
     if (setSize > largeContainerSize) {
         threadPoolQueue(&gData.threadPool, &entryDelFunc, ent);
@@ -360,103 +1198,619 @@ static void entryDel(Entry *ent) {
 static bool entryEq(HNode *node, HNode *key) {
     struct Entry *ent = container_of(node, struct Entry, node);
     struct LookupKey *keydata = container_of(key, struct LookupKey, node);
-    return ent->key == keydata->key;
+    return ent->klen == keydata->len && memcmp(ent->key, keydata->key, keydata->len) == 0;
 }
 
-static size_t outBeginArr(Buffer &out) {
-    out.push_back(TAG_ARR);
-    bufAppendU32(out, 0);
-    return out.size() - 4;
+// for unlinking an entry that is already at hand
+static bool entrySame(HNode *node, HNode *key) {
+    return node == key;
 }
 
-static void outEndArr(Buffer &out, size_t ctx, uint32_t n) {
-    assert(out[ctx - 1] == TAG_ARR);
-    memcpy(&out[ctx], &n, 4);
+// Cluster mode: the keys of each slot in gData.slotKeys, so that slot
+// counts and migration need no walk of the whole keyspace.
+static void slotKeysAdd(Entry *ent) {
+    if (gConfig.clusterEnabled) {
+        std::vector<Entry *> &keys = gData.slotKeys[keyHashSlot(ent->key, ent->klen)];
+        ent->slotPos = (uint32_t)keys.size();
+        keys.push_back(ent);
+    }
 }
 
-static const ZSet k_empty_zset;
-
-static ZSet *expectZset(std::string &name) {
-    LookupKey key;
-    key.key.swap(name);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
-    // hashtable lookup
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    if (!node) {
-        return (ZSet *)&k_empty_zset;
+static void slotKeysDel(Entry *ent) {
+    if (gConfig.clusterEnabled) {
+        std::vector<Entry *> &keys = gData.slotKeys[keyHashSlot(ent->key, ent->klen)];
+        keys[ent->slotPos] = keys.back();
+        keys[ent->slotPos]->slotPos = ent->slotPos;
+        keys.pop_back();
     }
-    Entry *ent = container_of(node, Entry, node);
-    return ent->type == T_ZSET ? &ent->zset : NULL;
 }
 
-static void doZQuery(std::vector<std::string> &cmd, Buffer &out) {
-    // parse args
-    double score = 0;
-    if (!str2dbl(cmd[2], score)) {
-        return outErr(out, ERR_BAD_ARG, "expect score to be number");
-    }
-    const std::string &name = cmd[3];
-    int64_t offset = 0, limit = 0;
-    if (!str2int(cmd[4], offset)) {
-        return outErr(out, ERR_BAD_ARG, "expect offset to be number");
+// With key-index on, the keys are also in a radix tree, in order, so
+// that a prefix is found without a walk of the whole keyspace.
+static void keyIndexAdd(Entry *ent) {
+    if (gConfig.keyIndex) {
+        radixInsert(&gData.keyIndex, ent->key, ent->klen, ent);
     }
-    if (!str2int(cmd[5], limit)) {
-        return outErr(out, ERR_BAD_ARG, "expect limit to be number");
+}
+
+static void keyIndexDel(Entry *ent) {
+    if (gConfig.keyIndex) {
+        radixRemove(&gData.keyIndex, ent->key, ent->klen);
     }
+}
 
-    ZSet *zset = expectZset(cmd[1]);
-    if (!zset) {
-        return outErr(out, ERR_BAD_ARG, "expected zset");
+static bool cbKeyIndexAdd(HNode *node, void *) {
+    keyIndexAdd(container_of(node, Entry, node));
+    return true;
+}
+
+// turned on: indexes the existing keys at once
+static void keyIndexUpdate() {
+    if (gConfig.keyIndex && !gData.keyIndex.root) {
+        radixInit(&gData.keyIndex);
+        hmForEach(&gData.db, &cbKeyIndexAdd, NULL);
+    } else if (!gConfig.keyIndex) {
+        radixClear(&gData.keyIndex);
     }
-    
-    if (limit <= 0) {
-        return outArr(out, 0);
+}
+
+// link a new entry (hcode set) into the keyspace
+static void dbAdd(Entry *ent) {
+    hmInsert(&gData.db, &ent->node);
+    slotKeysAdd(ent);
+    keyIndexAdd(ent);
+    gData.dataMemory += entryMemUsage(ent);
+}
+
+// the rest of a delete once the entry is out of the hashtable
+static void dbUnlink(Entry *ent) {
+    slotKeysDel(ent);
+    keyIndexDel(ent);
+    entryDel(ent);
+}
+
+// unlink and free an entry, e.g. an emptied container
+static void dbDelete(Entry *ent) {
+    hmDelete(&gData.db, &ent->node, &entrySame);
+    dbUnlink(ent);
+}
+
+static void appendRequest(std::string &data, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + (uint32_t)s.size();
     }
-    // search for key
-    ZNode *znode = zsetSeekge(zset, score, name.data(), name.size());
-    znode = znodeOffset(znode, offset);
-    // iterate and output
-    size_t ctx = outBeginArr(out);
-    int64_t n = 0;
-    while (znode && n < limit) {
-        outStr(out, znode->name, znode->len);
-        outDbl(out, znode->score);
-        znode = znodeOffset(znode, +1);
-        n += 2;
+    uint32_t nstr = (uint32_t)cmd.size();
+    data.append((const char *)&len, 4);
+    data.append((const char *)&nstr, 4);
+    for (const std::string &s : cmd) {
+        uint32_t size = (uint32_t)s.size();
+        data.append((const char *)&size, 4);
+        data.append(s);
     }
-    outEndArr(out, ctx, (uint32_t)n);
 }
 
-static void doZAdd(std::vector<std::string> &cmd, Buffer &out) {
-    LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
+// gData.replTxn
+enum {
+    REPL_TXN_NONE = 0,
+    // EXEC runs, its first write opens the MULTI
+    REPL_TXN_WANTED = 1,
+    REPL_TXN_OPEN = 2,
+};
+
+// whether writes are fed anywhere, i.e. this is a primary with a backlog
+static bool replActive() {
+    return !gData.backlog.buf.empty();
+}
+
+// Replication, primary side: writes go to the backlog and to every
+// replica as requests, in the order they were applied here. Replicas run
+// them as they come; commands whose effect depends on more than the data
+// (a blocking pop, expiry, eviction) are fed as what they did.
+static void replFeed(const std::vector<std::string> &cmd) {
+    if (!replActive()) {
+        return;
+    }
+    if (gData.replTxn == REPL_TXN_WANTED) {
+        gData.replTxn = REPL_TXN_OPEN;
+        replFeed({"multi"});
+    }
+    std::string data;
+    appendRequest(data, cmd);
+    backlogAppend(&gData.backlog, (const uint8_t *)data.data(), data.size());
+    for (Conn *conn : gData.replicas) {
+        bufAppend(conn->outgoing, (const uint8_t *)data.data(), data.size());
+        conn->wantWrite = true;
+    }
+}
+
+// a key deleted without a command, e.g. expired
+static void replFeedDel(Entry *ent) {
+    if (replActive()) {
+        replFeed({"del", std::string(ent->key, ent->klen)});
+    }
+}
+
+// the running write command is not fed itself, see cmdCall()
+static void replInstead() {
+    gData.replSkipCmd = true;
+}
+
+// fed after the running write command
+static void replAlso(std::vector<std::string> cmd) {
+    if (replActive()) {
+        gData.replOps.push_back(std::move(cmd));
+    }
+}
+
+static void connCheckOutput(Conn *conn);
+static void notifyPublish(uint32_t type, const char *event, const char *key, size_t len);
+
+// A keyspace event of class `type`. Publishing builds channel names, so
+// it is only done for an enabled class while someone is subscribed.
+static void notifyKeyspaceEvent(uint32_t type, const char *event, const char *key, size_t len) {
+    if ((gConfig.notifyKeyspaceEvents & type)
+        && (hmSize(&gData.channels) > 0 || gData.npatterns > 0))
+    {
+        notifyPublish(type, event, key, len);
+    }
+}
+
+// CLIENT TRACKING: the server remembers which clients read which keys and
+// tells them when a key changes, so that they can cache values locally.
+// A key is forgotten once invalidated, until read again. Clients are
+// referenced by fd and id, a closed one is skipped when found gone.
+struct TrackRef {
+    int fd;
+    uint64_t id;
+};
+
+struct TrackedKey {
+    HNode node;
+    std::string key;
+    std::vector<TrackRef> clients;
+};
+
+static bool trackedKeyEq(HNode *node, HNode *key) {
+    TrackedKey *tk = container_of(node, TrackedKey, node);
+    LookupKey *keydata = container_of(key, LookupKey, node);
+    return tk->key.size() == keydata->len && memcmp(tk->key.data(), keydata->key, keydata->len) == 0;
+}
+
+// Invalidations wait until the client is between replies, i.e. for the
+// end of the event-loop iteration, see trackingFlush().
+static void trackingQueue(Conn *conn, const char *key, size_t len) {
+    if (conn->invalidated.empty() && !conn->invalidateAll && !conn->deferred) {
+        connQueuePending(conn);
+    }
+    if (!conn->invalidateAll) {
+        conn->invalidated.emplace_back(key, len);
+    }
+}
+
+static void trackingSend(TrackedKey *tk, Conn *writer) {
+    for (const TrackRef &ref : tk->clients) {
+        Conn *conn = (size_t)ref.fd < gData.fd2conn.size() ? gData.fd2conn[ref.fd] : NULL;
+        if (conn && conn->id == ref.id && conn->tracking && !conn->trackingBcast
+            && !(conn == writer && conn->trackingNoloop))
+        {
+            trackingQueue(conn, tk->key.data(), tk->key.size());
+        }
+    }
+}
+
+static void trackingDrop(TrackedKey *tk) {
+    hmDelete(&gData.tracking, &tk->node, &entrySame);
+    delete tk;
+}
+
+// Down to `limit` keys. The clients of a forgotten key would never hear
+// of it again, they are told to drop it now.
+static void trackingEvict(size_t limit) {
+    while (hmSize(&gData.tracking) > limit) {
+        HNode *node = NULL;
+        if (hmSample(&gData.tracking, (size_t)rnd(), &node, 1) == 0) {
+            break;
+        }
+        TrackedKey *tk = container_of(node, TrackedKey, node);
+        trackingSend(tk, NULL);
+        trackingDrop(tk);
+        gStats.trackingEvictedKeys++;
+    }
+}
+
+static void trackingTableResize() {
+    if (gConfig.trackingTableMaxKeys > 0) {
+        trackingEvict((size_t)gConfig.trackingTableMaxKeys);
+    }
+}
+
+// `conn` read `name`
+static void trackingRemember(Conn *conn, const std::string &name) {
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    HNode *node = hmLookup(&gData.tracking, &key.node, &trackedKeyEq);
+    TrackedKey *tk = NULL;
+    if (node) {
+        tk = container_of(node, TrackedKey, node);
+    } else {
+        if (gConfig.trackingTableMaxKeys > 0) {
+            trackingEvict((size_t)gConfig.trackingTableMaxKeys - 1);
+        }
+        tk = new TrackedKey();
+        tk->node.hcode = key.node.hcode;
+        tk->key = name;
+        hmInsert(&gData.tracking, &tk->node);
+    }
+    for (const TrackRef &ref : tk->clients) {
+        if (ref.id == conn->id) {
+            return;
+        }
+    }
+    tk->clients.push_back(TrackRef{conn->fd, conn->id});
+}
+
+// `key` changed, by `writer` or by expiry/eviction when NULL
+static void trackingInvalidate(Conn *writer, const char *key, size_t len) {
+    if (gData.trackingClients == 0) {
+        return;
+    }
+    if (hmSize(&gData.tracking) > 0) {
+        LookupKey lk;
+        lk.key = key;
+        lk.len = len;
+        lk.node.hcode = strHash((const uint8_t *)key, len);
+        if (HNode *node = hmLookup(&gData.tracking, &lk.node, &trackedKeyEq)) {
+            TrackedKey *tk = container_of(node, TrackedKey, node);
+            trackingSend(tk, writer);
+            trackingDrop(tk);
+        }
+    }
+    for (Conn *conn : gData.bcastClients) {
+        if (conn == writer && conn->trackingNoloop) {
+            continue;
+        }
+        for (const std::string &prefix : conn->trackingPrefixes) {
+            if (len >= prefix.size() && memcmp(key, prefix.data(), prefix.size()) == 0) {
+                trackingQueue(conn, key, len);
+                break;
+            }
+        }
+    }
+}
+
+static void trackingClear() {
+    std::vector<HNode *> nodes;
+    hmForEach(&gData.tracking, [](HNode *node, void *arg) {
+        ((std::vector<HNode *> *)arg)->push_back(node);
+        return true;
+    }, &nodes);
+    hmClear(&gData.tracking);
+    for (HNode *node : nodes) {
+        delete container_of(node, TrackedKey, node);
+    }
+}
+
+// every key changed at once, e.g. a replica loading a new snapshot
+static void trackingInvalidateAll() {
+    for (Conn *conn : gData.fd2conn) {
+        if (conn && conn->tracking) {
+            if (conn->invalidated.empty() && !conn->invalidateAll && !conn->deferred) {
+                connQueuePending(conn);
+            }
+            conn->invalidateAll = true;
+            conn->invalidated.clear();
+        }
+    }
+    trackingClear();
+}
+
+static void trackingOff(Conn *conn) {
+    if (!conn->tracking) {
+        return;
+    }
+    if (conn->trackingBcast) {
+        std::vector<Conn *> &b = gData.bcastClients;
+        b.erase(std::find(b.begin(), b.end(), conn));
+    }
+    conn->tracking = false;
+    conn->trackingBcast = false;
+    conn->trackingNoloop = false;
+    conn->trackingPrefixes.clear();
+    conn->invalidated.clear();
+    conn->invalidateAll = false;
+    if (--gData.trackingClients == 0) {
+        trackingClear();
+    }
+}
+
+const size_t k_invalidate_batch = 1024;
+
+// The queued invalidations as push messages: ["invalidate", [key ...]],
+// or ["invalidate", nil] for all keys.
+static void trackingFlush(Conn *conn) {
+    if (conn->task.paused() || (conn->invalidated.empty() && !conn->invalidateAll)) {
+        return;
+    }
+    Buffer &out = conn->outgoing;
+    size_t n = conn->invalidateAll ? 1 : conn->invalidated.size();
+    for (size_t i = 0; i < n; i += k_invalidate_batch) {
+        size_t headerPos = 0;
+        responseBegin(out, &headerPos);
+        bufAppendU8(out, TAG_PUSH);
+        bufAppendU32(out, 2);
+        outStr(out, "invalidate", 10);
+        if (conn->invalidateAll) {
+            outNil(out);
+        } else {
+            size_t end = std::min(n, i + k_invalidate_batch);
+            outArr(out, end - i);
+            for (size_t j = i; j < end; j++) {
+                outStr(out, conn->invalidated[j].data(), conn->invalidated[j].size());
+            }
+        }
+        responseEnd(out, headerPos);
+    }
+    gStats.trackingInvalidations += n;
+    conn->invalidated.clear();
+    conn->invalidateAll = false;
+    conn->wantWrite = true;
+    connCheckOutput(conn);
+}
+
+// keyspace lookup on behalf of a command, counts as an access
+static Entry *dbLookup(LookupKey *key) {
+    HNode *node = hmLookup(&gData.db, &key->node, &entryEq);
+    if (!node) {
+        return NULL;
+    }
+    Entry *ent = container_of(node, Entry, node);
+    entryTouch(ent);
+    return ent;
+}
+
+// same for read commands, which feed the hit/miss counters
+static Entry *dbLookupRead(LookupKey *key) {
+    Entry *ent = dbLookup(key);
+    if (ent) {
+        gStats.keyspaceHits++;
+    } else {
+        gStats.keyspaceMisses++;
+    }
+    return ent;
+}
+
+static size_t outBeginArr(Buffer &out) {
+    out.push_back(TAG_ARR);
+    bufAppendU32(out, 0);
+    return out.size() - 4;
+}
+
+static void outEndArr(Buffer &out, size_t ctx, uint32_t n) {
+    assert(out[ctx - 1] == TAG_ARR);
+    memcpy(&out[ctx], &n, 4);
+}
+
+// work done between looks at the clock in SlicedArr
+const uint32_t k_slice_units = 256;
+
+// The array reply of a command run as a CoTask. The handler appends
+// elements to `out`, counts them with add(), and between steps of its
+// walk does `co_await arr.yield(units)`, which pauses the command
+//   - after client-request-budget-us of work, until the next event-loop
+//     iteration, so the cheap requests of other clients get to run;
+//   - while k_stream_ahead bytes are unsent, until the client reads.
+// Pausing closes the elements so far into a TAG_CHUNK message and the
+// resume opens a new one, so conn->outgoing holds only whole messages
+// while paused; the final message is a TAG_ARR. co_await returns true
+// after a pause, when whatever the handler walks may have changed. A
+// reply into any other buffer, or inside EXEC, is built whole.
+struct SlicedArr {
+    Conn *conn;
+    Buffer &out;
+    bool chunked;
+    // the array header of the current message, and where it started
+    size_t ctx = 0;
+    size_t start = 0;
+    uint32_t n = 0;
+    uint32_t units = 0;
+    uint64_t sliceStart = 0;
+    bool paused = false;
+
+    SlicedArr(Conn *conn, Buffer &out)
+        : conn(conn), out(out), chunked(conn && &out == &conn->outgoing && !conn->inExec)
+    {
+        sliceStart = getMonotonicNs();
+        open(false);
+    }
+
+    void add(uint32_t k) {
+        n += k;
+    }
+
+    // the first message was begun by tryOneRequest()
+    void open(bool message) {
+        if (message) {
+            responseBegin(out, &conn->replyHeader);
+        }
+        ctx = outBeginArr(out);
+        start = out.size();
+        n = 0;
+    }
+
+    // the elements so far as a TAG_CHUNK message, none if there are none
+    void close() {
+        if (n == 0) {
+            out.resize(conn->replyHeader);
+            return;
+        }
+        outEndArr(out, ctx, n);
+        out[ctx - 1] = TAG_CHUNK;
+        responseEnd(out, conn->replyHeader);
+    }
+
+    // the last elements, the caller ends the message
+    void end() {
+        outEndArr(out, ctx, n);
+    }
+
+    bool shouldPause(uint32_t work) {
+        if (!chunked) {
+            return false;
+        }
+        if (out.size() - start >= k_stream_chunk) {
+            close();
+            open(true);
+        }
+        if (connOutBytes(conn) >= k_stream_ahead) {
+            conn->taskWaitsDrain = true;
+            return true;
+        }
+        units += work;
+        if (units < k_slice_units) {
+            return false;
+        }
+        units = 0;
+        return gConfig.requestBudgetUs > 0
+            && getMonotonicNs() - sliceStart >= (uint64_t)gConfig.requestBudgetUs * 1000;
+    }
+
+    struct Yield {
+        SlicedArr *arr;
+        uint32_t work;
+        bool await_ready() {
+            return !arr->shouldPause(work);
+        }
+        void await_suspend(std::coroutine_handle<>) {
+            arr->close();
+            arr->paused = true;
+            gStats.commandYields++;
+            if (!arr->conn->taskWaitsDrain) {
+                connDefer(arr->conn);
+            }
+        }
+        bool await_resume() {
+            if (!arr->paused) {
+                return false;
+            }
+            arr->open(true);
+            arr->paused = false;
+            arr->sliceStart = getMonotonicNs();
+            return true;
+        }
+    };
+
+    Yield yield(uint32_t work) {
+        return Yield{this, work};
+    }
+};
+
+static const ZSet k_empty_zset;
+
+static ZSet *expectZset(const std::string &name) {
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    // hashtable lookup
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return (ZSet *)&k_empty_zset;
+    }
+    return ent->type == T_ZSET ? ent->zset : NULL;
+}
+
+// ZQUERY key score name offset limit
+static CoTask doZQuery(Conn *conn, std::vector<std::string> cmd, Buffer &out) {
+    // parse args
+    double score = 0;
+    if (!str2dbl(cmd[2], score)) {
+        outErr(out, ERR_BAD_ARG, "expect score to be number");
+        co_return;
+    }
+    const std::string &name = cmd[3];
+    int64_t offset = 0, limit = 0;
+    if (!str2int(cmd[4], offset)) {
+        outErr(out, ERR_BAD_ARG, "expect offset to be number");
+        co_return;
+    }
+    if (!str2int(cmd[5], limit)) {
+        outErr(out, ERR_BAD_ARG, "expect limit to be number");
+        co_return;
+    }
+
+    ZSet *zset = expectZset(cmd[1]);
+    if (!zset) {
+        outErr(out, ERR_BAD_ARG, "expected zset");
+        co_return;
+    }
+    
+    if (limit <= 0) {
+        outArr(out, 0);
+        co_return;
+    }
+    // search for key
+    ZNode *znode = zsetSeekge(zset, score, name.data(), name.size());
+    znode = znodeOffset(znode, offset);
+    // iterate and output
+    SlicedArr arr(conn, out);
+    int64_t n = 0;
+    std::string last;
+    while (znode && n < limit) {
+        outStr(out, znode->name, znode->len);
+        outDbl(out, znode->score);
+        arr.add(2);
+        n += 2;
+        score = znode->score;
+        last.assign(znode->name, znode->len);
+        znode = znodeOffset(znode, +1);
+        if (co_await arr.yield(1)) {
+            // go on after the last member sent, if the zset is still there
+            LookupKey key;
+            lookupKeyInit(&key, cmd[1]);
+            HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+            Entry *ent = node ? container_of(node, Entry, node) : NULL;
+            znode = NULL;
+            if (ent && ent->type == T_ZSET) {
+                znode = zsetSeekge(ent->zset, score, last.data(), last.size());
+            }
+            if (znode && znode->score == score && znode->len == last.size()
+                && memcmp(znode->name, last.data(), last.size()) == 0)
+            {
+                znode = znodeOffset(znode, +1);
+            }
+        }
+    }
+    arr.end();
+}
+
+static void doZAdd(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
     double score = 0;
     if (!str2dbl(cmd[2], score)) {
         return outErr(out, ERR_BAD_ARG, "expect score to be float");
     }
     // hashtable lookup
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    Entry *ent = NULL;
-    if (node) {
-        ent = container_of(node, Entry, node);
+    Entry *ent = dbLookup(&key);
+    if (ent) {
         if (ent->type != T_ZSET) {
             return outErr(out, ERR_BAD_ARG, "expected zset");
         }
     } else {
-        ent = entryNew(T_ZSET);
-        ent->key.swap(key.key);
+        ent = entryNew(T_ZSET, cmd[1], 0);
         ent->node.hcode = key.node.hcode;
-        hmInsert(&gData.db, &ent->node);
+        dbAdd(ent);
     }
 
     // add or update the tuple
     const std::string &name = cmd[3];
-    bool added = zsetInsert(&ent->zset, name.data(), name.size(), score);
+    size_t before = zsetMemUsage(ent->zset);
+    bool added = zsetInsert(ent->zset, name.data(), name.size(), score);
+    dbMemAdjust(before, zsetMemUsage(ent->zset));
+    notifyKeyspaceEvent(NOTIFY_ZSET, "zadd", cmd[1].data(), cmd[1].size());
     return outInt(out, (int64_t)added);
 }
 
-static void doZRem(std::vector<std::string> &cmd, Buffer &out) {
+static void doZRem(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
     ZSet *zset = expectZset(cmd[1]);
     if (!zset) {
         return outErr(out, ERR_BAD_ARG, "expected zset");
@@ -465,12 +1819,14 @@ static void doZRem(std::vector<std::string> &cmd, Buffer &out) {
     const std::string &name = cmd[2];
     ZNode *znode = zsetLookup(zset, name.data(), name.size());
     if (znode) {
+        size_t before = zsetMemUsage(zset);
         zsetDelete(zset, znode);
+        dbMemAdjust(before, zsetMemUsage(zset));
     }
     return outInt(out, znode ? 1 : 0);
 }
 
-static void doZScore(std::vector<std::string> &cmd, Buffer &out) {
+static void doZScore(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
     ZSet *zset = expectZset(cmd[1]);
     if (!zset) {
         return outErr(out, ERR_BAD_ARG, "expected zset");
@@ -480,170 +1836,3109 @@ static void doZScore(std::vector<std::string> &cmd, Buffer &out) {
     return znode ? outDbl(out, znode->score) : outNil(out);
 }
 
-static void doGet(std::vector<std::string> &cmd, Buffer &out) {
+static void doGet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
     LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    if (!node) {
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
         return outErr(out, ERR_UNKNOWN, "key not found");
     }
-    Entry *ent = container_of(node, Entry, node);
     if (ent->type != T_STR) {
         return outErr(out, ERR_BAD_ARG, "expected string");
     
     }
-    return outStr(out, ent->str.data(), ent->str.size());
+    return outEntryStr(conn, out, ent);
 }
 
-static void doSet(std::vector<std::string> &cmd, Buffer &out) {
+static void doSet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
     LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
+    lookupKeyInit(&key, cmd[1]);
     // hashtable lookup
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    if (node) {
-        Entry *ent = container_of(node, Entry, node);
+    Entry *ent = dbLookup(&key);
+    if (ent) {
+        if (ent->type != T_STR) {
+            return outErr(out, ERR_BAD_ARG, "expected string");
+        }
+        size_t before = entryMemUsage(ent);
+        entrySetStr(ent, cmd[2].data(), cmd[2].size());
+        dbMemAdjust(before, entryMemUsage(ent));
+    } else {
+        Entry *entry = entryNewStr(cmd[1], cmd[2]);
+        entry->node.hcode = key.node.hcode;
+        dbAdd(entry);
+    }
+    notifyKeyspaceEvent(NOTIFY_STRING, "set", cmd[1].data(), cmd[1].size());
+    return outNil(out);
+}
+
+// Counters work in place on ENC_INT. Since that encoding is used for
+// every canonical integer string, any other encoding is not a number.
+static void incrBy(std::vector<std::string> &cmd, Buffer &out, int64_t by) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (!ent) {
+        ent = entryNew(T_STR, cmd[1], 0);
+        ent->encoding = ENC_INT;
+        ent->ival = by;
+        ent->node.hcode = key.node.hcode;
+        dbAdd(ent);
+        return outInt(out, by);
+    }
+    if (ent->type != T_STR) {
+        return outErr(out, ERR_BAD_ARG, "expected string");
+    }
+    if (ent->encoding != ENC_INT) {
+        return outErr(out, ERR_BAD_ARG, "value is not an integer");
+    }
+    int64_t val = 0;
+    if (__builtin_add_overflow(ent->ival, by, &val)) {
+        return outErr(out, ERR_BAD_ARG, "increment would overflow");
+    }
+    ent->ival = val;
+    return outInt(out, val);
+}
+
+// INCR key
+static void doIncr(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return incrBy(cmd, out, 1);
+}
+
+// DECR key
+static void doDecr(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return incrBy(cmd, out, -1);
+}
+
+// INCRBY key increment
+static void doIncrBy(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t by = 0;
+    if (!str2int(cmd[2], by)) {
+        return outErr(out, ERR_BAD_ARG, "expect increment to be an integer");
+    }
+    return incrBy(cmd, out, by);
+}
+
+// DECRBY key decrement
+static void doDecrBy(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t by = 0;
+    if (!str2int(cmd[2], by) || by == INT64_MIN) {
+        return outErr(out, ERR_BAD_ARG, "expect decrement to be an integer");
+    }
+    return incrBy(cmd, out, -by);
+}
+
+// shortest of %.15g / %.17g that reads back as the same double
+static size_t dbl2str(double v, char *buf, size_t size) {
+    int n = snprintf(buf, size, "%.15g", v);
+    if (strtod(buf, NULL) != v) {
+        n = snprintf(buf, size, "%.17g", v);
+    }
+    return (size_t)n;
+}
+
+// INCRBYFLOAT key increment
+static void doIncrByFloat(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    double by = 0;
+    if (!str2dbl(cmd[2], by)) {
+        return outErr(out, ERR_BAD_ARG, "expect increment to be a number");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    double val = 0;
+    if (ent) {
         if (ent->type != T_STR) {
             return outErr(out, ERR_BAD_ARG, "expected string");
         }
-        ent->str.swap(cmd[2]);
-    } else {
-        Entry *entry = entryNew(T_STR);
-        entry->key.swap(key.key);
-        entry->str.swap(cmd[2]);
-        entry->node.hcode = key.node.hcode;
-        hmInsert(&gData.db, &entry->node);
+        if (ent->encoding == ENC_INT) {
+            val = (double)ent->ival;
+        } else {
+            char buf[k_int_str_max];
+            size_t len = 0;
+            const char *str = entryStr(ent, buf, &len);
+            if (len > 64 || !str2dbl(std::string(str, len), val)) {
+                return outErr(out, ERR_BAD_ARG, "value is not a number");
+            }
+        }
+    }
+    val += by;
+    if (isinf(val) || isnan(val)) {
+        return outErr(out, ERR_BAD_ARG, "increment would produce NaN or Infinity");
+    }
+    char buf[32];
+    size_t len = dbl2str(val, buf, sizeof(buf));
+    if (ent) {
+        size_t before = entryMemUsage(ent);
+        entrySetStr(ent, buf, len);
+        dbMemAdjust(before, entryMemUsage(ent));
+    } else {
+        ent = entryNew(T_STR, cmd[1], len);
+        entrySetStr(ent, buf, len);
+        ent->node.hcode = key.node.hcode;
+        dbAdd(ent);
+    }
+    return outDbl(out, val);
+}
+
+// Look up the hash at `key`. Returns NULL on a type mismatch; a missing
+// key is created if `create`, else reported through `*missing`.
+static HashObj *expectHash(LookupKey *key, const std::string &name, bool create, bool *missing) {
+    Entry *ent = create ? dbLookup(key) : dbLookupRead(key);
+    *missing = false;
+    if (!ent) {
+        if (!create) {
+            *missing = true;
+            return NULL;
+        }
+        ent = entryNew(T_HASH, name, 0);
+        ent->node.hcode = key->node.hcode;
+        dbAdd(ent);
+    }
+    return ent->type == T_HASH ? &ent->hash : NULL;
+}
+
+// HSET key field value [field value ...], returns the number of new fields
+static void doHSet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd.size() % 2 != 0) {
+        return outErr(out, ERR_BAD_ARG, "expect field value pairs");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], true, &missing);
+    if (!hash) {
+        return outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    size_t before = hobjMemUsage(hash);
+    int64_t added = 0;
+    for (size_t i = 2; i + 1 < cmd.size(); i += 2) {
+        const std::string &field = cmd[i], &val = cmd[i + 1];
+        added += hobjSet(hash, field.data(), field.size(), val.data(), val.size());
+    }
+    dbMemAdjust(before, hobjMemUsage(hash));
+    return outInt(out, added);
+}
+
+// HGET key field
+static void doHGet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], false, &missing);
+    if (!hash) {
+        return missing ? outNil(out) : outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    const char *val = NULL;
+    size_t vlen = 0;
+    if (!hobjGet(hash, cmd[2].data(), cmd[2].size(), &val, &vlen)) {
+        return outNil(out);
+    }
+    return outStr(out, val, vlen);
+}
+
+// HMGET key field [field ...]
+static void doHMGet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], false, &missing);
+    if (!hash && !missing) {
+        return outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    outArr(out, cmd.size() - 2);
+    for (size_t i = 2; i < cmd.size(); i++) {
+        const char *val = NULL;
+        size_t vlen = 0;
+        if (hash && hobjGet(hash, cmd[i].data(), cmd[i].size(), &val, &vlen)) {
+            outStr(out, val, vlen);
+        } else {
+            outNil(out);
+        }
+    }
+}
+
+// HDEL key field [field ...], the key goes away with its last field
+static void doHDel(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (!ent) {
+        return outInt(out, 0);
+    }
+    if (ent->type != T_HASH) {
+        return outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    size_t before = hobjMemUsage(&ent->hash);
+    int64_t deleted = 0;
+    for (size_t i = 2; i < cmd.size(); i++) {
+        deleted += hobjDel(&ent->hash, cmd[i].data(), cmd[i].size());
+    }
+    dbMemAdjust(before, hobjMemUsage(&ent->hash));
+    if (ent->hash.len == 0) {
+        dbDelete(ent);
+    }
+    return outInt(out, deleted);
+}
+
+// HLEN key
+static void doHLen(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], false, &missing);
+    if (!hash) {
+        return missing ? outInt(out, 0) : outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    return outInt(out, hash->len);
+}
+
+static bool cbHGetAll(const char *field, size_t flen, const char *val, size_t vlen, void *arg) {
+    Buffer &out = *(Buffer *)arg;
+    outStr(out, field, flen);
+    outStr(out, val, vlen);
+    return true;
+}
+
+// HGETALL key, a flat array of fields and values
+static void doHGetAll(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], false, &missing);
+    if (!hash) {
+        return missing ? outArr(out, 0) : outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    outArr(out, (uint32_t)hash->len * 2);
+    hobjForEach(hash, &cbHGetAll, &out);
+}
+
+// HINCRBY key field increment
+static void doHIncrBy(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t by = 0;
+    if (!str2int(cmd[3], by)) {
+        return outErr(out, ERR_BAD_ARG, "expect int");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    bool missing = false;
+    HashObj *hash = expectHash(&key, cmd[1], true, &missing);
+    if (!hash) {
+        return outErr(out, ERR_BAD_ARG, "expected hash");
+    }
+    const std::string &field = cmd[2];
+    const char *cur = NULL;
+    size_t curLen = 0;
+    int64_t val = 0;
+    if (hobjGet(hash, field.data(), field.size(), &cur, &curLen)
+        && !str2intExact(cur, curLen, val)) {
+        return outErr(out, ERR_BAD_ARG, "hash value is not an integer");
+    }
+    if (__builtin_add_overflow(val, by, &val)) {
+        return outErr(out, ERR_BAD_ARG, "increment would overflow");
+    }
+    char buf[k_int_str_max];
+    size_t len = int2str(val, buf);
+    size_t before = hobjMemUsage(hash);
+    hobjSet(hash, field.data(), field.size(), buf, len);
+    dbMemAdjust(before, hobjMemUsage(hash));
+    return outInt(out, val);
+}
+
+// Clients parked by BLPOP/BRPOP. Every key with waiters has a BlockedKey
+// listing them in arrival order; a push hands its elements to the oldest
+// waiters first. Waking a client is O(1) in the number of waiters, plus
+// the few keys the client itself was waiting on.
+struct BlockedKey {
+    HNode node;
+    // BlockWait::node
+    DList waiters;
+    std::string key;
+};
+
+static bool blockedKeyEq(HNode *node, HNode *key) {
+    BlockedKey *bk = container_of(node, BlockedKey, node);
+    LookupKey *keydata = container_of(key, LookupKey, node);
+    return bk->key.size() == keydata->len && memcmp(bk->key.data(), keydata->key, keydata->len) == 0;
+}
+
+// park on keys cmd[1 .. n-2] until a push or `timeoutMs`, 0 is forever
+static void connBlock(Conn *conn, std::vector<std::string> &cmd, bool front, uint64_t timeoutMs) {
+    conn->blocked = true;
+    conn->blockFront = front;
+    // linked below, the vector must not move afterwards
+    conn->blockWaits.resize(cmd.size() - 2);
+    for (size_t i = 0; i < conn->blockWaits.size(); i++) {
+        LookupKey key;
+        lookupKeyInit(&key, cmd[1 + i]);
+        HNode *node = hmLookup(&gData.blockingKeys, &key.node, &blockedKeyEq);
+        BlockedKey *bk = NULL;
+        if (node) {
+            bk = container_of(node, BlockedKey, node);
+        } else {
+            bk = new BlockedKey();
+            bk->node.hcode = key.node.hcode;
+            bk->key = cmd[1 + i];
+            dlistInit(&bk->waiters);
+            hmInsert(&gData.blockingKeys, &bk->node);
+        }
+        BlockWait &wait = conn->blockWaits[i];
+        wait.conn = conn;
+        wait.bk = bk;
+        dlistInsertBefore(&bk->waiters, &wait.node);
+    }
+    if (timeoutMs > 0) {
+        HeapItem item = {getMonotonicMs() + timeoutMs, &conn->blockHeapIdx};
+        heapUpsert(gData.blockHeap, conn->blockHeapIdx, item);
+    }
+    // a parked client is waiting on us, not idle
+    dlistDetach(&conn->idleNode);
+    dlistInit(&conn->idleNode);
+    gData.blockedClients++;
+}
+
+static void connUnblock(Conn *conn) {
+    for (BlockWait &wait : conn->blockWaits) {
+        dlistDetach(&wait.node);
+        if (dlistEmpty(&wait.bk->waiters)) {
+            hmDelete(&gData.blockingKeys, &wait.bk->node, &entrySame);
+            delete wait.bk;
+        }
+    }
+    conn->blockWaits.clear();
+    if (conn->blockHeapIdx != (size_t)-1) {
+        heapDelete(gData.blockHeap, conn->blockHeapIdx);
+        conn->blockHeapIdx = (size_t)-1;
+    }
+    conn->blocked = false;
+    gData.blockedClients--;
+}
+
+// Send the deferred reply of an unblocked client; its pipelined requests
+// run from the event loop, see processPending().
+static void connWake(Conn *conn, const char *key, size_t klen, const std::string *val) {
+    size_t headerPos = 0;
+    responseBegin(conn->outgoing, &headerPos);
+    if (val) {
+        outArr(conn->outgoing, 2);
+        outStr(conn->outgoing, key, klen);
+        outStr(conn->outgoing, val->data(), val->size());
+    } else {
+        outNil(conn->outgoing);
+    }
+    responseEnd(conn->outgoing, headerPos);
+    conn->lastActiveMs = getMonotonicMs();
+    dlistInsertBefore(&gData.idleList, &conn->idleNode);
+    connQueuePending(conn);
+}
+
+// hand the elements of a list that was just pushed to to its waiters
+static void serveBlocked(Entry *ent) {
+    if (hmSize(&gData.blockingKeys) == 0) {
+        return;
+    }
+    LookupKey key;
+    key.node.hcode = ent->node.hcode;
+    key.key = ent->key;
+    key.len = ent->klen;
+    size_t before = qlMemUsage(ent->list);
+    while (ent->list->len > 0) {
+        // looked up each time, the BlockedKey goes with its last waiter
+        HNode *node = hmLookup(&gData.blockingKeys, &key.node, &blockedKeyEq);
+        if (!node) {
+            break;
+        }
+        BlockedKey *bk = container_of(node, BlockedKey, node);
+        Conn *conn = container_of(bk->waiters.next, BlockWait, node)->conn;
+        std::string val;
+        qlPop(ent->list, conn->blockFront, val);
+        replAlso({conn->blockFront ? "lpop" : "rpop", std::string(ent->key, ent->klen)});
+        connUnblock(conn);
+        connWake(conn, ent->key, ent->klen, &val);
+    }
+    dbMemAdjust(before, qlMemUsage(ent->list));
+    if (ent->list->len == 0) {
+        dbDelete(ent);
+    }
+}
+
+// LPUSH/RPUSH key value [value ...], returns the new length
+static void listPush(std::vector<std::string> &cmd, Buffer &out, bool front) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (!ent) {
+        ent = entryNew(T_LIST, cmd[1], 0);
+        ent->node.hcode = key.node.hcode;
+        dbAdd(ent);
+    } else if (ent->type != T_LIST) {
+        return outErr(out, ERR_BAD_ARG, "expected list");
+    }
+    size_t before = qlMemUsage(ent->list);
+    for (size_t i = 2; i < cmd.size(); i++) {
+        qlPush(ent->list, front, cmd[i].data(), cmd[i].size());
+    }
+    dbMemAdjust(before, qlMemUsage(ent->list));
+    // the reply counts elements that go straight to blocked clients
+    outInt(out, (int64_t)ent->list->len);
+    serveBlocked(ent);
+}
+
+static void doLPush(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listPush(cmd, out, true);
+}
+
+static void doRPush(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listPush(cmd, out, false);
+}
+
+// LPOP/RPOP key, the key goes away with its last element
+static void listPop(std::vector<std::string> &cmd, Buffer &out, bool front) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return outNil(out);
+    }
+    if (ent->type != T_LIST) {
+        return outErr(out, ERR_BAD_ARG, "expected list");
+    }
+    std::string val;
+    size_t before = qlMemUsage(ent->list);
+    qlPop(ent->list, front, val);
+    dbMemAdjust(before, qlMemUsage(ent->list));
+    if (ent->list->len == 0) {
+        dbDelete(ent);
+    }
+    return outStr(out, val.data(), val.size());
+}
+
+static void doLPop(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listPop(cmd, out, true);
+}
+
+static void doRPop(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listPop(cmd, out, false);
+}
+
+// about 30 years, far from overflowing the deadline in ms
+const double k_max_block_timeout_s = 1e9;
+
+// BLPOP/BRPOP key [key ...] timeout, the timeout is in seconds
+static void listBlockingPop(Conn *conn, std::vector<std::string> &cmd, Buffer &out, bool front) {
+    double timeout = 0;
+    if (!str2dbl(cmd.back(), timeout) || timeout < 0) {
+        return outErr(out, ERR_BAD_ARG, "expect timeout in seconds");
+    }
+    if (timeout > k_max_block_timeout_s) {
+        return outErr(out, ERR_BAD_ARG, "timeout is out of range");
+    }
+    // replicas get the pop that happened, now or in serveBlocked()
+    replInstead();
+    // the first non-empty list is served right away
+    for (size_t i = 1; i + 1 < cmd.size(); i++) {
+        LookupKey key;
+        lookupKeyInit(&key, cmd[i]);
+        Entry *ent = dbLookupRead(&key);
+        if (!ent) {
+            continue;
+        }
+        if (ent->type != T_LIST) {
+            return outErr(out, ERR_BAD_ARG, "expected list");
+        }
+        std::string val;
+        size_t before = qlMemUsage(ent->list);
+        qlPop(ent->list, front, val);
+        dbMemAdjust(before, qlMemUsage(ent->list));
+        if (ent->list->len == 0) {
+            dbDelete(ent);
+        }
+        replAlso({front ? "lpop" : "rpop", cmd[i]});
+        outArr(out, 2);
+        outStr(out, cmd[i].data(), cmd[i].size());
+        return outStr(out, val.data(), val.size());
+    }
+    // inside EXEC there is no waiting, as if timed out
+    if (conn->inExec) {
+        return outNil(out);
+    }
+    // no reply now, see tryOneRequest()
+    connBlock(conn, cmd, front, (uint64_t)ceil(timeout * 1000));
+}
+
+static void doBLPop(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listBlockingPop(conn, cmd, out, true);
+}
+
+static void doBRPop(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    return listBlockingPop(conn, cmd, out, false);
+}
+
+// NULL for a type mismatch, an empty list for a missing key
+static const QuickList k_empty_list;
+
+static QuickList *expectList(const std::string &name) {
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return (QuickList *)&k_empty_list;
+    }
+    return ent->type == T_LIST ? ent->list : NULL;
+}
+
+// LLEN key
+static void doLLen(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    QuickList *list = expectList(cmd[1]);
+    if (!list) {
+        return outErr(out, ERR_BAD_ARG, "expected list");
+    }
+    return outInt(out, (int64_t)list->len);
+}
+
+// LINDEX key index
+static void doLIndex(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t idx = 0;
+    if (!str2int(cmd[2], idx)) {
+        return outErr(out, ERR_BAD_ARG, "expect int");
+    }
+    QuickList *list = expectList(cmd[1]);
+    if (!list) {
+        return outErr(out, ERR_BAD_ARG, "expected list");
+    }
+    QLIter it;
+    const char *val = NULL;
+    size_t len = 0;
+    if (!qlIndex(list, idx, &it) || !qlNext(&it, &val, &len)) {
+        return outNil(out);
+    }
+    return outStr(out, val, len);
+}
+
+// LRANGE key start stop, inclusive, negative indices count from the end
+static void doLRange(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t start = 0, stop = 0;
+    if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+        return outErr(out, ERR_BAD_ARG, "expect int");
+    }
+    QuickList *list = expectList(cmd[1]);
+    if (!list) {
+        return outErr(out, ERR_BAD_ARG, "expected list");
+    }
+    int64_t len = (int64_t)list->len;
+    if (start < 0) {
+        start = std::max<int64_t>(start + len, 0);
+    }
+    if (stop < 0) {
+        stop += len;
+    }
+    stop = std::min(stop, len - 1);
+    if (start > stop) {
+        return outArr(out, 0);
+    }
+    outArr(out, (size_t)(stop - start + 1));
+    QLIter it;
+    qlIndex(list, start, &it);
+    for (int64_t i = start; i <= stop; i++) {
+        const char *val = NULL;
+        size_t vlen = 0;
+        qlNext(&it, &val, &vlen);
+        outStr(out, val, vlen);
+    }
+}
+
+// SADD key member [member ...], returns the number of new members
+static void doSAdd(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (!ent) {
+        ent = entryNew(T_SET, cmd[1], 0);
+        ent->node.hcode = key.node.hcode;
+        dbAdd(ent);
+    } else if (ent->type != T_SET) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    size_t before = sobjMemUsage(&ent->set);
+    int64_t added = 0;
+    for (size_t i = 2; i < cmd.size(); i++) {
+        added += sobjAdd(&ent->set, cmd[i].data(), cmd[i].size());
+    }
+    dbMemAdjust(before, sobjMemUsage(&ent->set));
+    return outInt(out, added);
+}
+
+// SREM key member [member ...], the key goes away with its last member
+static void doSRem(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (!ent) {
+        return outInt(out, 0);
+    }
+    if (ent->type != T_SET) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    size_t before = sobjMemUsage(&ent->set);
+    int64_t removed = 0;
+    for (size_t i = 2; i < cmd.size(); i++) {
+        removed += sobjRemove(&ent->set, cmd[i].data(), cmd[i].size());
+    }
+    dbMemAdjust(before, sobjMemUsage(&ent->set));
+    if (sobjLen(&ent->set) == 0) {
+        dbDelete(ent);
+    }
+    return outInt(out, removed);
+}
+
+static const SetObj k_empty_set = {};
+
+// NULL for a type mismatch, an empty set for a missing key
+static SetObj *expectSet(const std::string &name) {
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return (SetObj *)&k_empty_set;
+    }
+    return ent->type == T_SET ? &ent->set : NULL;
+}
+
+// SISMEMBER key member
+static void doSIsMember(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    SetObj *set = expectSet(cmd[1]);
+    if (!set) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    return outInt(out, sobjContains(set, cmd[2].data(), cmd[2].size()));
+}
+
+// SCARD key
+static void doSCard(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    SetObj *set = expectSet(cmd[1]);
+    if (!set) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    return outInt(out, (int64_t)sobjLen(set));
+}
+
+struct SetOutArg {
+    Buffer *out;
+    uint32_t n;
+};
+
+static bool cbSetOut(const char *name, size_t len, void *arg) {
+    SetOutArg *so = (SetOutArg *)arg;
+    outStr(*so->out, name, len);
+    so->n++;
+    return true;
+}
+
+// the sets at cmd[1..], false on a type mismatch
+static bool expectSets(std::vector<std::string> &cmd, std::vector<SetObj *> &sets) {
+    for (size_t i = 1; i < cmd.size(); i++) {
+        SetObj *set = expectSet(cmd[i]);
+        if (!set) {
+            return false;
+        }
+        sets.push_back(set);
+    }
+    return true;
+}
+
+// SMEMBERS key
+static void doSMembers(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    SetObj *set = expectSet(cmd[1]);
+    if (!set) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    outArr(out, sobjLen(set));
+    SetOutArg so = {&out, 0};
+    sobjForEach(set, &cbSetOut, &so);
+}
+
+// SINTER key [key ...]
+static void doSInter(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    std::vector<SetObj *> sets;
+    if (!expectSets(cmd, sets)) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    size_t ctx = outBeginArr(out);
+    SetOutArg so = {&out, 0};
+    sobjInter(sets.data(), sets.size(), &cbSetOut, &so);
+    outEndArr(out, ctx, so.n);
+}
+
+static bool cbSetCollect(const char *name, size_t len, void *arg) {
+    sobjAdd((SetObj *)arg, name, len);
+    return true;
+}
+
+// SUNION key [key ...]
+static void doSUnion(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    std::vector<SetObj *> sets;
+    if (!expectSets(cmd, sets)) {
+        return outErr(out, ERR_BAD_ARG, "expected set");
+    }
+    SetObj all = {};
+    for (SetObj *set : sets) {
+        sobjForEach(set, &cbSetCollect, &all);
+    }
+    outArr(out, sobjLen(&all));
+    SetOutArg so = {&out, 0};
+    sobjForEach(&all, &cbSetOut, &so);
+    sobjClear(&all);
+}
+
+const size_t k_prefetch_batch = 16;
+
+// Hash `n` keys (every `stride`-th name) and prefetch their slots and
+// chain heads before any of them is probed.
+static void dbPrefetch(LookupKey *keys, const std::string *names, size_t n, size_t stride) {
+    for (size_t i = 0; i < n; i++) {
+        lookupKeyInit(&keys[i], names[i * stride]);
+        hmPrefetch(&gData.db, keys[i].node.hcode);
+    }
+    for (size_t i = 0; i < n; i++) {
+        hmPrefetchHead(&gData.db, keys[i].node.hcode);
+    }
+}
+
+// MGET key [key ...]
+static void doMGet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    size_t n = cmd.size() - 1;
+    outArr(out, n);
+    LookupKey keys[k_prefetch_batch];
+    for (size_t base = 0; base < n; base += k_prefetch_batch) {
+        size_t m = std::min(n - base, k_prefetch_batch);
+        dbPrefetch(keys, &cmd[1 + base], m, 1);
+        for (size_t i = 0; i < m; i++) {
+            Entry *ent = dbLookupRead(&keys[i]);
+            if (!ent || ent->type != T_STR) {
+                outNil(out);
+                continue;
+            }
+            outEntryStr(conn, out, ent);
+        }
+    }
+}
+
+// MSET key value [key value ...]
+static void doMSet(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd.size() % 2 == 0) {
+        return outErr(out, ERR_BAD_ARG, "expect key value pairs");
+    }
+    size_t n = (cmd.size() - 1) / 2;
+    // check the types first so that a failure leaves nothing half done
+    for (size_t i = 0; i < n; i++) {
+        LookupKey key;
+        lookupKeyInit(&key, cmd[1 + 2 * i]);
+        HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+        if (node && container_of(node, Entry, node)->type != T_STR) {
+            return outErr(out, ERR_BAD_ARG, "expected string");
+        }
+    }
+    LookupKey keys[k_prefetch_batch];
+    for (size_t base = 0; base < n; base += k_prefetch_batch) {
+        size_t m = std::min(n - base, k_prefetch_batch);
+        dbPrefetch(keys, &cmd[1 + 2 * base], m, 2);
+        for (size_t i = 0; i < m; i++) {
+            const std::string &val = cmd[2 + 2 * (base + i)];
+            // a repeated key was inserted by an earlier pair, so probe one by one
+            Entry *ent = dbLookup(&keys[i]);
+            if (ent) {
+                size_t before = entryMemUsage(ent);
+                entrySetStr(ent, val.data(), val.size());
+                dbMemAdjust(before, entryMemUsage(ent));
+            } else {
+                ent = entryNewStr(cmd[1 + 2 * (base + i)], val);
+                ent->node.hcode = keys[i].node.hcode;
+                dbAdd(ent);
+            }
+        }
+    }
+    return outNil(out);
+}
+
+// DEL key [key ...], returns the number of keys removed
+static void doDel(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    size_t n = cmd.size() - 1;
+    int64_t deleted = 0;
+    LookupKey keys[k_prefetch_batch];
+    for (size_t base = 0; base < n; base += k_prefetch_batch) {
+        size_t m = std::min(n - base, k_prefetch_batch);
+        dbPrefetch(keys, &cmd[1 + base], m, 1);
+        for (size_t i = 0; i < m; i++) {
+            HNode *node = hmDelete(&gData.db, &keys[i].node, &entryEq);
+            if (node) {
+                dbUnlink(container_of(node, Entry, node));
+                deleted++;
+                const std::string &name = cmd[1 + base + i];
+                notifyKeyspaceEvent(NOTIFY_GENERIC, "del", name.data(), name.size());
+            }
+        }
+    }
+    return outInt(out, deleted);
+}
+
+struct KeysArg {
+    Buffer *out;
+    SlicedArr *arr;
+    // compiled once for the whole walk, NULL matches all
+    const GlobPattern *pattern;
+    uint32_t visited;
+};
+
+static void cbKeys(HNode *node, void *arg) {
+    KeysArg *ka = (KeysArg *)arg;
+    Entry *ent = container_of(node, Entry, node);
+    ka->visited++;
+    if (ka->pattern && !globMatchCompiled(ka->pattern, ent->key, ent->klen)) {
+        return;
+    }
+    outStr(*ka->out, ent->key, ent->klen);
+    ka->arr->add(1);
+}
+
+const uint32_t k_keys_index_batch = 256;
+
+struct KeysIndexArg {
+    KeysArg ka;
+    const std::string *prefix;
+    // where the next batch starts: after the last key visited
+    std::string last;
+    bool more;
+};
+
+static bool cbKeysIndex(const char *key, size_t len, void *, void *arg) {
+    KeysIndexArg *kia = (KeysIndexArg *)arg;
+    const std::string &prefix = *kia->prefix;
+    if (len < prefix.size() || memcmp(key, prefix.data(), prefix.size()) != 0) {
+        return false;  // past the prefix, the walk is done
+    }
+    KeysArg *ka = &kia->ka;
+    ka->visited++;
+    if (!ka->pattern || globMatchCompiled(ka->pattern, key, len)) {
+        outStr(*ka->out, key, len);
+        ka->arr->add(1);
+    }
+    if (ka->visited >= k_keys_index_batch) {
+        kia->last.assign(key, len);
+        kia->more = true;
+        return false;
+    }
+    return true;
+}
+
+// KEYS [pattern]
+// A walk of the whole keyspace, paused every so often. hmScan() takes
+// whole slots and its cursor survives rehashing, so keys that exist
+// throughout are sent exactly once.
+// With key-index the walk is over the radix tree instead: the keys come
+// in order, starting right at the literal prefix of the pattern. Each
+// batch looks its start up again, so writes in between do not matter;
+// turning the index off ends the walk.
+static CoTask doKeys(Conn *conn, std::vector<std::string> cmd, Buffer &out) {
+    if (cmd.size() > 2) {
+        outErr(out, ERR_BAD_ARG, "expect KEYS [pattern]");
+        co_return;
+    }
+    SlicedArr arr(conn, out);
+    GlobPattern glob;
+    if (cmd.size() == 2) {
+        globCompile(&glob, cmd[1].data(), cmd[1].size());
+    }
+    const GlobPattern *pattern = cmd.size() == 2 ? &glob : NULL;
+    if (gConfig.keyIndex) {
+        KeysIndexArg kia = {{&out, &arr, pattern, 0}, &glob.prefix, glob.prefix, false};
+        // the first key >= `last` on the first batch, > it afterwards
+        bool first = true;
+        do {
+            if (!first) {
+                kia.last.push_back('\0');
+            }
+            first = false;
+            kia.ka.visited = 0;
+            kia.more = false;
+            radixWalk(&gData.keyIndex, kia.last.data(), kia.last.size(), &cbKeysIndex, &kia);
+            co_await arr.yield(kia.ka.visited + 1);
+        } while (kia.more && gConfig.keyIndex);
+        arr.end();
+        co_return;
+    }
+    KeysArg ka = {&out, &arr, pattern, 0};
+    size_t cursor = 0;
+    do {
+        ka.visited = 0;
+        cursor = hmScan(&gData.db, cursor, &cbKeys, &ka);
+        co_await arr.yield(ka.visited + 1);
+    } while (cursor != 0);
+    arr.end();
+}
+
+// PEXPIRE key ttl_ms
+static void doExpire(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t ttlMs = 0;
+    if (!str2int(cmd[2], ttlMs)) {
+        return outErr(out, ERR_BAD_ARG, "expect ttl to be number");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookup(&key);
+    if (ent) {
+        entrySetTTL(ent, ttlMs);
+    }
+    return outInt(out, ent ? 1 : 0);
+}
+
+// PTTL key
+static void doTtl(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return outInt(out, -2);
+    }
+
+    if (ent->heapIdx == (size_t)-1) {
+        return outInt(out, -1);
+    }
+    uint64_t expireAt = gData.heap[ent->heapIdx].val;
+    uint64_t nowMs = getMonotonicMs();
+    return outInt(out, expireAt > nowMs ? (int64_t)(expireAt - nowMs) : 0);
+}
+
+static const char *entryEncodingName(Entry *ent) {
+    if (ent->type == T_ZSET) {
+        return "zset";
+    }
+    if (ent->type == T_HASH) {
+        return ent->hash.encoding == HASH_PACKED ? "packed" : "hashtable";
+    }
+    if (ent->type == T_LIST) {
+        return "quicklist";
+    }
+    if (ent->type == T_SET) {
+        return ent->set.encoding == SET_INTSET ? "intset" : "hashtable";
+    }
+    switch (ent->encoding) {
+    case ENC_INT: return "int";
+    case ENC_EMBSTR: return "embstr";
+    default: return "raw";
+    }
+}
+
+// OBJECT ENCODING key
+static void doObject(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd[1] != "encoding") {
+        return outErr(out, ERR_BAD_ARG, "expect OBJECT ENCODING key");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[2]);
+    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+    if (!node) {
+        return outNil(out);
+    }
+    const char *name = entryEncodingName(container_of(node, Entry, node));
+    return outStr(out, name, strlen(name));
+}
+
+// MEMORY USAGE key
+static void doMemory(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd[1] != "usage") {
+        return outErr(out, ERR_BAD_ARG, "expect MEMORY USAGE key");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[2]);
+    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+    if (!node) {
+        return outNil(out);
+    }
+    return outInt(out, (int64_t)entryMemUsage(container_of(node, Entry, node)));
+}
+
+// Pub/Sub. Every channel with subscribers is a PubsubTopic in
+// gData.channels, every pattern one in gData.patterns. PUBLISH serializes
+// a message frame once into a SharedBuf and queues a reference to it on
+// each receiver, so fan-out costs a pointer per subscriber, not a copy.
+struct PubsubTopic {
+    // gData.channels
+    HNode node;
+    // gData.patterns
+    DList link;
+    std::string name;
+    // patterns only, `name` compiled
+    GlobPattern glob;
+    // Subscription::node
+    DList subs;
+};
+
+struct Subscription {
+    DList node;
+    Conn *conn = NULL;
+    PubsubTopic *topic = NULL;
+};
+
+static bool topicEq(HNode *node, HNode *key) {
+    PubsubTopic *topic = container_of(node, PubsubTopic, node);
+    LookupKey *keydata = container_of(key, LookupKey, node);
+    return topic->name.size() == keydata->len
+        && memcmp(topic->name.data(), keydata->key, keydata->len) == 0;
+}
+
+static bool connSubscribed(Conn *conn) {
+    return !conn->channels.empty() || !conn->patterns.empty();
+}
+
+static PubsubTopic *topicFind(bool pattern, const std::string &name) {
+    if (pattern) {
+        for (DList *it = gData.patterns.next; it != &gData.patterns; it = it->next) {
+            PubsubTopic *topic = container_of(it, PubsubTopic, link);
+            if (topic->name == name) {
+                return topic;
+            }
+        }
+        return NULL;
+    }
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    HNode *node = hmLookup(&gData.channels, &key.node, &topicEq);
+    return node ? container_of(node, PubsubTopic, node) : NULL;
+}
+
+// return false if already subscribed
+static bool pubsubSubscribe(Conn *conn, bool pattern, const std::string &name) {
+    std::vector<Subscription *> &mine = pattern ? conn->patterns : conn->channels;
+    for (Subscription *sub : mine) {
+        if (sub->topic->name == name) {
+            return false;
+        }
+    }
+    PubsubTopic *topic = topicFind(pattern, name);
+    if (!topic) {
+        topic = new PubsubTopic();
+        topic->name = name;
+        dlistInit(&topic->subs);
+        dlistInit(&topic->link);
+        if (pattern) {
+            globCompile(&topic->glob, name.data(), name.size());
+            dlistInsertBefore(&gData.patterns, &topic->link);
+            gData.npatterns++;
+        } else {
+            topic->node.hcode = strHash((const uint8_t *)name.data(), name.size());
+            hmInsert(&gData.channels, &topic->node);
+        }
+    }
+    Subscription *sub = new Subscription();
+    sub->conn = conn;
+    sub->topic = topic;
+    dlistInsertBefore(&topic->subs, &sub->node);
+    mine.push_back(sub);
+    return true;
+}
+
+// drop the i-th subscription of the conn
+static void pubsubUnsubscribe(Conn *conn, bool pattern, size_t i) {
+    std::vector<Subscription *> &mine = pattern ? conn->patterns : conn->channels;
+    Subscription *sub = mine[i];
+    mine[i] = mine.back();
+    mine.pop_back();
+    PubsubTopic *topic = sub->topic;
+    dlistDetach(&sub->node);
+    delete sub;
+    if (!dlistEmpty(&topic->subs)) {
+        return;
+    }
+    if (pattern) {
+        dlistDetach(&topic->link);
+        gData.npatterns--;
+    } else {
+        hmDelete(&gData.channels, &topic->node, &entrySame);
+    }
+    delete topic;
+}
+
+static void pubsubUnsubscribeAll(Conn *conn) {
+    while (!conn->channels.empty()) {
+        pubsubUnsubscribe(conn, false, conn->channels.size() - 1);
+    }
+    while (!conn->patterns.empty()) {
+        pubsubUnsubscribe(conn, true, conn->patterns.size() - 1);
+    }
+}
+
+// one [kind, name, subscription count] entry of a (un)subscribe reply
+static void outSubscribeAck(Conn *conn, Buffer &out, const char *kind, const std::string *name) {
+    outArr(out, 3);
+    outStr(out, kind, strlen(kind));
+    if (name) {
+        outStr(out, name->data(), name->size());
+    } else {
+        outNil(out);
+    }
+    outInt(out, (int64_t)(conn->channels.size() + conn->patterns.size()));
+}
+
+// Subscribed clients sit on pushes, not requests: the idle reaper skips
+// them while they have a subscription.
+static void pubsubIdleUpdate(Conn *conn, bool wasSubscribed) {
+    if (!wasSubscribed && connSubscribed(conn)) {
+        dlistDetach(&conn->idleNode);
+        dlistInit(&conn->idleNode);
+    } else if (wasSubscribed && !connSubscribed(conn)) {
+        conn->lastActiveMs = getMonotonicMs();
+        dlistInsertBefore(&gData.idleList, &conn->idleNode);
+    }
+}
+
+// One reply for the whole command, an array with an entry per name; the
+// request/response protocol has no room for a reply per channel.
+static void doSubscribeGeneric(Conn *conn, std::vector<std::string> &cmd, Buffer &out, bool pattern) {
+    bool was = connSubscribed(conn);
+    outArr(out, cmd.size() - 1);
+    for (size_t i = 1; i < cmd.size(); i++) {
+        pubsubSubscribe(conn, pattern, cmd[i]);
+        outSubscribeAck(conn, out, pattern ? "psubscribe" : "subscribe", &cmd[i]);
+    }
+    pubsubIdleUpdate(conn, was);
+}
+
+// without names: everything the client is subscribed to
+static void doUnsubscribeGeneric(Conn *conn, std::vector<std::string> &cmd, Buffer &out, bool pattern) {
+    bool was = connSubscribed(conn);
+    const char *kind = pattern ? "punsubscribe" : "unsubscribe";
+    std::vector<Subscription *> &mine = pattern ? conn->patterns : conn->channels;
+    std::vector<std::string> names(cmd.begin() + 1, cmd.end());
+    if (names.empty()) {
+        for (Subscription *sub : mine) {
+            names.push_back(sub->topic->name);
+        }
+    }
+    if (names.empty()) {
+        outArr(out, 1);
+        outSubscribeAck(conn, out, kind, NULL);
+        return;
+    }
+    outArr(out, names.size());
+    for (const std::string &name : names) {
+        for (size_t i = 0; i < mine.size(); i++) {
+            if (mine[i]->topic->name == name) {
+                pubsubUnsubscribe(conn, pattern, i);
+                break;
+            }
+        }
+        outSubscribeAck(conn, out, kind, &name);
+    }
+    pubsubIdleUpdate(conn, was);
+}
+
+static void doSubscribe(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    doSubscribeGeneric(conn, cmd, out, false);
+}
+
+static void doUnsubscribe(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    doUnsubscribeGeneric(conn, cmd, out, false);
+}
+
+static void doPSubscribe(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    doSubscribeGeneric(conn, cmd, out, true);
+}
+
+static void doPUnsubscribe(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    doUnsubscribeGeneric(conn, cmd, out, true);
+}
+
+static uint32_t connClass(Conn *conn) {
+    return connSubscribed(conn) ? CLIENT_PUBSUB : CLIENT_NORMAL;
+}
+
+// After the output grew: disconnect past the hard limit. The close is
+// left to processPending(), the caller may be walking a list the client
+// is on (e.g. the subscribers of a channel).
+static void connCheckOutput(Conn *conn) {
+    size_t hard = (size_t)gConfig.outputHardLimit[connClass(conn)];
+    if (hard == 0 || conn->wantClose || connOutBytes(conn) <= hard) {
+        return;
+    }
+    fprintf(stderr, "closing client %d: output buffer over the hard limit\n", conn->fd);
+    conn->wantClose = true;
+    gStats.outputDisconnects++;
+    connQueuePending(conn);
+}
+
+// Before running a request: hold it while the output is past the soft
+// limit. The client is not read from meanwhile (wantRead stays false).
+static bool connThrottle(Conn *conn) {
+    size_t soft = (size_t)gConfig.outputSoftLimit[connClass(conn)];
+    if (soft == 0 || connOutBytes(conn) <= soft) {
+        return false;
+    }
+    if (!conn->throttled) {
+        conn->throttled = true;
+        conn->throttleCount++;
+        gStats.outputThrottled++;
+        gData.throttledClients++;
+    }
+    return true;
+}
+
+static void uringArmRecv(Conn *conn);
+
+// after a write: a throttled client resumes below the soft limit
+static void connOnDrain(Conn *conn) {
+    size_t soft = (size_t)gConfig.outputSoftLimit[connClass(conn)];
+    if (conn->throttled && (soft == 0 || connOutBytes(conn) <= soft)) {
+        connUnthrottle(conn);
+        if (gData.uring && !conn->recvArmed) {
+            uringArmRecv(conn);
+        }
+        // its buffered requests run at the end of the iteration
+        connQueuePending(conn);
+    }
+    // a paused command goes on once the client has read some
+    if (conn->taskWaitsDrain && connOutBytes(conn) < k_stream_ahead) {
+        conn->taskWaitsDrain = false;
+        connQueuePending(conn);
+    }
+}
+
+// a whole response frame holding [args...], ready to be shared
+static SharedBuf *pubsubFrame(const std::string **args, size_t n) {
+    static thread_local Buffer frame;
+    frame.clear();
+    size_t headerPos = 0;
+    responseBegin(frame, &headerPos);
+    outArr(frame, n);
+    for (size_t i = 0; i < n; i++) {
+        outStr(frame, args[i]->data(), args[i]->size());
+    }
+    responseEnd(frame, headerPos);
+    return sharedNew(frame.data(), frame.size());
+}
+
+static size_t pubsubDeliver(PubsubTopic *topic, SharedBuf *buf) {
+    size_t n = 0;
+    for (DList *it = topic->subs.next; it != &topic->subs; it = it->next) {
+        Conn *conn = container_of(it, Subscription, node)->conn;
+        if (!conn->wantClose) {
+            connPushShared(conn, buf);
+            connCheckOutput(conn);
+        }
+        n++;
+    }
+    sharedUnref(buf);
+    return n;
+}
+
+// returns the number of receivers
+static size_t pubsubPublish(const std::string &channel, const std::string &msg) {
+    static const std::string k_message = "message", k_pmessage = "pmessage";
+    size_t receivers = 0;
+    if (PubsubTopic *topic = topicFind(false, channel)) {
+        const std::string *args[] = {&k_message, &channel, &msg};
+        receivers += pubsubDeliver(topic, pubsubFrame(args, 3));
+    }
+    for (DList *it = gData.patterns.next; it != &gData.patterns; it = it->next) {
+        PubsubTopic *topic = container_of(it, PubsubTopic, link);
+        if (globMatchCompiled(&topic->glob, channel.data(), channel.size())) {
+            const std::string *args[] = {&k_pmessage, &topic->name, &channel, &msg};
+            receivers += pubsubDeliver(topic, pubsubFrame(args, 4));
+        }
+    }
+    return receivers;
+}
+
+// PUBLISH channel message, replies with the number of receivers
+static void doPublish(Conn *, std::vector<std::string> &cmd, Buffer &out) {
+    return outInt(out, (int64_t)pubsubPublish(cmd[1], cmd[2]));
+}
+
+// `event` on `key` as a message on __keyspace@0__:<key> and/or
+// __keyevent@0__:<event>, per notify-keyspace-events
+static void notifyPublish(uint32_t type, const char *event, const char *key, size_t len) {
+    std::string name(key, len), ev(event);
+    if (gConfig.notifyKeyspaceEvents & NOTIFY_KEYSPACE) {
+        pubsubPublish("__keyspace@0__:" + name, ev);
+    }
+    if (gConfig.notifyKeyspaceEvents & NOTIFY_KEYEVENT) {
+        pubsubPublish("__keyevent@0__:" + ev, name);
+    }
+}
+
+const size_t k_slowlog_max_args = 32;
+const size_t k_slowlog_max_arg_len = 128;
+
+struct SlowlogEntry {
+    uint64_t id = 0;
+    // unix time in seconds
+    uint64_t timestamp = 0;
+    uint64_t durationUs = 0;
+    int fd = -1;
+    // truncated copy, the strings keep their capacity across wrap-arounds
+    std::vector<std::string> args;
+};
+
+// ring of the newest slowlog-max-len slow commands
+static struct {
+    std::vector<SlowlogEntry> ring;
+    // next slot to overwrite
+    size_t head = 0;
+    size_t len = 0;
+    uint64_t nextId = 0;
+} gSlowlog;
+
+static void slowlogAdd(Conn *conn, const std::vector<std::string> &cmd, uint64_t durationUs) {
+    if (gSlowlog.ring.empty()) {
+        return;
+    }
+    SlowlogEntry &ent = gSlowlog.ring[gSlowlog.head];
+    gSlowlog.head = (gSlowlog.head + 1) % gSlowlog.ring.size();
+    if (gSlowlog.len < gSlowlog.ring.size()) {
+        gSlowlog.len++;
+    }
+    ent.id = gSlowlog.nextId++;
+    ent.timestamp = (uint64_t)time(NULL);
+    ent.durationUs = durationUs;
+    ent.fd = conn->fd;
+    size_t nargs = cmd.size() < k_slowlog_max_args ? cmd.size() : k_slowlog_max_args;
+    ent.args.resize(nargs);
+    for (size_t i = 0; i < nargs; i++) {
+        std::string &arg = ent.args[i];
+        if (i + 1 == k_slowlog_max_args && cmd.size() > k_slowlog_max_args) {
+            arg = "... (" + std::to_string(cmd.size() - i) + " more arguments)";
+        } else if (cmd[i].size() > k_slowlog_max_arg_len) {
+            arg.assign(cmd[i], 0, k_slowlog_max_arg_len);
+            arg += "... (" + std::to_string(cmd[i].size() - k_slowlog_max_arg_len)
+                + " more bytes)";
+        } else {
+            arg = cmd[i];
+        }
+    }
+}
+
+// i-th newest entry
+static SlowlogEntry &slowlogAt(size_t i) {
+    size_t n = gSlowlog.ring.size();
+    return gSlowlog.ring[(gSlowlog.head + n - 1 - i) % n];
+}
+
+// apply slowlog-max-len, keeping the newest entries
+static void slowlogResize() {
+    std::vector<SlowlogEntry> ring((size_t)gConfig.slowlogMaxLen);
+    size_t keep = gSlowlog.len < ring.size() ? gSlowlog.len : ring.size();
+    for (size_t i = 0; i < keep; i++) {
+        ring[keep - 1 - i] = std::move(slowlogAt(i));
+    }
+    gSlowlog.ring.swap(ring);
+    gSlowlog.len = keep;
+    gSlowlog.head = gSlowlog.ring.empty() ? 0 : keep % gSlowlog.ring.size();
+}
+
+// SLOWLOG GET [count] | LEN | RESET
+static void doSlowlog(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd[1] == "len" && cmd.size() == 2) {
+        return outInt(out, (int64_t)gSlowlog.len);
+    } else if (cmd[1] == "reset" && cmd.size() == 2) {
+        gSlowlog.len = 0;
+        return outNil(out);
+    } else if (cmd[1] != "get" || cmd.size() > 3) {
+        return outErr(out, ERR_BAD_ARG, "expect SLOWLOG GET [count] | LEN | RESET");
+    }
+    int64_t count = 10;
+    if (cmd.size() == 3 && (!str2int(cmd[2], count) || count < 0)) {
+        return outErr(out, ERR_BAD_ARG, "expect count to be a positive number");
+    }
+    size_t n = (size_t)count < gSlowlog.len ? (size_t)count : gSlowlog.len;
+    outArr(out, n);
+    for (size_t i = 0; i < n; i++) {
+        const SlowlogEntry &ent = slowlogAt(i);
+        outArr(out, 5);
+        outInt(out, (int64_t)ent.id);
+        outInt(out, (int64_t)ent.timestamp);
+        outInt(out, (int64_t)ent.durationUs);
+        outInt(out, ent.fd);
+        outArr(out, ent.args.size());
+        for (const std::string &arg : ent.args) {
+            outStr(out, arg.data(), arg.size());
+        }
+    }
+}
+
+enum {
+    CFG_INT = 0,
+    // bytes, accepts k/kb/m/mb/g/gb suffixes
+    CFG_MEM = 1,
+    // index into ConfigParam::names
+    CFG_ENUM = 2,
+    // a bit set, ConfigParam::names has a letter per bit
+    CFG_FLAGS = 3,
+};
+
+// a new size applies at once, what the old ring held is lost
+static void replBacklogResize() {
+    if (replActive()) {
+        backlogInit(&gData.backlog, (size_t)gConfig.replBacklogSize);
+    }
+}
+
+struct ConfigParam {
+    const char *name;
+    uint32_t type;
+    int64_t *val;
+    int64_t min;
+    int64_t max;
+    // CFG_ENUM value names or CFG_FLAGS letters, NULL terminated
+    const char *const *names;
+    // only settable on the command line
+    bool immutable;
+    // applies a changed value, may be NULL
+    void (*onChange)();
+};
+
+static const ConfigParam k_config_params[] = {
+    {"port", CFG_INT, &gConfig.port, 1, 65535, NULL, true, NULL},
+    {"slowlog-log-slower-than", CFG_INT, &gConfig.slowlogSlowerThanUs, -1, INT64_MAX,
+        NULL, false, NULL},
+    {"slowlog-max-len", CFG_INT, &gConfig.slowlogMaxLen, 0, 1 << 20,
+        NULL, false, &slowlogResize},
+    {"maxmemory", CFG_MEM, &gConfig.maxmemory, 0, INT64_MAX, NULL, false, NULL},
+    {"maxmemory-policy", CFG_ENUM, &gConfig.maxmemoryPolicy, 0, 0,
+        k_evict_policy_names, false, NULL},
+    {"maxmemory-samples", CFG_INT, &gConfig.maxmemorySamples, 1, 64, NULL, false, NULL},
+    {"lfu-log-factor", CFG_INT, &gConfig.lfuLogFactor, 0, 1000000, NULL, false, NULL},
+    {"lfu-decay-time", CFG_INT, &gConfig.lfuDecayTime, 0, 1000000, NULL, false, NULL},
+    {"io-backend", CFG_ENUM, &gConfig.ioBackend, 0, 0, k_io_backend_names, true, NULL},
+    {"client-output-soft-limit-normal", CFG_MEM, &gConfig.outputSoftLimit[CLIENT_NORMAL],
+        0, INT64_MAX, NULL, false, NULL},
+    {"client-output-hard-limit-normal", CFG_MEM, &gConfig.outputHardLimit[CLIENT_NORMAL],
+        0, INT64_MAX, NULL, false, NULL},
+    {"client-output-soft-limit-pubsub", CFG_MEM, &gConfig.outputSoftLimit[CLIENT_PUBSUB],
+        0, INT64_MAX, NULL, false, NULL},
+    {"client-output-hard-limit-pubsub", CFG_MEM, &gConfig.outputHardLimit[CLIENT_PUBSUB],
+        0, INT64_MAX, NULL, false, NULL},
+    {"client-request-budget", CFG_INT, &gConfig.requestBudget, 0, INT64_MAX,
+        NULL, false, NULL},
+    {"client-request-budget-us", CFG_INT, &gConfig.requestBudgetUs, 0, INT64_MAX,
+        NULL, false, NULL},
+    {"cluster-enabled", CFG_ENUM, &gConfig.clusterEnabled, 0, 0, k_yes_no_names, true, NULL},
+    {"repl-backlog-size", CFG_MEM, &gConfig.replBacklogSize, 16 << 10, INT64_MAX,
+        NULL, false, &replBacklogResize},
+    {"tracking-table-max-keys", CFG_INT, &gConfig.trackingTableMaxKeys, 0, INT64_MAX,
+        NULL, false, &trackingTableResize},
+    {"notify-keyspace-events", CFG_FLAGS, &gConfig.notifyKeyspaceEvents, 0, 0,
+        k_notify_flag_names, false, NULL},
+    {"key-index", CFG_ENUM, &gConfig.keyIndex, 0, 0, k_yes_no_names, false, &keyIndexUpdate},
+};
+
+static bool str2mem(const std::string &s, int64_t &out) {
+    char *endp = NULL;
+    long long n = strtoll(s.c_str(), &endp, 10);
+    if (endp == s.c_str() || n < 0) {
+        return false;
+    }
+    int64_t unit = 1;
+    std::string suffix = endp;
+    for (char &c : suffix) {
+        c = (char)tolower(c);
+    }
+    if (suffix == "k" || suffix == "kb") {
+        unit = 1 << 10;
+    } else if (suffix == "m" || suffix == "mb") {
+        unit = 1 << 20;
+    } else if (suffix == "g" || suffix == "gb") {
+        unit = 1 << 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    if (n > INT64_MAX / unit) {
+        return false;
+    }
+    out = n * unit;
+    return true;
+}
+
+static std::string configGet(const ConfigParam *p) {
+    if (p->type == CFG_ENUM) {
+        return p->names[*p->val];
+    }
+    if (p->type == CFG_FLAGS) {
+        std::string s;
+        for (int64_t i = 0; p->names[i]; i++) {
+            if (*p->val & ((int64_t)1 << i)) {
+                s += p->names[i];
+            }
+        }
+        return s;
+    }
+    return std::to_string(*p->val);
+}
+
+static const ConfigParam *configLookup(const std::string &name) {
+    for (const ConfigParam &p : k_config_params) {
+        if (name == p.name) {
+            return &p;
+        }
+    }
+    return NULL;
+}
+
+static bool configSet(const ConfigParam *p, const std::string &val) {
+    int64_t v = -1;
+    if (p->type == CFG_ENUM) {
+        for (int64_t i = 0; p->names[i]; i++) {
+            if (val == p->names[i]) {
+                v = i;
+            }
+        }
+        if (v < 0) {
+            return false;
+        }
+    } else if (p->type == CFG_FLAGS) {
+        v = 0;
+        for (char c : val) {
+            int64_t i = 0;
+            while (p->names[i] && p->names[i][0] != c) {
+                i++;
+            }
+            if (!p->names[i]) {
+                return false;
+            }
+            v |= (int64_t)1 << i;
+        }
+    } else if (p->type == CFG_MEM) {
+        if (!str2mem(val, v) || v < p->min || v > p->max) {
+            return false;
+        }
+    } else if (!str2int(val, v) || v < p->min || v > p->max) {
+        return false;
+    }
+    *p->val = v;
+    if (p->onChange) {
+        p->onChange();
+    }
+    return true;
+}
+
+// CONFIG GET name|* | CONFIG SET name value
+static void doConfig(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd[1] == "get" && cmd.size() == 3) {
+        size_t ctx = outBeginArr(out);
+        uint32_t n = 0;
+        for (const ConfigParam &p : k_config_params) {
+            if (cmd[2] == "*" || cmd[2] == p.name) {
+                std::string val = configGet(&p);
+                outStr(out, p.name, strlen(p.name));
+                outStr(out, val.data(), val.size());
+                n += 2;
+            }
+        }
+        return outEndArr(out, ctx, n);
+    } else if (cmd[1] == "set" && cmd.size() == 4) {
+        const ConfigParam *p = configLookup(cmd[2]);
+        if (!p || p->immutable) {
+            return outErr(out, ERR_BAD_ARG, "unknown or immutable parameter");
+        }
+        if (!configSet(p, cmd[3])) {
+            return outErr(out, ERR_BAD_ARG, "invalid value");
+        }
+        return outNil(out);
+    }
+    return outErr(out, ERR_BAD_ARG, "expect CONFIG GET name | SET name value");
+}
+
+static uint64_t evictScore(Entry *ent) {
+    if (policyIsLFU()) {
+        return 255 - lfuDecay(ent->lru);
+    }
+    return (lruClock() - ent->lru) & k_lru_max;
+}
+
+// keep the best k_evict_pool_size candidates across calls
+static void evictPoolInsert(Entry *ent, uint64_t score) {
+    EvictCandidate *pool = gData.evictPool;
+    size_t &n = gData.evictPoolLen;
+    for (size_t i = 0; i < n; i++) {
+        if (pool[i].key.size() == ent->klen && !memcmp(pool[i].key.data(), ent->key, ent->klen)) {
+            return;
+        }
+    }
+    if (n == k_evict_pool_size && score <= pool[0].score) {
+        return;
+    }
+    size_t pos = 0;
+    while (pos < n && pool[pos].score < score) {
+        pos++;
+    }
+    // swaps move the strings around, their buffers get reused
+    if (n < k_evict_pool_size) {
+        for (size_t i = n; i > pos; i--) {
+            std::swap(pool[i], pool[i - 1]);
+        }
+        n++;
+    } else {
+        // drop the lowest score
+        pos--;
+        for (size_t i = 0; i < pos; i++) {
+            std::swap(pool[i], pool[i + 1]);
+        }
+    }
+    pool[pos].score = score;
+    pool[pos].key.assign(ent->key, ent->klen);
+}
+
+static bool policyIsVolatile() {
+    return gConfig.maxmemoryPolicy == EVICT_VOLATILE_LRU
+        || gConfig.maxmemoryPolicy == EVICT_VOLATILE_LFU;
+}
+
+// a few random keys, from the TTL heap for the volatile policies
+static size_t evictSample(Entry **out, size_t n) {
+    if (policyIsVolatile()) {
+        size_t size = gData.heap.size();
+        for (size_t i = 0; i < n && size; i++) {
+            out[i] = container_of(gData.heap[rnd() % size].ref, Entry, heapIdx);
+        }
+        return size ? n : 0;
+    }
+    HNode *nodes[64];
+    size_t got = hmSample(&gData.db, (size_t)rnd(), nodes, n);
+    for (size_t i = 0; i < got; i++) {
+        out[i] = container_of(nodes[i], Entry, node);
+    }
+    return got;
+}
+
+static Entry *evictPick() {
+    Entry *samples[64];
+    size_t n = evictSample(samples, (size_t)gConfig.maxmemorySamples);
+    if (gConfig.maxmemoryPolicy == EVICT_ALLKEYS_RANDOM) {
+        return n ? samples[0] : NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        evictPoolInsert(samples[i], evictScore(samples[i]));
+    }
+    while (gData.evictPoolLen > 0) {
+        EvictCandidate &best = gData.evictPool[--gData.evictPoolLen];
+        LookupKey key;
+        lookupKeyInit(&key, best.key);
+        HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+        if (!node) {
+            continue;
+        }
+        Entry *ent = container_of(node, Entry, node);
+        if (!policyIsVolatile() || ent->heapIdx != (size_t)-1) {
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+// evict until under maxmemory, false if that is not possible
+static bool evictToLimit() {
+    while (usedMemory() > (size_t)gConfig.maxmemory) {
+        if (gConfig.maxmemoryPolicy == EVICT_NONE) {
+            return false;
+        }
+        Entry *ent = evictPick();
+        if (!ent) {
+            return false;
+        }
+        replFeedDel(ent);
+        trackingInvalidate(NULL, ent->key, ent->klen);
+        notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted", ent->key, ent->klen);
+        dbDelete(ent);
+        gStats.evictedKeys++;
+    }
+    return true;
+}
+
+static void doInfo(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doClient(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doMulti(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doExec(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doDiscard(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doWatch(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doUnwatch(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doCluster(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doAsking(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doDump(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doRestore(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doMigrate(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doPsync(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+static void doReplicaof(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+
+enum {
+    // modifies the keyspace, triggers eviction
+    CMD_WRITE = 1 << 0,
+    // may grow memory, refused when eviction cannot make room
+    CMD_DENYOOM = 1 << 1,
+    // allowed while the client has subscriptions
+    CMD_PUBSUB = 1 << 2,
+    // MULTI/EXEC itself, runs at once instead of being queued
+    CMD_TXN = 1 << 3,
+};
+
+struct Command {
+    const char *name;
+    // > 0: exact number of arguments including the name, < 0: at least -arity
+    int32_t arity;
+    void (*fn)(Conn *conn, std::vector<std::string> &cmd, Buffer &out);
+    uint32_t flags;
+    // the key arguments: cmd[firstKey], then every keyStep-th up to
+    // cmd[lastKey], negative counting from the end; none if firstKey is 0
+    int8_t firstKey;
+    int8_t lastKey;
+    int8_t keyStep;
+    // instead of `fn`, for commands that pause, see SlicedArr
+    CoTask (*task)(Conn *conn, std::vector<std::string> cmd, Buffer &out);
+};
+
+static const Command k_commands[] = {
+    {"get",     2, &doGet,     0, 1, 1, 1},
+    {"set",     3, &doSet,     CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"del",    -2, &doDel,     CMD_WRITE, 1, -1, 1},
+    {"mget",   -2, &doMGet,    0, 1, -1, 1},
+    {"mset",   -3, &doMSet,    CMD_WRITE | CMD_DENYOOM, 1, -1, 2},
+    {"hset",   -4, &doHSet,    CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"hget",    3, &doHGet,    0, 1, 1, 1},
+    {"hmget",  -3, &doHMGet,   0, 1, 1, 1},
+    {"hdel",   -3, &doHDel,    CMD_WRITE, 1, 1, 1},
+    {"hlen",    2, &doHLen,    0, 1, 1, 1},
+    {"hgetall", 2, &doHGetAll, 0, 1, 1, 1},
+    {"hincrby", 4, &doHIncrBy, CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"lpush",  -3, &doLPush,   CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"rpush",  -3, &doRPush,   CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"lpop",    2, &doLPop,    CMD_WRITE, 1, 1, 1},
+    {"rpop",    2, &doRPop,    CMD_WRITE, 1, 1, 1},
+    {"blpop",  -3, &doBLPop,   CMD_WRITE, 1, -2, 1},
+    {"brpop",  -3, &doBRPop,   CMD_WRITE, 1, -2, 1},
+    {"llen",    2, &doLLen,    0, 1, 1, 1},
+    {"lindex",  3, &doLIndex,  0, 1, 1, 1},
+    {"lrange",  4, &doLRange,  0, 1, 1, 1},
+    {"sadd",   -3, &doSAdd,    CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"srem",   -3, &doSRem,    CMD_WRITE, 1, 1, 1},
+    {"sismember", 3, &doSIsMember, 0, 1, 1, 1},
+    {"scard",   2, &doSCard,   0, 1, 1, 1},
+    {"smembers", 2, &doSMembers, 0, 1, 1, 1},
+    {"sinter", -2, &doSInter,  0, 1, -1, 1},
+    {"sunion", -2, &doSUnion,  0, 1, -1, 1},
+    {"keys",   -1, NULL,       0, 0, 0, 0, &doKeys},
+    {"zadd",    4, &doZAdd,    CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"zquery",  6, NULL,       0, 1, 1, 1, &doZQuery},
+    {"zscore",  3, &doZScore,  0, 1, 1, 1},
+    {"zrem",    3, &doZRem,    CMD_WRITE, 1, 1, 1},
+    {"pexpire", 3, &doExpire,  CMD_WRITE, 1, 1, 1},
+    {"pttl",    2, &doTtl,     0, 1, 1, 1},
+    {"incr",    2, &doIncr,    CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"decr",    2, &doDecr,    CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"incrby",  3, &doIncrBy,  CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"decrby",  3, &doDecrBy,  CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"incrbyfloat", 3, &doIncrByFloat, CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"object",  3, &doObject,  0, 2, 2, 1},
+    {"memory",  3, &doMemory,  0, 2, 2, 1},
+    {"info",   -1, &doInfo,    0, 0, 0, 0},
+    {"client",  -2, &doClient,  0, 0, 0, 0},
+    {"slowlog",-2, &doSlowlog, 0, 0, 0, 0},
+    {"config", -3, &doConfig,  0, 0, 0, 0},
+    {"subscribe",   -2, &doSubscribe,   CMD_PUBSUB, 0, 0, 0},
+    {"unsubscribe", -1, &doUnsubscribe, CMD_PUBSUB, 0, 0, 0},
+    {"psubscribe",  -2, &doPSubscribe,  CMD_PUBSUB, 0, 0, 0},
+    {"punsubscribe",-1, &doPUnsubscribe, CMD_PUBSUB, 0, 0, 0},
+    {"publish",  3, &doPublish, 0, 0, 0, 0},
+    {"multi",    1, &doMulti,   CMD_TXN, 0, 0, 0},
+    {"exec",     1, &doExec,    CMD_TXN, 0, 0, 0},
+    {"discard",  1, &doDiscard, CMD_TXN, 0, 0, 0},
+    {"watch",   -2, &doWatch,   CMD_TXN, 1, -1, 1},
+    {"unwatch",  1, &doUnwatch, 0, 0, 0, 0},
+    {"cluster", -2, &doCluster, 0, 0, 0, 0},
+    {"asking",   1, &doAsking,  0, 0, 0, 0},
+    {"dump",     2, &doDump,    0, 1, 1, 1},
+    {"restore",  4, &doRestore, CMD_WRITE | CMD_DENYOOM, 1, 1, 1},
+    {"migrate", -5, &doMigrate, CMD_WRITE, 0, 0, 0},
+    {"psync",    3, &doPsync,   0, 0, 0, 0},
+    {"replicaof", 3, &doReplicaof, 0, 0, 0, 0},
+};
+
+const size_t k_num_commands = sizeof(k_commands) / sizeof(k_commands[0]);
+
+// per-command latency, indexed like k_commands
+static thread_local Histogram gCmdStats[k_num_commands];
+
+static const Command *lookupCommand(const std::vector<std::string> &cmd) {
+    if (cmd.empty()) {
+        return NULL;
+    }
+    for (const Command &c : k_commands) {
+        if (cmd[0] != c.name) {
+            continue;
+        }
+        bool ok = c.arity > 0 ? cmd.size() == (size_t)c.arity
+                              : cmd.size() >= (size_t)-c.arity;
+        return ok ? &c : NULL;
+    }
+    return NULL;
+}
+
+static void infoAppend(std::string &s, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    s.append(buf, n < (int)sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+static bool infoWants(const std::vector<std::string> &cmd, const char *section) {
+    return cmd.size() < 2 || cmd[1] == "all" || cmd[1] == section;
+}
+
+// INFO [section]
+static void doInfo(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    std::string s;
+    if (infoWants(cmd, "server")) {
+        infoAppend(s, "# Server\n");
+        infoAppend(s, "uptime_in_seconds:%llu\n",
+            (unsigned long long)(getMonotonicMs() - gStats.startMs) / 1000);
+    }
+    if (infoWants(cmd, "clients")) {
+        infoAppend(s, "# Clients\n");
+        infoAppend(s, "connected_clients:%llu\n", (unsigned long long)gStats.connsCurrent);
+        infoAppend(s, "total_connections_received:%llu\n",
+            (unsigned long long)gStats.connsAccepted);
+        infoAppend(s, "blocked_clients:%zu\n", gData.blockedClients);
+        infoAppend(s, "throttled_clients:%zu\n", gData.throttledClients);
+        infoAppend(s, "watched_keys:%zu\n", gData.watchedKeys);
+        infoAppend(s, "tracking_clients:%zu\n", gData.trackingClients);
+    }
+    if (infoWants(cmd, "memory")) {
+        struct mallinfo2 mi = mallinfo2();
+        infoAppend(s, "# Memory\n");
+        infoAppend(s, "used_memory:%zu\n", usedMemory());
+        infoAppend(s, "used_memory_dataset:%zu\n", gData.dataMemory);
+        infoAppend(s, "used_memory_key_index:%zu\n", gData.keyIndex.mem);
+        infoAppend(s, "key_index_nodes:%zu\n", gData.keyIndex.nodes);
+        infoAppend(s, "used_memory_heap:%zu\n", mi.uordblks);
+        infoAppend(s, "maxmemory:%lld\n", (long long)gConfig.maxmemory);
+        infoAppend(s, "maxmemory_policy:%s\n",
+            k_evict_policy_names[gConfig.maxmemoryPolicy]);
+        infoAppend(s, "threadpool_queue_depth:%zu\n",
+            threadPoolQueueDepth(&gData.threadPool));
+    }
+    if (infoWants(cmd, "stats")) {
+        uint64_t calls = 0;
+        for (const Histogram &h : gCmdStats) {
+            calls += h.count;
+        }
+        infoAppend(s, "# Stats\n");
+        infoAppend(s, "total_commands_processed:%llu\n", (unsigned long long)calls);
+        infoAppend(s, "unknown_commands:%llu\n", (unsigned long long)gStats.unknownCmds);
+        infoAppend(s, "keyspace_hits:%llu\n", (unsigned long long)gStats.keyspaceHits);
+        infoAppend(s, "keyspace_misses:%llu\n", (unsigned long long)gStats.keyspaceMisses);
+        infoAppend(s, "evicted_keys:%llu\n", (unsigned long long)gStats.evictedKeys);
+        infoAppend(s, "client_output_throttled:%llu\n",
+            (unsigned long long)gStats.outputThrottled);
+        infoAppend(s, "client_output_disconnects:%llu\n",
+            (unsigned long long)gStats.outputDisconnects);
+        infoAppend(s, "client_budget_exhausted:%llu\n",
+            (unsigned long long)gStats.budgetExhausted);
+        infoAppend(s, "command_yields:%llu\n", (unsigned long long)gStats.commandYields);
+        infoAppend(s, "sync_full:%llu\n", (unsigned long long)gStats.syncFull);
+        infoAppend(s, "sync_partial_ok:%llu\n", (unsigned long long)gStats.syncPartialOk);
+        infoAppend(s, "sync_partial_err:%llu\n", (unsigned long long)gStats.syncPartialErr);
+        size_t prefixes = 0;
+        for (Conn *c : gData.bcastClients) {
+            prefixes += c->trackingPrefixes.size();
+        }
+        infoAppend(s, "tracking_total_keys:%zu\n", hmSize(&gData.tracking));
+        infoAppend(s, "tracking_total_prefixes:%zu\n", prefixes);
+        infoAppend(s, "tracking_invalidations:%llu\n",
+            (unsigned long long)gStats.trackingInvalidations);
+        infoAppend(s, "tracking_evicted_keys:%llu\n",
+            (unsigned long long)gStats.trackingEvictedKeys);
+        infoAppend(s, "pubsub_channels:%zu\n", hmSize(&gData.channels));
+        infoAppend(s, "pubsub_patterns:%zu\n", gData.npatterns);
+        infoAppend(s, "total_net_input_bytes:%llu\n", (unsigned long long)gStats.bytesIn);
+        infoAppend(s, "total_net_output_bytes:%llu\n", (unsigned long long)gStats.bytesOut);
+        infoAppend(s, "eventloop_iterations:%llu\n", (unsigned long long)gStats.loopNs.count);
+        infoAppend(s, "eventloop_busy_usec:%llu\n",
+            (unsigned long long)gStats.loopNs.sum / 1000);
+        infoAppend(s, "eventloop_busy_p99_usec:%.3f\n",
+            (double)histPercentile(&gStats.loopNs, 99) / 1e3);
+        infoAppend(s, "eventloop_poll_wait_usec:%llu\n",
+            (unsigned long long)gStats.pollNs.sum / 1000);
+    }
+    if (infoWants(cmd, "keyspace")) {
+        infoAppend(s, "# Keyspace\n");
+        infoAppend(s, "keys:%zu\n", hmSize(&gData.db));
+        infoAppend(s, "expires:%zu\n", gData.heap.size());
+    }
+    if (infoWants(cmd, "cluster")) {
+        size_t assigned = 0, owned = 0;
+        for (const ClusterSlot &cs : gData.cluster.slots) {
+            assigned += cs.owner != k_no_node;
+            owned += cs.owner == 0;
+        }
+        infoAppend(s, "# Cluster\n");
+        infoAppend(s, "cluster_enabled:%d\n", (int)gConfig.clusterEnabled);
+        infoAppend(s, "cluster_slots_assigned:%zu\n", assigned);
+        infoAppend(s, "cluster_slots_owned:%zu\n", owned);
+        infoAppend(s, "cluster_known_nodes:%zu\n", gData.cluster.nodes.size());
+    }
+    if (infoWants(cmd, "replication")) {
+        infoAppend(s, "# Replication\n");
+        if (gData.masterHost.empty()) {
+            infoAppend(s, "role:master\n");
+        } else {
+            bool up = gData.masterConn && gData.masterConn->repl == REPL_CONN_MASTER;
+            infoAppend(s, "role:slave\n");
+            infoAppend(s, "master_host:%s\n", gData.masterHost.c_str());
+            infoAppend(s, "master_port:%u\n", (unsigned)gData.masterPort);
+            infoAppend(s, "master_link_status:%s\n", up ? "up" : "down");
+            infoAppend(s, "master_sync_in_progress:%d\n", (int)(up && gData.replSnapshotLeft > 0));
+            infoAppend(s, "slave_repl_offset:%llu\n",
+                (unsigned long long)gData.backlog.offset);
+        }
+        infoAppend(s, "connected_slaves:%zu\n", gData.replicas.size());
+        infoAppend(s, "master_replid:%s\n", gData.replid.c_str());
+        infoAppend(s, "master_repl_offset:%llu\n", (unsigned long long)gData.backlog.offset);
+        infoAppend(s, "repl_backlog_active:%d\n", (int)replActive());
+        infoAppend(s, "repl_backlog_size:%zu\n", gData.backlog.buf.size());
+        infoAppend(s, "repl_backlog_histlen:%zu\n", gData.backlog.len);
+    }
+    if (infoWants(cmd, "commandstats")) {
+        infoAppend(s, "# Commandstats\n");
+        for (size_t i = 0; i < k_num_commands; i++) {
+            const Histogram &h = gCmdStats[i];
+            if (h.count == 0) {
+                continue;
+            }
+            infoAppend(s, "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f\n",
+                k_commands[i].name, (unsigned long long)h.count,
+                (unsigned long long)h.sum / 1000, (double)h.sum / 1e3 / (double)h.count);
+        }
+    }
+    if (infoWants(cmd, "latencystats")) {
+        infoAppend(s, "# Latencystats\n");
+        for (size_t i = 0; i < k_num_commands; i++) {
+            const Histogram &h = gCmdStats[i];
+            if (h.count == 0) {
+                continue;
+            }
+            infoAppend(s, "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f,max=%.3f\n",
+                k_commands[i].name, (double)histPercentile(&h, 50) / 1e3,
+                (double)histPercentile(&h, 99) / 1e3, (double)histPercentile(&h, 99.9) / 1e3,
+                (double)h.max / 1e3);
+        }
+    }
+    return outStr(out, s.data(), s.size());
+}
+
+// CLIENT TRACKING ON [BCAST] [PREFIX p ...] [NOLOOP] | OFF
+static void clientTracking(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd.size() < 3) {
+        return outErr(out, ERR_BAD_ARG, "expect ON or OFF");
+    }
+    if (strcasecmp(cmd[2].c_str(), "off") == 0 && cmd.size() == 3) {
+        trackingOff(conn);
+        return outNil(out);
+    }
+    if (strcasecmp(cmd[2].c_str(), "on") != 0) {
+        return outErr(out, ERR_BAD_ARG, "expect ON or OFF");
+    }
+    bool bcast = false, noloop = false;
+    std::vector<std::string> prefixes;
+    for (size_t i = 3; i < cmd.size(); i++) {
+        const char *opt = cmd[i].c_str();
+        if (strcasecmp(opt, "bcast") == 0) {
+            bcast = true;
+        } else if (strcasecmp(opt, "noloop") == 0) {
+            noloop = true;
+        } else if (strcasecmp(opt, "prefix") == 0 && i + 1 < cmd.size()) {
+            prefixes.push_back(cmd[++i]);
+        } else {
+            return outErr(out, ERR_BAD_ARG, "bad tracking option");
+        }
+    }
+    if (!prefixes.empty() && !bcast) {
+        return outErr(out, ERR_BAD_ARG, "PREFIX needs BCAST");
+    }
+    if (bcast && prefixes.empty()) {
+        prefixes.push_back("");  // every key
+    }
+    // switching modes starts over
+    trackingOff(conn);
+    conn->tracking = true;
+    conn->trackingBcast = bcast;
+    conn->trackingNoloop = noloop;
+    conn->trackingPrefixes = std::move(prefixes);
+    if (bcast) {
+        gData.bcastClients.push_back(conn);
+    }
+    gData.trackingClients++;
+    return outNil(out);
+}
+
+// CLIENT LIST, a line per connection
+static void doClient(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (cmd[1] == "tracking") {
+        return clientTracking(conn, cmd, out);
+    }
+    if (cmd[1] != "list" || cmd.size() != 2) {
+        return outErr(out, ERR_BAD_ARG, "expect CLIENT LIST or CLIENT TRACKING");
+    }
+    std::string s;
+    uint64_t nowMs = getMonotonicMs();
+    for (Conn *c : gData.fd2conn) {
+        if (!c) {
+            continue;
+        }
+        infoAppend(s, "fd=%d class=%s idle=%llu qbuf=%zu omem=%zu sub=%zu psub=%zu "
+            "blocked=%d throttled=%d throttle_count=%llu tracking=%d\n",
+            c->fd, k_client_class_names[connClass(c)],
+            (unsigned long long)(nowMs - c->lastActiveMs) / 1000, connInBytes(c),
+            connOutBytes(c), c->channels.size(), c->patterns.size(), (int)c->blocked,
+            (int)c->throttled, (unsigned long long)c->throttleCount, (int)c->tracking);
+    }
+    return outStr(out, s.data(), s.size());
+}
+
+// the index past the last key argument of `cmd`, see Command::lastKey
+static size_t cmdKeysEnd(const Command *c, const std::vector<std::string> &cmd) {
+    if (c->firstKey == 0) {
+        return 0;
+    }
+    int64_t last = c->lastKey < 0 ? (int64_t)cmd.size() + c->lastKey : c->lastKey;
+    return (size_t)last + 1;
+}
+
+// the clients WATCHing a key, a client once per WATCH of it
+struct WatchedKey {
+    HNode node;
+    std::string key;
+    std::vector<Conn *> clients;
+};
+
+static bool watchedKeyEq(HNode *node, HNode *key) {
+    WatchedKey *wk = container_of(node, WatchedKey, node);
+    LookupKey *keydata = container_of(key, LookupKey, node);
+    return wk->key.size() == keydata->len && memcmp(wk->key.data(), keydata->key, keydata->len) == 0;
+}
+
+// A write to `name`: the clients WATCHing it fail their EXEC, whether
+// the key exists afterwards or not (created then deleted is a change).
+static void keyTouch(const std::string &name) {
+    LookupKey key;
+    lookupKeyInit(&key, name);
+    HNode *node = hmLookup(&gData.watching, &key.node, &watchedKeyEq);
+    if (node) {
+        for (Conn *conn : container_of(node, WatchedKey, node)->clients) {
+            conn->watchDirty = true;
+        }
+    }
+}
+
+// run one command, queued or not
+static void cmdCall(Conn *conn, const Command *c, std::vector<std::string> &cmd, Buffer &out) {
+    // pushes may land after any reply, a subscribed client has no others
+    if (connSubscribed(conn) && !(c->flags & CMD_PUBSUB)) {
+        return outErr(out, ERR_BAD_ARG, "only (P)SUBSCRIBE / (P)UNSUBSCRIBE allowed while subscribed");
+    }
+    // a replica takes what the primary sends, the primary evicts
+    if ((c->flags & CMD_WRITE) && gConfig.maxmemory > 0 && conn->repl != REPL_CONN_MASTER
+        && !evictToLimit() && (c->flags & CMD_DENYOOM))
+    {
+        return outErr(out, ERR_OOM, "command not allowed when used memory > maxmemory");
+    }
+    size_t replyStart = out.size();
+    uint64_t start = getMonotonicNs();
+    if (c->task) {
+        // the frame gets its own copy of the arguments
+        CoTask task = c->task(conn, cmd, out);
+        if (task.paused()) {
+            conn->task = std::move(task);
+        }
+    } else {
+        c->fn(conn, cmd, out);
+    }
+    uint64_t elapsed = getMonotonicNs() - start;
+    histAdd(&gCmdStats[c - k_commands], elapsed);
+    if ((c->flags & CMD_WRITE) && gData.watchedKeys > 0) {
+        size_t end = cmdKeysEnd(c, cmd);
+        for (size_t i = c->firstKey; i < end; i += c->keyStep) {
+            keyTouch(cmd[i]);
+        }
+    }
+    if (gData.trackingClients > 0) {
+        size_t end = cmdKeysEnd(c, cmd);
+        for (size_t i = c->firstKey; i < end; i += c->keyStep) {
+            if (c->flags & CMD_WRITE) {
+                trackingInvalidate(conn, cmd[i].data(), cmd[i].size());
+            } else if (conn->tracking && !conn->trackingBcast) {
+                trackingRemember(conn, cmd[i]);
+            }
+        }
+    }
+    if (c->flags & CMD_WRITE) {
+        // a failed command changed nothing, unless it says otherwise
+        if (!gData.replSkipCmd && out.size() > replyStart && out[replyStart] != TAG_ERR) {
+            replFeed(cmd);
+        }
+        for (const std::vector<std::string> &op : gData.replOps) {
+            replFeed(op);
+        }
+        gData.replSkipCmd = false;
+        gData.replOps.clear();
+    }
+    if (gConfig.slowlogSlowerThanUs >= 0
+        && elapsed / 1000 >= (uint64_t)gConfig.slowlogSlowerThanUs)
+    {
+        slowlogAdd(conn, cmd, elapsed / 1000);
+    }
+}
+
+static void outErrRedirect(Buffer &out, uint32_t code, const char *kind, uint32_t slot,
+    int32_t node)
+{
+    std::string msg = std::string(kind) + " " + std::to_string(slot) + " "
+        + gData.cluster.nodes[node];
+    return outErr(out, code, msg);
+}
+
+static void outErrMoved(Buffer &out, uint32_t slot) {
+    int32_t owner = gData.cluster.slots[slot].owner;
+    if (owner == k_no_node) {
+        return outErr(out, ERR_BAD_ARG, "CLUSTERDOWN hash slot not served");
+    }
+    return outErrRedirect(out, ERR_MOVED, "MOVED", slot, owner);
+}
+
+// Cluster mode: whether this node serves the keys of `cmd`, otherwise
+// the reply is a redirect. The keys must be in one slot, the same for all
+// commands of a transaction. While a slot moves out, keys already gone
+// are asked for at the target; it serves them to a client that said
+// ASKING, and the rest of the slot only once it owns it.
+static bool clusterRoute(Conn *conn, const Command *c, std::vector<std::string> &cmd,
+    Buffer &out, bool asking)
+{
+    size_t end = cmdKeysEnd(c, cmd);
+    int32_t slot = -1;
+    for (size_t i = c->firstKey; i < end; i += c->keyStep) {
+        int32_t s = (int32_t)keyHashSlot(cmd[i].data(), cmd[i].size());
+        if (slot >= 0 && s != slot) {
+            outErr(out, ERR_BAD_ARG, "CROSSSLOT keys in request don't hash to the same slot");
+            return false;
+        }
+        slot = s;
+    }
+    if (slot < 0) {
+        return true;
+    }
+    if (conn->inMulti && !(c->flags & CMD_TXN)) {
+        if (conn->multiSlot >= 0 && conn->multiSlot != slot) {
+            outErr(out, ERR_BAD_ARG, "CROSSSLOT keys in transaction don't hash to the same slot");
+            return false;
+        }
+        conn->multiSlot = slot;
+    }
+    const ClusterSlot &cs = gData.cluster.slots[slot];
+    if (cs.owner == 0) {
+        if (cs.migrating == k_no_node) {
+            return true;
+        }
+        size_t nkeys = 0, missing = 0;
+        for (size_t i = c->firstKey; i < end; i += c->keyStep) {
+            LookupKey key;
+            lookupKeyInit(&key, cmd[i]);
+            nkeys++;
+            missing += hmLookup(&gData.db, &key.node, &entryEq) ? 0 : 1;
+        }
+        if (missing == 0) {
+            return true;
+        } else if (missing < nkeys) {
+            outErr(out, ERR_TRYAGAIN, "TRYAGAIN multiple keys request during slot migration");
+            return false;
+        }
+        outErrRedirect(out, ERR_ASK, "ASK", slot, cs.migrating);
+        return false;
+    }
+    if (cs.importing != k_no_node && asking) {
+        return true;
+    }
+    outErrMoved(out, slot);
+    return false;
+}
+
+static void doRequest(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    const Command *c = lookupCommand(cmd);
+    if (!c) {
+        gStats.unknownCmds++;
+        // a transaction with a bad command does not run at all
+        if (conn->inMulti) {
+            conn->multiError = true;
+        }
+        return outErr(out, ERR_UNKNOWN, "unknown command");
+    }
+    // only good for the next command
+    bool asking = conn->asking;
+    conn->asking = false;
+    if (gConfig.clusterEnabled && c->firstKey && !clusterRoute(conn, c, cmd, out, asking)) {
+        if (conn->inMulti) {
+            conn->multiError = true;
+        }
+        return;
+    }
+    // a replica's data only changes by its primary
+    if ((c->flags & CMD_WRITE) && !gData.masterHost.empty() && conn->repl != REPL_CONN_MASTER) {
+        if (conn->inMulti) {
+            conn->multiError = true;
+        }
+        return outErr(out, ERR_BAD_ARG, "READONLY You can't write against a read only replica.");
+    }
+    if (conn->inMulti && !(c->flags & CMD_TXN)) {
+        conn->multiCmds.push_back(std::move(cmd));
+        return outStr(out, "QUEUED", 6);
+    }
+    cmdCall(conn, c, cmd, out);
+}
+
+static void unwatchAll(Conn *conn) {
+    for (const auto &w : conn->watched) {
+        LookupKey key;
+        lookupKeyInit(&key, w.first);
+        HNode *node = hmLookup(&gData.watching, &key.node, &watchedKeyEq);
+        assert(node);
+        WatchedKey *wk = container_of(node, WatchedKey, node);
+        auto it = std::find(wk->clients.begin(), wk->clients.end(), conn);
+        assert(it != wk->clients.end());
+        wk->clients.erase(it);
+        if (wk->clients.empty()) {
+            hmDelete(&gData.watching, &wk->node, &entrySame);
+            delete wk;
+        }
+    }
+    gData.watchedKeys -= conn->watched.size();
+    conn->watched.clear();
+    conn->watchDirty = false;
+}
+
+static void multiReset(Conn *conn) {
+    conn->inMulti = false;
+    conn->multiError = false;
+    conn->multiSlot = -1;
+    conn->multiCmds.clear();
+    unwatchAll(conn);
+}
+
+// MULTI, later commands are queued until EXEC or DISCARD
+static void doMulti(Conn *conn, std::vector<std::string> &, Buffer &out) {
+    if (conn->inMulti) {
+        return outErr(out, ERR_BAD_ARG, "MULTI calls can not be nested");
+    }
+    conn->inMulti = true;
+    return outNil(out);
+}
+
+// EXEC runs the queued commands back to back, nothing else runs in
+// between; the reply is an array of their replies. Nil instead if a
+// WATCHed key was written since WATCH, the caller retries.
+static void doExec(Conn *conn, std::vector<std::string> &, Buffer &out) {
+    if (!conn->inMulti) {
+        return outErr(out, ERR_BAD_ARG, "EXEC without MULTI");
+    }
+    if (conn->multiError) {
+        multiReset(conn);
+        return outErr(out, ERR_BAD_ARG, "transaction discarded because of previous errors");
+    }
+    bool changed = conn->watchDirty;
+    for (const auto &w : conn->watched) {
+        LookupKey key;
+        lookupKeyInit(&key, w.first);
+        HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+        uint32_t version = node ? container_of(node, Entry, node)->version : 0;
+        changed = changed || version != w.second;
+    }
+    // the slot may have moved away since the commands were queued
+    int32_t slot = conn->multiSlot;
+    std::vector<std::vector<std::string>> cmds;
+    cmds.swap(conn->multiCmds);
+    multiReset(conn);
+    if (changed) {
+        return outNil(out);
+    }
+    if (slot >= 0 && gData.cluster.slots[slot].owner != 0
+        && gData.cluster.slots[slot].importing == k_no_node)
+    {
+        return outErrMoved(out, slot);
+    }
+    // paused or blocked commands would let others in, see SlicedArr and
+    // listBlockingPop()
+    conn->inExec = true;
+    gData.replTxn = REPL_TXN_WANTED;
+    outArr(out, cmds.size());
+    for (std::vector<std::string> &cmd : cmds) {
+        cmdCall(conn, lookupCommand(cmd), cmd, out);
+    }
+    if (gData.replTxn == REPL_TXN_OPEN) {
+        gData.replTxn = REPL_TXN_NONE;
+        replFeed({"exec"});
+    }
+    gData.replTxn = REPL_TXN_NONE;
+    conn->inExec = false;
+}
+
+// DISCARD, drops the queued commands
+static void doDiscard(Conn *conn, std::vector<std::string> &, Buffer &out) {
+    if (!conn->inMulti) {
+        return outErr(out, ERR_BAD_ARG, "DISCARD without MULTI");
+    }
+    multiReset(conn);
+    return outNil(out);
+}
+
+// WATCH key [key ...], makes the next EXEC fail if any of them is
+// written before it
+static void doWatch(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (conn->inMulti) {
+        return outErr(out, ERR_BAD_ARG, "WATCH inside MULTI is not allowed");
+    }
+    for (size_t i = 1; i < cmd.size(); i++) {
+        LookupKey key;
+        lookupKeyInit(&key, cmd[i]);
+        HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+        uint32_t version = node ? container_of(node, Entry, node)->version : 0;
+        conn->watched.emplace_back(cmd[i], version);
+        gData.watchedKeys++;
+        node = hmLookup(&gData.watching, &key.node, &watchedKeyEq);
+        WatchedKey *wk = NULL;
+        if (node) {
+            wk = container_of(node, WatchedKey, node);
+        } else {
+            wk = new WatchedKey();
+            wk->node.hcode = key.node.hcode;
+            wk->key = cmd[i];
+            hmInsert(&gData.watching, &wk->node);
+        }
+        wk->clients.push_back(conn);
+    }
+    return outNil(out);
+}
+
+static void doUnwatch(Conn *conn, std::vector<std::string> &, Buffer &out) {
+    unwatchAll(conn);
+    return outNil(out);
+}
+
+static bool expectSlot(const std::string &arg, uint32_t &slot) {
+    int64_t v = 0;
+    if (!str2int(arg, v) || v < 0 || v >= (int64_t)k_cluster_slots) {
+        return false;
+    }
+    slot = (uint32_t)v;
+    return true;
+}
+
+// "<slot>" or "<first>-<last>"
+static bool expectSlotRange(const std::string &arg, uint32_t &first, uint32_t &last) {
+    size_t dash = arg.find('-');
+    if (dash == std::string::npos) {
+        return expectSlot(arg, first) && expectSlot(arg, last);
+    }
+    return expectSlot(arg.substr(0, dash), first) && expectSlot(arg.substr(dash + 1), last)
+        && first <= last;
+}
+
+// CLUSTER SETSLOT <slot>[-<last>] NODE|MIGRATING|IMPORTING <host:port>
+// CLUSTER SETSLOT <slot>[-<last>] STABLE
+static void clusterSetSlot(std::vector<std::string> &cmd, Buffer &out) {
+    Cluster &cl = gData.cluster;
+    uint32_t first = 0, last = 0;
+    if (cmd.size() < 4 || !expectSlotRange(cmd[2], first, last)) {
+        return outErr(out, ERR_BAD_ARG, "expect CLUSTER SETSLOT slot[-last] state [host:port]");
+    }
+    const std::string &state = cmd[3];
+    if (state == "stable" && cmd.size() == 4) {
+        for (uint32_t s = first; s <= last; s++) {
+            cl.slots[s].migrating = cl.slots[s].importing = k_no_node;
+        }
+        return outNil(out);
+    }
+    std::string host;
+    uint16_t port = 0;
+    if (cmd.size() != 5 || !clusterParseAddr(cmd[4], host, port)) {
+        return outErr(out, ERR_BAD_ARG, "expect host:port");
+    }
+    int32_t node = clusterNode(&cl, cmd[4]);
+    for (uint32_t s = first; s <= last; s++) {
+        bool ok = state == "node" || state == "migrating" || state == "importing";
+        if (state == "node" && node != 0 && cl.slots[s].owner == 0 && !gData.slotKeys[s].empty()) {
+            return outErr(out, ERR_BAD_ARG, "slot " + std::to_string(s) + " still has keys here");
+        } else if (state == "migrating" && (cl.slots[s].owner != 0 || node == 0)) {
+            ok = false;
+        } else if (state == "importing" && (cl.slots[s].owner == 0 || node == 0)) {
+            ok = false;
+        }
+        if (!ok) {
+            return outErr(out, ERR_BAD_ARG, "cannot set slot " + std::to_string(s) + " " + state);
+        }
+    }
+    for (uint32_t s = first; s <= last; s++) {
+        if (state == "node") {
+            // the end of a move
+            cl.slots[s] = ClusterSlot();
+            cl.slots[s].owner = node;
+        } else if (state == "migrating") {
+            cl.slots[s].migrating = node;
+        } else {
+            cl.slots[s].importing = node;
+        }
+    }
+    return outNil(out);
+}
+
+// CLUSTER SLOTS: [first, last, host:port] for each run of slots with one
+// owner
+static void clusterSlots(Buffer &out) {
+    const Cluster &cl = gData.cluster;
+    size_t ctx = outBeginArr(out);
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < k_cluster_slots;) {
+        uint32_t e = s;
+        while (e + 1 < k_cluster_slots && cl.slots[e + 1].owner == cl.slots[s].owner) {
+            e++;
+        }
+        if (cl.slots[s].owner != k_no_node) {
+            outArr(out, 3);
+            outInt(out, s);
+            outInt(out, e);
+            const std::string &addr = cl.nodes[cl.slots[s].owner];
+            outStr(out, addr.data(), addr.size());
+            n++;
+        }
+        s = e + 1;
+    }
+    outEndArr(out, ctx, n);
+}
+
+// CLUSTER KEYSLOT key | SLOTS | ADDSLOTSRANGE first last | SETSLOT ...
+//       | COUNTKEYSINSLOT slot | GETKEYSINSLOT slot count
+// Each node is told the whole slot map, see Cluster.
+static void doCluster(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (!gConfig.clusterEnabled) {
+        return outErr(out, ERR_BAD_ARG, "cluster support disabled");
+    }
+    Cluster &cl = gData.cluster;
+    const std::string &sub = cmd[1];
+    uint32_t slot = 0, last = 0;
+    int64_t count = 0;
+    if (sub == "keyslot" && cmd.size() == 3) {
+        return outInt(out, keyHashSlot(cmd[2].data(), cmd[2].size()));
+    } else if (sub == "slots" && cmd.size() == 2) {
+        return clusterSlots(out);
+    } else if (sub == "setslot") {
+        return clusterSetSlot(cmd, out);
+    } else if (sub == "addslotsrange" && cmd.size() == 4) {
+        if (!expectSlot(cmd[2], slot) || !expectSlot(cmd[3], last) || slot > last) {
+            return outErr(out, ERR_BAD_ARG, "expect slot range");
+        }
+        for (uint32_t s = slot; s <= last; s++) {
+            if (cl.slots[s].owner != k_no_node) {
+                return outErr(out, ERR_BAD_ARG, "slot " + std::to_string(s) + " is already assigned");
+            }
+        }
+        for (uint32_t s = slot; s <= last; s++) {
+            cl.slots[s].owner = 0;
+        }
+        return outNil(out);
+    } else if (sub == "countkeysinslot" && cmd.size() == 3) {
+        if (!expectSlot(cmd[2], slot)) {
+            return outErr(out, ERR_BAD_ARG, "expect slot");
+        }
+        return outInt(out, (int64_t)gData.slotKeys[slot].size());
+    } else if (sub == "getkeysinslot" && cmd.size() == 4) {
+        if (!expectSlot(cmd[2], slot) || !str2int(cmd[3], count) || count < 0) {
+            return outErr(out, ERR_BAD_ARG, "expect slot and count");
+        }
+        const std::vector<Entry *> &keys = gData.slotKeys[slot];
+        size_t n = std::min(keys.size(), (size_t)count);
+        outArr(out, n);
+        for (size_t i = 0; i < n; i++) {
+            outStr(out, keys[i]->key, keys[i]->klen);
+        }
+        return;
+    }
+    return outErr(out, ERR_BAD_ARG, "unknown CLUSTER subcommand");
+}
+
+// ASKING: the next command may use a slot this node is importing
+static void doAsking(Conn *conn, std::vector<std::string> &, Buffer &out) {
+    if (!gConfig.clusterEnabled) {
+        return outErr(out, ERR_BAD_ARG, "cluster support disabled");
+    }
+    conn->asking = true;
+    return outNil(out);
+}
+
+// Values move between nodes as the write commands that rebuild them, in
+// the request framing and without the key: RESTORE runs them on a new
+// key through the regular handlers, which pick the encodings.
+static const char *const k_restore_cmds[] = {"set", "rpush", "sadd", "hset", "zadd"};
+
+// items per rebuilding command
+const size_t k_dump_batch = 256;
+
+struct DumpWriter {
+    std::string *payload;
+    const char *name;
+    std::vector<std::string> args;
+};
+
+static void dumpFlush(DumpWriter *w) {
+    if (w->args.empty()) {
+        return;
+    }
+    uint32_t len = 4 + 4 + (uint32_t)strlen(w->name);
+    for (const std::string &a : w->args) {
+        len += 4 + (uint32_t)a.size();
+    }
+    uint32_t nstr = 1 + (uint32_t)w->args.size();
+    w->payload->append((const char *)&len, 4);
+    w->payload->append((const char *)&nstr, 4);
+    uint32_t size = (uint32_t)strlen(w->name);
+    w->payload->append((const char *)&size, 4);
+    w->payload->append(w->name, size);
+    for (const std::string &a : w->args) {
+        size = (uint32_t)a.size();
+        w->payload->append((const char *)&size, 4);
+        w->payload->append(a);
+    }
+    w->args.clear();
+}
+
+static void dumpItem(DumpWriter *w, const char *a, size_t alen, const char *b, size_t blen) {
+    w->args.emplace_back(a, alen);
+    if (b) {
+        w->args.emplace_back(b, blen);
+    }
+    if (w->args.size() >= k_dump_batch * (b ? 2 : 1)) {
+        dumpFlush(w);
+    }
+}
+
+static bool cbDumpHash(const char *field, size_t flen, const char *val, size_t vlen, void *arg) {
+    dumpItem((DumpWriter *)arg, field, flen, val, vlen);
+    return true;
+}
+
+static bool cbDumpSet(const char *member, size_t len, void *arg) {
+    dumpItem((DumpWriter *)arg, member, len, NULL, 0);
+    return true;
+}
+
+static void entryDump(Entry *ent, std::string &payload) {
+    DumpWriter w = {&payload, NULL, {}};
+    if (ent->type == T_STR) {
+        char buf[k_int_str_max];
+        size_t len = 0;
+        const char *val = entryStr(ent, buf, &len);
+        w.name = "set";
+        dumpItem(&w, val, len, NULL, 0);
+    } else if (ent->type == T_LIST) {
+        w.name = "rpush";
+        QLIter it;
+        const char *val = NULL;
+        size_t len = 0;
+        for (bool ok = qlIndex(ent->list, 0, &it); ok && qlNext(&it, &val, &len);) {
+            dumpItem(&w, val, len, NULL, 0);
+        }
+    } else if (ent->type == T_SET) {
+        w.name = "sadd";
+        sobjForEach(&ent->set, &cbDumpSet, &w);
+    } else if (ent->type == T_HASH) {
+        w.name = "hset";
+        hobjForEach(&ent->hash, &cbDumpHash, &w);
+    } else if (ent->type == T_ZSET) {
+        // ZADD takes one member, and the score as text that reads back
+        // to the same double
+        w.name = "zadd";
+        ZNode *znode = zsetSeekge(ent->zset, -INFINITY, "", 0);
+        for (; znode; znode = znodeOffset(znode, +1)) {
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%.17g", znode->score);
+            dumpItem(&w, buf, (size_t)n, znode->name, znode->len);
+            dumpFlush(&w);
+        }
+    }
+    dumpFlush(&w);
+}
+
+// the remaining TTL, 0 for none
+static int64_t entryTtlMs(Entry *ent) {
+    if (ent->heapIdx == (size_t)-1) {
+        return 0;
+    }
+    uint64_t expireAt = gData.heap[ent->heapIdx].val;
+    uint64_t nowMs = getMonotonicMs();
+    return expireAt > nowMs ? (int64_t)(expireAt - nowMs) : 1;
+}
+
+// DUMP key, the value for RESTORE; nil for a missing key
+static void doDump(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    Entry *ent = dbLookupRead(&key);
+    if (!ent) {
+        return outNil(out);
+    }
+    std::string payload;
+    entryDump(ent, payload);
+    return outStr(out, payload.data(), payload.size());
+}
+
+static bool isRestoreCmd(const std::string &name) {
+    for (const char *c : k_restore_cmds) {
+        if (name == c) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// RESTORE key ttl_ms payload, ttl 0 for none; the key must not exist
+static void doRestore(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    int64_t ttlMs = 0;
+    if (!str2int(cmd[2], ttlMs) || ttlMs < 0) {
+        return outErr(out, ERR_BAD_ARG, "expect ttl to be a positive number");
+    }
+    LookupKey key;
+    lookupKeyInit(&key, cmd[1]);
+    if (hmLookup(&gData.db, &key.node, &entryEq)) {
+        return outErr(out, ERR_BAD_ARG, "BUSYKEY target key name already exists");
+    }
+    const uint8_t *curr = (const uint8_t *)cmd[3].data();
+    const uint8_t *end = curr + cmd[3].size();
+    bool ok = curr < end;
+    Buffer scratch;
+    while (ok && curr < end) {
+        uint32_t len = 0;
+        std::vector<std::string> sub;
+        ok = readUInt32(curr, end, len) && len <= (size_t)(end - curr)
+            && parseRequest(curr, len, sub) == 0 && !sub.empty() && isRestoreCmd(sub[0]);
+        curr += ok ? len : 0;
+        if (ok) {
+            sub.insert(sub.begin() + 1, cmd[1]);
+            const Command *c = lookupCommand(sub);
+            scratch.clear();
+            ok = c && (c->fn(conn, sub, scratch), scratch[0] != TAG_ERR);
+        }
+    }
+    Entry *ent = dbLookup(&key);
+    if (!ok) {
+        if (ent) {
+            dbDelete(ent);
+        }
+        return outErr(out, ERR_BAD_ARG, "bad payload");
+    }
+    if (ent && ttlMs > 0) {
+        entrySetTTL(ent, ttlMs);
+    }
+    return outNil(out);
+}
+
+// Blocking I/O with the target of MIGRATE, until `deadlineMs`
+static bool syncWait(int fd, short events, uint64_t deadlineMs) {
+    uint64_t now = getMonotonicMs();
+    if (now >= deadlineMs) {
+        return false;
+    }
+    struct pollfd pfd = {fd, events, 0};
+    int rv = poll(&pfd, 1, (int)(deadlineMs - now));
+    return rv == 1 && !(pfd.revents & (POLLERR | POLLNVAL));
+}
+
+static int syncConnect(const std::string &host, uint16_t port, uint64_t deadlineMs) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    fd_set_nb(fd);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if (rv < 0 && (errno != EINPROGRESS || !syncWait(fd, POLLOUT, deadlineMs)
+        || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool syncWrite(int fd, const std::string &data, uint64_t deadlineMs) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t rv = write(fd, data.data() + done, data.size() - done);
+        if (rv > 0) {
+            done += (size_t)rv;
+        } else if (rv < 0 && errno == EAGAIN) {
+            if (!syncWait(fd, POLLOUT, deadlineMs)) {
+                return false;
+            }
+        } else if (rv < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one reply message, the tag and what follows
+static bool syncReadReply(int fd, std::string &buf, std::string &reply, uint64_t deadlineMs) {
+    while (true) {
+        uint32_t len = 0;
+        if (buf.size() >= 4) {
+            memcpy(&len, buf.data(), 4);
+            if (len > k_max_msg) {
+                return false;
+            }
+            if (buf.size() >= 4 + (size_t)len) {
+                reply = buf.substr(4, len);
+                buf.erase(0, 4 + (size_t)len);
+                return len > 0;
+            }
+        }
+        char tmp[64 << 10];
+        ssize_t rv = read(fd, tmp, sizeof(tmp));
+        if (rv > 0) {
+            buf.append(tmp, (size_t)rv);
+        } else if (rv == 0 || (errno != EAGAIN && errno != EINTR)) {
+            return false;
+        } else if (errno == EAGAIN && !syncWait(fd, POLLIN, deadlineMs)) {
+            return false;
+        }
+    }
+}
+
+// MIGRATE host port timeout_ms key [key ...]
+// Moves keys to another node, e.g. the keys of a slot being migrated:
+// an ASKING + RESTORE each, deleted here once the target took them.
+// Missing keys are skipped. Like in Redis the event loop waits for the
+// target, up to timeout_ms. Returns the number of keys moved.
+static void doMigrate(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    std::string host;
+    uint16_t port = 0;
+    int64_t timeoutMs = 0;
+    if (!clusterParseAddr(cmd[1] + ":" + cmd[2], host, port)) {
+        return outErr(out, ERR_BAD_ARG, "expect host and port");
+    }
+    if (!str2int(cmd[3], timeoutMs) || timeoutMs <= 0) {
+        return outErr(out, ERR_BAD_ARG, "expect timeout in milliseconds");
+    }
+    // replicas get the deletes, not the move
+    replInstead();
+    std::string data;
+    std::vector<std::string> sent;
+    for (size_t i = 4; i < cmd.size(); i++) {
+        LookupKey key;
+        lookupKeyInit(&key, cmd[i]);
+        HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
+        if (!node) {
+            continue;
+        }
+        Entry *ent = container_of(node, Entry, node);
+        std::string payload;
+        entryDump(ent, payload);
+        appendRequest(data, {"asking"});
+        appendRequest(data, {"restore", cmd[i], std::to_string(entryTtlMs(ent)), payload});
+        sent.push_back(cmd[i]);
+    }
+    if (sent.empty()) {
+        return outInt(out, 0);
+    }
+    uint64_t deadlineMs = getMonotonicMs() + (uint64_t)timeoutMs;
+    int fd = syncConnect(host, port, deadlineMs);
+    if (fd < 0) {
+        return outErr(out, ERR_BAD_ARG, "IOERR cannot connect to target");
+    }
+    bool ioOk = syncWrite(fd, data, deadlineMs);
+    std::string buf, reply, firstErr;
+    int64_t moved = 0;
+    for (size_t i = 0; ioOk && i < sent.size(); i++) {
+        // ASKING is refused by a node without cluster mode, RESTORE then
+        // works all the same
+        ioOk = syncReadReply(fd, buf, reply, deadlineMs)
+            && syncReadReply(fd, buf, reply, deadlineMs);
+        if (!ioOk) {
+            break;
+        }
+        if (reply[0] != TAG_NIL) {
+            if (firstErr.empty() && reply[0] == TAG_ERR && reply.size() >= 9) {
+                firstErr = "target: " + reply.substr(9);
+            }
+            continue;
+        }
+        LookupKey key;
+        lookupKeyInit(&key, sent[i]);
+        if (Entry *ent = dbLookup(&key)) {
+            dbDelete(ent);
+            replAlso({"del", sent[i]});
+            trackingInvalidate(conn, sent[i].data(), sent[i].size());
+            moved++;
+        }
     }
-    return outNil(out);
-}
-
-static void doDel(std::vector<std::string> &cmd, Buffer &out) {
-    LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
-    HNode *node = hmDelete(&gData.db, &key.node, &entryEq);
-    if (node) {
-        entryDel(container_of(node, Entry, node));
-    } else {
-        outErr(out, ERR_UNKNOWN, "key not found");
+    close(fd);
+    if (!ioOk) {
+        return outErr(out, ERR_BAD_ARG, "IOERR error or timeout talking to target");
+    }
+    if (!firstErr.empty()) {
+        return outErr(out, ERR_BAD_ARG, firstErr);
     }
-    return outInt(out, node ? 1 : 0);
+    return outInt(out, moved);
 }
 
-static bool cbKeys(HNode *node, void *arg) {
-    Buffer &out = *(Buffer *)arg;
-    const std::string &key = container_of(node, Entry, node)->key;
-    outStr(out, key.data(), key.size());
+// Replication. A replica sends PSYNC <replid> <offset>, the last stream
+// position it has. If the backlog still holds the stream from there, the
+// reply is CONTINUE and the rest follows. Otherwise it is FULLRESYNC
+// <replid> <offset> <bytes>: a snapshot of <bytes> bytes of RESTORE
+// requests, then the stream from <offset>. There is no fork() here, the
+// snapshot is taken right away, the event loop waits for it.
+const uint64_t k_repl_connect_timeout_ms = 500;
+const uint64_t k_repl_retry_ms = 1000;
+
+static bool cbCollectEntry(HNode *node, void *arg) {
+    ((std::vector<Entry *> *)arg)->push_back(container_of(node, Entry, node));
     return true;
 }
 
-static void doKeys(std::vector<std::string> &, Buffer &out) {
-    outArr(out, (uint32_t)hmSize(&gData.db));
-    hmForEach(&gData.db, &cbKeys, (void *) &out);
+static void replSnapshot(Buffer &out) {
+    std::vector<Entry *> ents;
+    hmForEach(&gData.db, &cbCollectEntry, &ents);
+    std::string req, payload;
+    for (Entry *ent : ents) {
+        payload.clear();
+        entryDump(ent, payload);
+        req.clear();
+        appendRequest(req, {"restore", std::string(ent->key, ent->klen),
+            std::to_string(entryTtlMs(ent)), payload});
+        bufAppend(out, (const uint8_t *)req.data(), req.size());
+    }
 }
 
-// PEXPIRE key ttl_ms
-static void doExpire(std::vector<std::string> &cmd, Buffer &out) {
-    int64_t ttlMs = 0;
-    if (!str2int(cmd[2], ttlMs)) {
-        return outErr(out, ERR_BAD_ARG, "expect ttl to be number");
+// PSYNC replid offset, the stream itself starts in replAttach()
+static void doPsync(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    if (!gData.masterHost.empty()) {
+        return outErr(out, ERR_BAD_ARG, "PSYNC not served by a replica");
     }
-    LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    if (node) {
-        Entry *ent = container_of(node, Entry, node);
-        entrySetTTL(ent, ttlMs);
+    if (conn->inExec || conn->repl != REPL_CONN_NONE) {
+        return outErr(out, ERR_BAD_ARG, "PSYNC not allowed here");
+    }
+    if (!replActive()) {
+        backlogInit(&gData.backlog, (size_t)gConfig.replBacklogSize);
+    }
+    int64_t offset = -1;
+    std::string tail;
+    if (cmd[1] == gData.replid) {
+        if (str2int(cmd[2], offset) && offset >= 0
+            && backlogRead(&gData.backlog, (uint64_t)offset, tail))
+        {
+            gStats.syncPartialOk++;
+            conn->replSync.assign(tail.begin(), tail.end());
+            conn->repl = REPL_CONN_SYNC;
+            return outStr(out, "CONTINUE", 8);
+        }
+        gStats.syncPartialErr++;
     }
-    return outInt(out, node ? 1 : 0);
+    gStats.syncFull++;
+    uint64_t start = getMonotonicNs();
+    replSnapshot(conn->replSync);
+    fprintf(stderr, "full resync: %zu keys, %zu bytes in %.1f ms\n", hmSize(&gData.db),
+        conn->replSync.size(), (double)(getMonotonicNs() - start) / 1e6);
+    conn->repl = REPL_CONN_SYNC;
+    std::string reply = "FULLRESYNC " + gData.replid + " "
+        + std::to_string(gData.backlog.offset) + " " + std::to_string(conn->replSync.size());
+    return outStr(out, reply.data(), reply.size());
 }
 
-// PTTL key
-static void doTtl(std::vector<std::string> &cmd, Buffer &out) {
-    LookupKey key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = strHash((uint8_t *)key.key.data(), key.key.size());
-    HNode *node = hmLookup(&gData.db, &key.node, &entryEq);
-    if (!node) {
-        return outInt(out, -2);
+// after the PSYNC reply: what it promised, then the writes as they come
+static void replAttach(Conn *conn) {
+    connSeal(conn);
+    if (!conn->replSync.empty()) {
+        outqPushOwn(conn, std::move(conn->replSync));
+        conn->replSync = Buffer();
     }
+    conn->wantWrite = true;
+    conn->repl = REPL_CONN_REPLICA;
+    gData.replicas.push_back(conn);
+    // quiet for as long as nothing is written
+    dlistDetach(&conn->idleNode);
+    dlistInit(&conn->idleNode);
+}
 
-    Entry *ent = container_of(node, Entry, node);
-    if (ent->heapIdx == (size_t)-1) {
-        return outInt(out, -1);
+static void replDetach(Conn *conn) {
+    if (conn->repl == REPL_CONN_REPLICA) {
+        std::vector<Conn *> &r = gData.replicas;
+        r.erase(std::find(r.begin(), r.end(), conn));
+    }
+    if (conn == gData.masterConn) {
+        msg("lost the link to the primary");
+        gData.masterConn = NULL;
+        gData.replRetryMs = getMonotonicMs() + k_repl_retry_ms;
     }
-    uint64_t expireAt = gData.heap[ent->heapIdx].val;
-    uint64_t nowMs = getMonotonicMs();
-    return outInt(out, expireAt > nowMs ? (int64_t)(expireAt - nowMs) : 0);
 }
 
-static void responseBegin(Buffer &out, size_t *headerPos) {
-    *headerPos = out.size();
-    bufAppendU32(out, 0);
+static void uringArmRecv(Conn *conn);
+
+// Replica: the link to the primary is a connection like the clients',
+// whose requests come from the primary and whose replies are dropped.
+// Like MIGRATE, the connect() blocks, up to k_repl_connect_timeout_ms.
+static void replConnect() {
+    int fd = syncConnect(gData.masterHost, gData.masterPort,
+        getMonotonicMs() + k_repl_connect_timeout_ms);
+    if (fd < 0) {
+        msg("cannot connect to the primary");
+        gData.replRetryMs = getMonotonicMs() + k_repl_retry_ms;
+        return;
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(gData.masterPort);
+    inet_pton(AF_INET, gData.masterHost.c_str(), &addr.sin_addr);
+    Conn *conn = connNew(fd, addr);
+    dlistDetach(&conn->idleNode);
+    dlistInit(&conn->idleNode);
+    conn->repl = REPL_CONN_HANDSHAKE;
+    gData.masterConn = conn;
+    // a replid the primary does not know gets a full resync
+    std::string req;
+    appendRequest(req, {"psync", gData.replid, std::to_string(gData.backlog.offset)});
+    bufAppend(conn->outgoing, (const uint8_t *)req.data(), req.size());
+    conn->wantWrite = true;
+    if (gData.uring) {
+        uringArmRecv(conn);
+    }
 }
 
-static size_t responseSize(Buffer &out, size_t header) {
-    return out.size() - header - 4;
+// a full resync starts from nothing
+static void replFlushDb() {
+    trackingInvalidateAll();
+    std::vector<Entry *> ents;
+    hmForEach(&gData.db, &cbCollectEntry, &ents);
+    for (Entry *ent : ents) {
+        dbDelete(ent);
+    }
 }
 
-static void responseEnd(Buffer &out, size_t header) {
-    size_t size = responseSize(out, header);
-    if (size > k_max_msg) {
-        out.resize(header + 4);
-        outErr(out, ERR_TOO_BIG, "response is too big");
-        size = responseSize(out, header);
+static void replOnPsyncReply(Conn *conn, const uint8_t *data, size_t len) {
+    uint32_t size = 0;
+    if (len < 5 || data[0] != TAG_STR || (memcpy(&size, data + 1, 4), size != len - 5)) {
+        msg("bad PSYNC reply");
+        conn->wantClose = true;
+        return;
     }
-    // message header
-    uint32_t len = (uint32_t)size;
-    memcpy(&out[header], &len, 4);   
+    std::string reply((const char *)data + 5, size);
+    char replid[41] = {};
+    unsigned long long offset = 0, snapshot = 0;
+    if (reply == "CONTINUE") {
+        msg("partial resync with the primary");
+    } else if (sscanf(reply.c_str(), "FULLRESYNC %40s %llu %llu", replid, &offset, &snapshot) == 3) {
+        fprintf(stderr, "full resync with the primary: %llu bytes\n", snapshot);
+        replFlushDb();
+        gData.replid = replid;
+        gData.backlog.offset = offset;
+        gData.replSnapshotLeft = snapshot;
+    } else {
+        msg("bad PSYNC reply");
+        conn->wantClose = true;
+        return;
+    }
+    conn->repl = REPL_CONN_MASTER;
 }
 
+// a request of the primary ran, `n` bytes of the stream
+static void replApplied(Conn *conn, size_t n) {
+    if (gData.replSnapshotLeft > 0) {
+        gData.replSnapshotLeft -= std::min((uint64_t)n, gData.replSnapshotLeft);
+        return;
+    }
+    // a reconnect resumes before a MULTI whose EXEC did not come
+    conn->replPendingBytes += n;
+    if (!conn->inMulti) {
+        gData.backlog.offset += conn->replPendingBytes;
+        conn->replPendingBytes = 0;
+    }
+}
 
-static void doRequest(std::vector<std::string> &cmd, Buffer &out) {
-    if (cmd.size() == 2 && cmd[0] == "get") {
-        return doGet(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "set") {
-        return doSet(cmd, out);
-    } else if (cmd.size() == 2 && cmd[0] == "del") {
-        return doDel(cmd, out);
-    } else if (cmd.size() == 1 && cmd[0] == "keys") { 
-        return doKeys(cmd, out);
-    } else if (cmd.size() == 4 && cmd[0] == "zadd") {
-        return doZAdd(cmd, out);
-    } else if (cmd.size() == 6 && cmd[0] == "zquery") {
-        return doZQuery(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "zscore") {
-        return doZScore(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "zrem") {
-        return doZRem(cmd, out);
-    } else if (cmd.size() == 3 && cmd[0] == "pexpire") {
-        return doExpire(cmd, out);
-    } else if (cmd.size() == 2 && cmd[0] == "pttl") {
-        return doTtl(cmd, out);
-    } else {
-        return outErr(out, ERR_UNKNOWN, "unknown command");
+// REPLICAOF host port, or REPLICAOF NO ONE to stop replicating. A replica
+// keeps no backlog and feeds no replicas of its own.
+static void doReplicaof(Conn *conn, std::vector<std::string> &cmd, Buffer &out) {
+    std::string host;
+    uint16_t port = 0;
+    bool none = !strcasecmp(cmd[1].c_str(), "no") && !strcasecmp(cmd[2].c_str(), "one");
+    if (!none && !clusterParseAddr(cmd[1] + ":" + cmd[2], host, port)) {
+        return outErr(out, ERR_BAD_ARG, "expect host and port, or NO ONE");
+    }
+    if (host == gData.masterHost && port == gData.masterPort) {
+        return outNil(out);
+    }
+    // closed at the end of the iteration, see processPending()
+    if (gData.masterConn) {
+        gData.masterConn->wantClose = true;
+        connQueuePending(gData.masterConn);
+        gData.masterConn = NULL;
+    }
+    gData.masterHost = host;
+    gData.masterPort = port;
+    if (none) {
+        // a history of its own from here on
+        gData.replid = replNewId();
+        msg("replication stopped, now a primary");
+        return outNil(out);
     }
+    for (Conn *r : gData.replicas) {
+        r->wantClose = true;
+        connQueuePending(r);
+    }
+    backlogInit(&gData.backlog, 0);
+    gData.replRetryMs = 0;
+    return outNil(out);
 }
 
 static bool tryOneRequest(Conn *conn) {
+    // a blocked client's later requests wait for its reply, the same
+    // for one with a paused command
+    if (conn->blocked || conn->task.paused() || conn->wantClose) {
+        return false;
+    }
+    // a replica only listens
+    if (conn->repl == REPL_CONN_REPLICA) {
+        connInConsume(conn, connInBytes(conn));
+        return false;
+    }
     // 3. Try to parse the accumulated buffer.
     // Protocol: message header
-    if (conn->incoming.size() < 4) {
+    if (connInBytes(conn) < 4) {
         return false;
     }
     uint32_t len = 0;
-    memcpy(&len, conn->incoming.data(), 4);
+    memcpy(&len, connInData(conn), 4);
     if (len > k_max_msg) {
         conn->wantClose = true;
         return false;
     }
     // Protocol: message body
-    if (conn->incoming.size() < 4 + len) {
+    if (connInBytes(conn) < 4 + len) {
+        return false;
+    }
+    if (conn->repl == REPL_CONN_HANDSHAKE) {
+        replOnPsyncReply(conn, connInData(conn) + 4, len);
+        connInConsume(conn, 4 + len);
+        return !conn->wantClose;
+    }
+    if (connThrottle(conn)) {
         return false;
     }
-    const uint8_t *request = &conn->incoming[4];
+    const uint8_t *request = connInData(conn) + 4;
     std::vector<std::string> cmd;
     if (parseRequest(request, len, cmd) < 0) {
         msg("bad req");
@@ -653,18 +4948,102 @@ static bool tryOneRequest(Conn *conn) {
     // 4. Process the parsed message
     // generate the response
     size_t headerPos = 0;
+    size_t firstRef = conn->outRefs.size();
     responseBegin(conn->outgoing, &headerPos);
-    doRequest(cmd, conn->outgoing);
-    responseEnd(conn->outgoing, headerPos);
+    conn->replyHeader = headerPos;
+    doRequest(conn, cmd, conn->outgoing);
+    if (conn->repl == REPL_CONN_MASTER) {
+        // the primary gets no replies
+        connDropRefs(conn, firstRef);
+        conn->outgoing.resize(headerPos);
+        replApplied(conn, 4 + len);
+    } else if (conn->blocked) {
+        // parked, connWake() writes the reply
+        connDropRefs(conn, firstRef);
+        conn->outgoing.resize(headerPos);
+    } else if (!conn->task.paused()) {
+        // a reply cut into messages ends in one that starts later
+        connResponseEnd(conn, conn->replyHeader, firstRef);
+        connCheckOutput(conn);
+        if (conn->repl == REPL_CONN_SYNC) {
+            replAttach(conn);
+        }
+    }
 
     // 5. Remove the message from conn->incoming.
-    bufConsume(conn->incoming, 4 + len);
-    return true;
+    connInConsume(conn, 4 + len);
+    return !conn->blocked && !conn->task.paused() && !conn->wantClose;
+}
+
+static void connTouch(Conn *conn) {
+    conn->lastActiveMs = getMonotonicMs();
+    if (!conn->blocked && !connSubscribed(conn) && conn->repl == REPL_CONN_NONE) {
+        dlistDetach(&conn->idleNode);
+        dlistInsertBefore(&gData.idleList, &conn->idleNode);
+    }
+}
+
+// Run a paused command to its next pause or to its end, then the end of
+// its reply is due. False while it is still paused.
+static bool connResumeTask(Conn *conn) {
+    // busy, not idle, even if nothing is sent for a while
+    connTouch(conn);
+    conn->task.resume();
+    if (conn->task.paused()) {
+        return false;
+    }
+    conn->task.reset();
+    responseEnd(conn->outgoing, conn->replyHeader);
+    connCheckOutput(conn);
+    trackingFlush(conn);
+    return !conn->wantClose;
+}
+
+// a whole request is buffered
+static bool connRequestReady(Conn *conn) {
+    if (connInBytes(conn) < 4) {
+        return false;
+    }
+    uint32_t len = 0;
+    memcpy(&len, connInData(conn), 4);
+    return connInBytes(conn) >= 4 + (size_t)len;
+}
+
+// Run the buffered requests, up to the per-iteration budget. A deep
+// pipeline or a run of slow commands would otherwise hold up every other
+// client; what is left waits in gData.deferred for the next iteration.
+static void connRunRequests(Conn *conn) {
+    if (conn->deferred) {
+        return;  // already used its turn
+    }
+    if (conn->task.paused()) {
+        if (conn->taskWaitsDrain || !connResumeTask(conn)) {
+            return;
+        }
+    }
+    uint64_t start = getMonotonicNs();
+    int64_t n = 0;
+    while (tryOneRequest(conn)) {
+        n++;
+        bool outOfBudget = (gConfig.requestBudget > 0 && n >= gConfig.requestBudget)
+            || (gConfig.requestBudgetUs > 0
+                && getMonotonicNs() - start >= (uint64_t)gConfig.requestBudgetUs * 1000);
+        if (outOfBudget && connRequestReady(conn)) {
+            connDefer(conn);
+            gStats.budgetExhausted++;
+            return;
+        }
+    }
 }
 
+const size_t k_max_iov = 64;
+
 static void handleWrite(Conn *conn) {
-    assert(conn->outgoing.size() > 0);
-    ssize_t rv = write(conn->fd, &conn->outgoing[0], conn->outgoing.size());
+    connSeal(conn);
+    assert(conn->outqBytes > conn->outHead);
+    struct iovec iov[k_max_iov];
+    size_t n = connOutIov(conn, iov, k_max_iov);
+    ssize_t rv = writev(conn->fd, iov, (int)n);
     if (rv < 0 && errno == EAGAIN) {
         return; 
     }
@@ -673,15 +5052,41 @@ static void handleWrite(Conn *conn) {
         conn->wantClose = true;
         return;
     }
-    // remove written data from conn->outgoing
-    bufConsume(conn->outgoing, (size_t)rv);
+    gStats.bytesOut += (size_t)rv;
+    // drop the written chunks, no memmove of what is left
+    outqConsume(conn, (size_t)rv);
+    connOnDrain(conn);
     // update readiness intention
-    if (conn->outgoing.size() == 0) {
+    if (connOutBytes(conn) == 0) {
         conn->wantWrite = false;
         conn->wantRead = true;
     }
 }
 
+static void handleEOF(Conn *conn) {
+    if (connInBytes(conn) == 0) {
+        msg("client closed");
+    } else {
+        msg("unexpected EOF");
+    }
+    conn->wantClose = true;
+}
+
+static void handleData(Conn *conn, const uint8_t *data, size_t size) {
+    gStats.bytesIn += size;
+    // Requests are parsed in place, the front of a deep buffer (a long
+    // pipeline, a replica loading a snapshot) is dropped once it is half
+    // of it, not one request at a time
+    if (conn->inHead > 0 && conn->inHead >= conn->incoming.size() / 2) {
+        bufConsume(conn->incoming, conn->inHead);
+        conn->inHead = 0;
+    }
+    // 2. Add new data to the Conn->incoming buf
+    bufAppend(conn->incoming, data, size);
+    // 3. Try to parse the accumulated buffer.
+    connRunRequests(conn);
+}
+
 static void handleRead(Conn *conn) {
     // 1. Do a non-blocking read
     uint8_t buf[64 * 1024];
@@ -697,20 +5102,11 @@ static void handleRead(Conn *conn) {
     }
     // handle EOF
     if (rv == 0) {
-        if (conn->incoming.size() == 0) {
-            msg("client closed");
-        } else {
-            msg("unexpected EOF");
-        }
-        conn->wantClose = true;
-        return;
+        return handleEOF(conn);
     }
-    // 2. Add new data to the Conn->incoming buf
-    bufAppend(conn->incoming, buf, (size_t)rv);
-    // 3. Try to parse the accumulated buffer.
-    while (tryOneRequest(conn)) {}
+    handleData(conn, buf, (size_t)rv);
     // update readiness intention
-    if (conn->outgoing.size() > 0) {
+    if (connOutBytes(conn) > 0) {
         conn->wantWrite = true;
         conn->wantRead = false;
         return handleWrite(conn);
@@ -718,6 +5114,10 @@ static void handleRead(Conn *conn) {
 }
 
 static int32_t nextTimerMs() {
+    // requests left over from the last iteration
+    if (!dlistEmpty(&gData.pending)) {
+        return 0;
+    }
     uint32_t nowMs = getMonotonicMs();
     // max val since this is unsigned
     uint64_t nextMs = (uint64_t)-1;
@@ -726,10 +5126,18 @@ static int32_t nextTimerMs() {
         Conn *conn = container_of(gData.idleList.next, Conn, idleNode);
         nextMs = conn->lastActiveMs + k_idle_timeout_ms;
     }
-    // TTL timers on DB
-    if (!gData.heap.empty() && gData.heap[0].val <= nextMs) {
+    // TTL timers on DB, a replica leaves expiry to its primary
+    if (gData.masterHost.empty() && !gData.heap.empty() && gData.heap[0].val <= nextMs) {
         nextMs = gData.heap[0].val;
     }
+    // reconnecting to the primary
+    if (!gData.masterHost.empty() && !gData.masterConn && gData.replRetryMs <= nextMs) {
+        nextMs = gData.replRetryMs;
+    }
+    // timeouts of blocked clients
+    if (!gData.blockHeap.empty() && gData.blockHeap[0].val <= nextMs) {
+        nextMs = gData.blockHeap[0].val;
+    }
     // timeout value
     if (nextMs == (uint64_t)-1) {
         return -1;
@@ -740,8 +5148,44 @@ static int32_t nextTimerMs() {
     return (int32_t)(nextMs - nowMs);
 }
 
+// The clients deferred by connRunRequests() last iteration get a new
+// budget in this one's processPending().
+static void resumeDeferred() {
+    while (!dlistEmpty(&gData.deferred)) {
+        DList *node = gData.deferred.next;
+        dlistDetach(node);
+        dlistInsertBefore(&gData.pending, node);
+    }
+}
+
+// Run the requests that queued up behind a blocking pop, while the
+// client was throttled or out of budget, and close the clients marked
+// for it.
+static void processPending() {
+    while (!dlistEmpty(&gData.pending)) {
+        Conn *conn = container_of(gData.pending.next, Conn, pendingNode);
+        dlistDetach(&conn->pendingNode);
+        dlistInit(&conn->pendingNode);
+        conn->deferred = false;
+        trackingFlush(conn);
+        connRunRequests(conn);
+        if (conn->wantClose) {
+            connDestroy(conn);
+        } else if (connOutBytes(conn) > 0) {
+            conn->wantWrite = true;
+            conn->wantRead = false;
+        }
+    }
+}
+
 static void processTimers() {
     uint64_t nowMs = getMonotonicMs();
+    // blocked clients that timed out get a nil
+    while (!gData.blockHeap.empty() && gData.blockHeap[0].val <= nowMs) {
+        Conn *conn = container_of(gData.blockHeap[0].ref, Conn, blockHeapIdx);
+        connUnblock(conn);
+        connWake(conn, NULL, 0, NULL);
+    }
     // idle timers from clients
     while (!dlistEmpty(&gData.idleList)) {
         Conn *conn = container_of(gData.idleList.next, Conn, idleNode);
@@ -752,41 +5196,239 @@ static void processTimers() {
         fprintf(stderr, "removing idle connection: %d\n", conn->fd);
         connDestroy(conn);
     }
+    if (!gData.masterHost.empty()) {
+        if (!gData.masterConn && gData.replRetryMs <= nowMs) {
+            replConnect();
+        }
+        return;
+    }
     // TTL timers for DB entries
     const std::vector<HeapItem> &heap = gData.heap;
     const size_t kMaxWorks = 2000;
     size_t nworks = 0;
     while (!heap.empty() && heap[0].val <= nowMs && nworks++ < kMaxWorks) {
         Entry *ent = container_of(heap[0].ref, Entry, heapIdx);
-        hmDelete(&gData.db, &ent->node, &entryEq);
-        entryDel(ent);
+        replFeedDel(ent);
+        trackingInvalidate(NULL, ent->key, ent->klen);
+        notifyKeyspaceEvent(NOTIFY_EXPIRED, "expired", ent->key, ent->klen);
+        dbDelete(ent);
     }
 }
 
-int main() {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    int val = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-    struct sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
-    addr.sin_addr.s_addr = ntohl(0);
-    int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
-    if (rv) {
-        die("bind()");
+// set by SIGINT/SIGTERM, the event loop exits so that atexit work
+// (e.g. writing PGO profiles) gets to run
+static volatile sig_atomic_t gShutdown = 0;
+
+static void onShutdownSignal(int) {
+    gShutdown = 1;
+}
+
+// The io_uring backend. The kernel accepts and receives on its own:
+// multishot accept, and a multishot recv per connection that lands in a
+// ring of provided buffers. Each iteration queues a writev for every
+// connection with output and submits them all in the io_uring_enter()
+// that also waits for the next completions.
+enum {
+    UD_ACCEPT = 0,
+    UD_RECV = 1,
+    UD_SEND = 2,
+    UD_CANCEL = 3,
+};
+
+// user_data is a Conn pointer tagged with the op in its low bits
+const uint64_t k_ud_mask = 3;
+const uint32_t k_uring_entries = 1024;
+const uint16_t k_recv_group = 0;
+const uint32_t k_recv_bufs = 256;
+const uint32_t k_recv_buf_size = 16 << 10;
+
+static bool uringStart(Uring *ring) {
+    if (!uringInit(ring, k_uring_entries)) {
+        return false;
     }
-    fd_set_nb(fd);
-    rv = listen(fd, SOMAXCONN);
-    if (rv) {
-        die("listen()");
+    if (!uringSetupBufRing(ring, k_recv_group, k_recv_bufs, k_recv_buf_size)) {
+        uringDestroy(ring);
+        return false;
+    }
+    gData.uring = ring;
+    return true;
+}
+
+static struct io_uring_sqe *uringSqe() {
+    struct io_uring_sqe *sqe = uringGetSqe(gData.uring);
+    if (!sqe) {
+        // full, hand what is queued to the kernel
+        int rv = uringSubmitAndWait(gData.uring, 0, 0);
+        if (rv < 0) {
+            errno = -rv;
+            die("io_uring_enter()");
+        }
+        sqe = uringGetSqe(gData.uring);
+        assert(sqe);
     }
+    return sqe;
+}
 
-    memset(&gData, 0, sizeof(gData));
-    dlistInit(&gData.idleList);
-    threadPoolInit(&gData.threadPool, 4);
-    // event loop
+static void uringArmRecv(Conn *conn) {
+    uringPrepRecvMultishot(uringSqe(), conn->fd, k_recv_group, (uint64_t)(uintptr_t)conn | UD_RECV);
+    conn->recvArmed = true;
+    conn->ioPending++;
+}
+
+// a throttled client is not read from, like wantRead under poll(); the
+// recv ends with -ECANCELED and connOnDrain() arms it again
+static void uringCancelRecv(Conn *conn) {
+    uringPrepCancel(uringSqe(), (uint64_t)(uintptr_t)conn | UD_RECV, UD_CANCEL);
+    conn->recvCanceling = true;
+}
+
+static void uringQueueSend(Conn *conn) {
+    connSeal(conn);
+    // stays put until the completion, the kernel may read it late
+    conn->sendIov.resize(k_max_iov);
+    size_t n = connOutIov(conn, conn->sendIov.data(), k_max_iov);
+    uringPrepWritev(uringSqe(), conn->fd, conn->sendIov.data(), (uint32_t)n,
+        (uint64_t)(uintptr_t)conn | UD_SEND);
+    conn->sending = true;
+    conn->ioPending++;
+}
+
+// false: a kernel without multishot accept, nothing accepted yet
+static bool uringOnAccept(int fd, const struct io_uring_cqe &cqe) {
+    if (cqe.res >= 0) {
+        struct sockaddr_in addr = {};
+        socklen_t addrlen = sizeof(addr);
+        (void)getpeername(cqe.res, (struct sockaddr *)&addr, &addrlen);
+        uringArmRecv(connNew(cqe.res, addr));
+    } else if (cqe.res == -EINVAL && gStats.connsAccepted == 0) {
+        return false;
+    } else {
+        errno = -cqe.res;
+        msg_errno("accept() error");
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        uringPrepAcceptMultishot(uringSqe(), fd, UD_ACCEPT);
+    }
+    return true;
+}
+
+static void uringOnRecv(Conn *conn, const struct io_uring_cqe &cqe) {
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more) {
+        conn->ioPending--;
+        conn->recvArmed = false;
+        conn->recvCanceling = false;
+    }
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->dead && cqe.res > 0) {
+            connTouch(conn);
+            handleData(conn, uringBuf(gData.uring, bid), (size_t)cqe.res);
+        }
+        uringBufReturn(gData.uring, bid);
+    }
+    if (conn->dead) {
+        if (conn->ioPending == 0) {
+            connFree(conn);
+        }
+        return;
+    }
+    if (cqe.res == 0) {
+        handleEOF(conn);
+    } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        errno = -cqe.res;
+        msg_errno("read() error");
+        conn->wantClose = true;
+    }
+    if (conn->wantClose) {
+        return connDestroy(conn);
+    }
+    if (conn->throttled) {
+        if (more && !conn->recvCanceling) {
+            uringCancelRecv(conn);
+        }
+    } else if (!more) {
+        // stopped by the kernel, e.g. out of provided buffers
+        uringArmRecv(conn);
+    }
+}
+
+static void uringOnSend(Conn *conn, const struct io_uring_cqe &cqe) {
+    conn->ioPending--;
+    conn->sending = false;
+    if (conn->dead) {
+        if (conn->ioPending == 0) {
+            connFree(conn);
+        }
+        return;
+    }
+    if (cqe.res < 0) {
+        errno = -cqe.res;
+        msg_errno("write() error");
+        return connDestroy(conn);
+    }
+    gStats.bytesOut += (size_t)cqe.res;
+    outqConsume(conn, (size_t)cqe.res);
+    connOnDrain(conn);
+}
+
+// returns false to fall back to poll(), before any client connected
+static bool runUringLoop(int fd) {
+    Uring *ring = gData.uring;
+    uringPrepAcceptMultishot(uringSqe(), fd, UD_ACCEPT);
+    while (!gShutdown) {
+        // one submission for all the writes of this iteration
+        for (Conn *conn : gData.fd2conn) {
+            if (conn && !conn->sending && connOutBytes(conn) > 0) {
+                uringQueueSend(conn);
+            }
+        }
+        resumeDeferred();
+        int32_t timeoutMs = nextTimerMs();
+        uint64_t waitStart = getMonotonicNs();
+        int rv = uringSubmitAndWait(ring, 1, timeoutMs);
+        uint64_t waitEnd = getMonotonicNs();
+        gData.clockMs = waitEnd / 1000000;
+        histAdd(&gStats.pollNs, waitEnd - waitStart);
+        if (rv < 0 && rv != -EINTR && rv != -ETIME) {
+            errno = -rv;
+            die("io_uring_enter()");
+        }
+        while (struct io_uring_cqe *head = uringPeekCqe(ring)) {
+            // copied out, the handlers may submit and wait
+            struct io_uring_cqe cqe = *head;
+            uringCqeSeen(ring);
+            Conn *conn = (Conn *)(uintptr_t)(cqe.user_data & ~k_ud_mask);
+            switch (cqe.user_data & k_ud_mask) {
+            case UD_ACCEPT:
+                if (!uringOnAccept(fd, cqe)) {
+                    msg("io_uring multishot accept not supported, using poll()");
+                    gData.uring = NULL;
+                    uringDestroy(ring);
+                    return false;
+                }
+                break;
+            case UD_RECV:
+                uringOnRecv(conn, cqe);
+                break;
+            case UD_SEND:
+                uringOnSend(conn, cqe);
+                break;
+            case UD_CANCEL:
+                // the canceled recv completes on its own
+                break;
+            }
+        }
+        processTimers();
+        processPending();
+        histAdd(&gStats.loopNs, getMonotonicNs() - waitEnd);
+    }
+    return true;
+}
+
+static void runPollLoop(int fd) {
     std::vector<struct pollfd> pollArgs;
-    while (true) {
+    while (!gShutdown) {
         // prepare args of poll()
         pollArgs.clear();
         // put listening sockets in first position
@@ -807,24 +5449,23 @@ int main() {
             }
             pollArgs.push_back(pfd);
         }
+        resumeDeferred();
         int32_t timeoutMs = nextTimerMs();
         // poll() the client conns
+        uint64_t pollStart = getMonotonicNs();
         int rv = poll(pollArgs.data(), (nfds_t)pollArgs.size(), timeoutMs);
+        uint64_t pollEnd = getMonotonicNs();
+        gData.clockMs = pollEnd / 1000000;
+        histAdd(&gStats.pollNs, pollEnd - pollStart);
         if (rv < 0 && errno == EINTR) {
-            continue;
+            continue;  // re-checks gShutdown
         } else if (rv < 0) {
             die("poll()");
         }
 
         // handle the listening socket
         if (pollArgs[0].revents & POLLIN) {
-            if (Conn *conn = handleAccept(fd)) {
-                if (gData.fd2conn.size() <= (size_t)conn->fd) {
-                    gData.fd2conn.resize(conn->fd + 1);
-                }
-                assert(!gData.fd2conn[conn->fd]);
-                gData.fd2conn[conn->fd] = conn;
-            }
+            handleAccept(fd);
         }
 
         // handle connection sockets
@@ -835,15 +5476,13 @@ int main() {
             }
 
             Conn *conn = gData.fd2conn[pollArgs[i].fd];
-            conn->lastActiveMs = getMonotonicMs();
-            dlistDetach(&conn->idleNode);
-            dlistInsertBefore(&gData.idleList, &conn->idleNode);
-            if (ready & POLLIN) {
-                assert(conn->wantRead);
+            connTouch(conn);
+            // a subscriber polls for both, handleRead() may have flushed
+            // everything already
+            if ((ready & POLLIN) && conn->wantRead) {
                 handleRead(conn);
             }
-            if (ready & POLLOUT) {
-                assert(conn->wantWrite);
+            if ((ready & POLLOUT) && conn->wantWrite) {
                 handleWrite(conn);
             }
 
@@ -853,6 +5492,71 @@ int main() {
             }
         }
         processTimers();
+        processPending();
+        histAdd(&gStats.loopNs, getMonotonicNs() - pollEnd);
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const ConfigParam *p = NULL;
+        if (!strncmp(argv[i], "--", 2)) {
+            p = configLookup(argv[i] + 2);
+        }
+        if (!p || i + 1 >= argc) {
+            fprintf(stderr, "usage: %s [--<config name> <value>]...\n", argv[0]);
+            return 1;
+        }
+        if (!configSet(p, argv[++i])) {
+            fprintf(stderr, "invalid value for %s\n", argv[i - 1]);
+            return 1;
+        }
+    }
+    slowlogResize();
+    gData.replid = replNewId();
+    if (gConfig.clusterEnabled) {
+        // other nodes and clients reach this one at this address
+        clusterInit(&gData.cluster, "127.0.0.1:" + std::to_string(gConfig.port));
+        gData.slotKeys.resize(k_cluster_slots);
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = &onShutdownSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int val = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs((uint16_t)gConfig.port);
+    addr.sin_addr.s_addr = ntohl(0);
+    int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+        die("bind()");
+    }
+    fd_set_nb(fd);
+    rv = listen(fd, SOMAXCONN);
+    if (rv) {
+        die("listen()");
+    }
+
+    gStats.startMs = getMonotonicMs();
+    gData.clockMs = gStats.startMs;
+    dlistInit(&gData.idleList);
+    dlistInit(&gData.pending);
+    dlistInit(&gData.deferred);
+    dlistInit(&gData.patterns);
+    threadPoolInit(&gData.threadPool, 4);
+    Uring ring;
+    if (gConfig.ioBackend == IO_URING && !uringStart(&ring)) {
+        msg("io_uring not supported by the kernel, using poll()");
+    }
+    if (!gData.uring || !runUringLoop(fd)) {
+        runPollLoop(fd);
     }
+    msg("shutting down");
     return 0;
 }
\ No newline at end of file
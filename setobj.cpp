@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+// proj
+#include "setobj.h"
+#include "hashtable.hpp"
+#include "intset.h"
+#include "common.hpp"
+
+struct MemberKey {
+    HNode node;
+    const char *name = NULL;
+    size_t len = 0;
+};
+
+static bool memberEq(HNode *node, HNode *key) {
+    SetMember *m = container_of(node, SetMember, node);
+    MemberKey *mkey = container_of(key, MemberKey, node);
+    return m->len == mkey->len && memcmp(m->name, mkey->name, m->len) == 0;
+}
+
+static void memberKeyInit(MemberKey *key, const char *name, size_t len) {
+    key->node.hcode = strHash((const uint8_t *)name, len);
+    key->name = name;
+    key->len = len;
+}
+
+static void tableAdd(SetTable *table, const char *name, size_t len, uint64_t hcode) {
+    SetMember *m = (SetMember *)malloc(sizeof(SetMember) + len);
+    assert(m);
+    m->node.next = NULL;
+    m->node.hcode = hcode;
+    m->len = (uint32_t)len;
+    memcpy(m->name, name, len);
+    table->memberBytes += sizeof(SetMember) + len;
+    hmInsert(&table->map, &m->node);
+}
+
+static void convertToTable(SetObj *set) {
+    IntSet *ints = set->ints;
+    SetTable *table = new SetTable();
+    for (size_t i = 0; i < intsetLen(ints); i++) {
+        char buf[24];
+        size_t len = int2str(intsetGet(ints, i), buf);
+        tableAdd(table, buf, len, strHash((const uint8_t *)buf, len));
+    }
+    free(ints);
+    set->table = table;
+    set->encoding = SET_TABLE;
+}
+
+bool sobjAdd(SetObj *set, const char *name, size_t len) {
+    if (set->encoding == SET_INTSET) {
+        int64_t v = 0;
+        if (str2intExact(name, len, v)) {
+            if (intsetFind(set->ints, v)) {
+                return false;
+            }
+            if (intsetLen(set->ints) < k_set_intset_max) {
+                bool added = false;
+                set->ints = intsetAdd(set->ints, v, &added);
+                return added;
+            }
+        }
+        convertToTable(set);
+    }
+    MemberKey key;
+    memberKeyInit(&key, name, len);
+    if (hmLookup(&set->table->map, &key.node, &memberEq)) {
+        return false;
+    }
+    tableAdd(set->table, name, len, key.node.hcode);
+    return true;
+}
+
+bool sobjRemove(SetObj *set, const char *name, size_t len) {
+    if (set->encoding == SET_INTSET) {
+        int64_t v = 0;
+        bool removed = false;
+        if (str2intExact(name, len, v)) {
+            set->ints = intsetRemove(set->ints, v, &removed);
+        }
+        return removed;
+    }
+    MemberKey key;
+    memberKeyInit(&key, name, len);
+    HNode *node = hmDelete(&set->table->map, &key.node, &memberEq);
+    if (!node) {
+        return false;
+    }
+    SetMember *m = container_of(node, SetMember, node);
+    set->table->memberBytes -= sizeof(SetMember) + m->len;
+    free(m);
+    return true;
+}
+
+bool sobjContains(SetObj *set, const char *name, size_t len) {
+    if (set->encoding == SET_INTSET) {
+        int64_t v = 0;
+        return str2intExact(name, len, v) && intsetFind(set->ints, v);
+    }
+    MemberKey key;
+    memberKeyInit(&key, name, len);
+    return hmLookup(&set->table->map, &key.node, &memberEq) != NULL;
+}
+
+size_t sobjLen(SetObj *set) {
+    if (set->encoding == SET_INTSET) {
+        return intsetLen(set->ints);
+    }
+    return hmSize(&set->table->map);
+}
+
+struct ForEachArg {
+    bool (*cb)(const char *, size_t, void *);
+    void *arg;
+};
+
+static bool cbMember(HNode *node, void *arg) {
+    SetMember *m = container_of(node, SetMember, node);
+    ForEachArg *fa = (ForEachArg *)arg;
+    return fa->cb(m->name, m->len, fa->arg);
+}
+
+void sobjForEach(SetObj *set, bool (*cb)(const char *name, size_t len, void *arg), void *arg) {
+    if (set->encoding == SET_TABLE) {
+        ForEachArg fa = {cb, arg};
+        hmForEach(&set->table->map, &cbMember, &fa);
+        return;
+    }
+    for (size_t i = 0; i < intsetLen(set->ints); i++) {
+        char buf[24];
+        size_t len = int2str(intsetGet(set->ints, i), buf);
+        if (!cb(buf, len, arg)) {
+            return;
+        }
+    }
+}
+
+struct InterArg {
+    SetObj **others;
+    size_t n;
+    ForEachArg out;
+};
+
+static bool cbInter(const char *name, size_t len, void *arg) {
+    InterArg *ia = (InterArg *)arg;
+    for (size_t i = 0; i < ia->n; i++) {
+        if (!sobjContains(ia->others[i], name, len)) {
+            return true;
+        }
+    }
+    return ia->out.cb(name, len, ia->out.arg);
+}
+
+void sobjInter(SetObj **sets, size_t n, bool (*cb)(const char *name, size_t len, void *arg), void *arg) {
+    if (n == 0) {
+        return;
+    }
+    // smallest first: it bounds the result and the number of probes
+    std::vector<SetObj *> order(sets, sets + n);
+    std::sort(order.begin(), order.end(), [](SetObj *a, SetObj *b) {
+        return sobjLen(a) < sobjLen(b);
+    });
+    if (n >= 2 && order[0]->encoding == SET_INTSET && order[1]->encoding == SET_INTSET) {
+        // sorted merge of the two smallest, vectorized when both are int32
+        std::vector<int64_t> common;
+        intsetIntersect(order[0]->ints, order[1]->ints, common);
+        for (int64_t v : common) {
+            bool all = true;
+            for (size_t i = 2; i < n && all; i++) {
+                if (order[i]->encoding == SET_INTSET) {
+                    all = intsetFind(order[i]->ints, v);
+                } else {
+                    char buf[24];
+                    size_t len = int2str(v, buf);
+                    all = sobjContains(order[i], buf, len);
+                }
+            }
+            if (!all) {
+                continue;
+            }
+            char buf[24];
+            size_t len = int2str(v, buf);
+            if (!cb(buf, len, arg)) {
+                return;
+            }
+        }
+        return;
+    }
+    InterArg ia = {order.data() + 1, n - 1, {cb, arg}};
+    sobjForEach(order[0], &cbInter, &ia);
+}
+
+static bool cbFree(HNode *node, void *) {
+    free(container_of(node, SetMember, node));
+    return true;
+}
+
+void sobjClear(SetObj *set) {
+    if (set->encoding == SET_TABLE) {
+        hmForEach(&set->table->map, &cbFree, NULL);
+        hmClear(&set->table->map);
+        delete set->table;
+    } else {
+        free(set->ints);
+    }
+    *set = SetObj{};
+}
+
+size_t sobjMemUsage(SetObj *set) {
+    if (set->encoding == SET_INTSET) {
+        return intsetMemUsage(set->ints);
+    }
+    return sizeof(SetTable) + set->table->memberBytes + hmMemUsage(&set->table->map);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashtable.hpp"
+#include "intset.h"
+
+// A set of strings. Sets whose members all print as int64 (canonical
+// decimal, see str2intExact()) are an IntSet until they pass
+// k_set_intset_max members; anything else converts them, one way, to an
+// HMap of SetMember nodes.
+enum {
+    SET_INTSET = 0,
+    SET_TABLE = 1,
+};
+
+const size_t k_set_intset_max = 512;
+
+struct SetTable {
+    HMap map;
+    // bytes allocated for the members
+    size_t memberBytes = 0;
+};
+
+// 16 bytes, lives inside the Entry. Zero-initialize for an empty set.
+struct SetObj {
+    uint32_t encoding;
+    union {
+        // NULL while empty
+        IntSet *ints;
+        SetTable *table;
+    };
+};
+
+struct SetMember {
+    HNode node;
+    uint32_t len = 0;
+    char name[0];
+};
+
+// return true if the set changed
+bool sobjAdd(SetObj *set, const char *name, size_t len);
+bool sobjRemove(SetObj *set, const char *name, size_t len);
+bool sobjContains(SetObj *set, const char *name, size_t len);
+size_t sobjLen(SetObj *set);
+void sobjForEach(SetObj *set, bool (*cb)(const char *name, size_t len, void *arg), void *arg);
+// calls `cb` for each member of all `n` sets
+void sobjInter(SetObj **sets, size_t n, bool (*cb)(const char *name, size_t len, void *arg), void *arg);
+void sobjClear(SetObj *set);
+size_t sobjMemUsage(SetObj *set);
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Shows what pausing long commands does for the latency of everyone else.
+#
+#   ./slicebench.sh [builddir] [keyspace]
+#
+# Fills a keyspace of <keyspace> keys (default 10M, random keys so about
+# 86% of them get set) from <builddir> (default _gate_build), then runs a
+# GET benchmark while another client loops on KEYS with a pattern that
+# matches nothing: a walk of the whole keyspace with no output. Once with
+# client-request-budget-us 0, where KEYS runs to the end in one go, and
+# once with the default, where it pauses after each millisecond of work.
+set -e
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+BUILD=$(cd "${1:-$SRC/_gate_build}" && pwd)
+KEYSPACE=${2:-10000000}
+PORT=${SLICEBENCH_PORT:-12347}
+
+"$BUILD/server" --port "$PORT" 2>/dev/null &
+pid=$!
+sleep 0.5
+echo "== filling $KEYSPACE keys"
+"$BUILD/bench" -p "$PORT" -c 4 -P 64 -r "$KEYSPACE" -n $((KEYSPACE * 2)) -t set >/dev/null
+
+for budget in 0 1000; do
+    echo "== client-request-budget-us $budget"
+    "$BUILD/client" -p "$PORT" config set client-request-budget-us $budget >/dev/null
+    "$BUILD/bench" -p "$PORT" -c 4 -P 1 -r "$KEYSPACE" -n 50000 -t get
+    (while :; do "$BUILD/client" -p "$PORT" keys 'nomatch*' >/dev/null; done) &
+    loop=$!
+    sleep 1
+    # few requests: without pauses each can wait out a whole KEYS
+    "$BUILD/bench" -p "$PORT" -c 4 -P 1 -r "$KEYSPACE" -n 200 -t get
+    kill $loop
+    wait $loop 2>/dev/null || true
+done
+kill -TERM $pid
+wait $pid
@@ -0,0 +1,35 @@
+#include <math.h>
+#include "stats.h"
+
+// smallest value that lands in bucket `b`
+static uint64_t histBucketLow(uint32_t b) {
+    if (b < (1u << kHistSubBits)) {
+        return b;
+    }
+    uint32_t exp = (b >> kHistSubBits) + kHistSubBits - 1;
+    uint64_t sub = b & ((1u << kHistSubBits) - 1);
+    return (1ull << exp) + (sub << (exp - kHistSubBits));
+}
+
+uint64_t histPercentile(const Histogram *h, double p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * (double)h->count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < kHistBuckets; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t high = b + 1 < kHistBuckets ? histBucketLow(b + 1) - 1 : h->max;
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+void histReset(Histogram *h) {
+    *h = Histogram{};
+}
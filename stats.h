@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-linear histogram. Values below 2^kHistSubBits get a bucket each,
+// above that every power of two is split into 2^kHistSubBits linear
+// sub-buckets, so a bucket is at most 1/8 of its value wide. Values are
+// clamped to 2^kHistMaxExp - 1.
+const uint32_t kHistSubBits = 3;
+const uint32_t kHistMaxExp = 40;
+const uint32_t kHistBuckets = (kHistMaxExp - kHistSubBits + 1) << kHistSubBits;
+
+struct Histogram {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t buckets[kHistBuckets] = {};
+};
+
+inline uint32_t histBucket(uint64_t val) {
+    if (val < (1u << kHistSubBits)) {
+        return (uint32_t)val;
+    }
+    if (val >> kHistMaxExp) {
+        val = (1ull << kHistMaxExp) - 1;
+    }
+    uint32_t exp = 63 - (uint32_t)__builtin_clzll(val);
+    uint32_t sub = (uint32_t)(val >> (exp - kHistSubBits)) & ((1u << kHistSubBits) - 1);
+    return ((exp - kHistSubBits + 1) << kHistSubBits) + sub;
+}
+
+inline void histAdd(Histogram *h, uint64_t val) {
+    h->count++;
+    h->sum += val;
+    if (val > h->max) {
+        h->max = val;
+    }
+    h->buckets[histBucket(val)]++;
+}
+
+// upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+uint64_t histPercentile(const Histogram *h, double p);
+void histReset(Histogram *h);
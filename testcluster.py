@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Cluster mode on two local servers: slot routing with MOVED, and a slot
+# migrated key by key with ASK redirects while it moves.
+
+import argparse
+import socket
+import struct
+import subprocess
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--server', required=True)
+args = parser.parse_args()
+
+PORTS = [7001, 7002]
+ADDRS = [b'127.0.0.1:%d' % p for p in PORTS]
+
+TAG_NIL, TAG_ERR, TAG_INT, TAG_STR, TAG_DBL, TAG_ARR = range(6)
+ERR_MOVED, ERR_ASK = 5, 6
+
+
+def encode_req(*argv):
+    body = struct.pack('<I', len(argv))
+    for a in argv:
+        body += struct.pack('<I', len(a)) + a
+    return struct.pack('<I', len(body)) + body
+
+
+def decode(data, pos=0):
+    tag = data[pos]
+    pos += 1
+    if tag == TAG_NIL:
+        return None, pos
+    if tag == TAG_ERR:
+        code, size = struct.unpack('<II', data[pos:pos + 8])
+        return ('err', code, data[pos + 8:pos + 8 + size]), pos + 8 + size
+    if tag == TAG_INT:
+        return struct.unpack('<q', data[pos:pos + 8])[0], pos + 8
+    if tag == TAG_STR:
+        (size,) = struct.unpack('<I', data[pos:pos + 4])
+        return data[pos + 4:pos + 4 + size], pos + 4 + size
+    if tag == TAG_DBL:
+        return struct.unpack('<d', data[pos:pos + 8])[0], pos + 8
+    assert tag == TAG_ARR, tag
+    (n,) = struct.unpack('<I', data[pos:pos + 4])
+    pos += 4
+    items = []
+    for _ in range(n):
+        item, pos = decode(data, pos)
+        items.append(item)
+    return items, pos
+
+
+class Node:
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port))
+
+    def __call__(self, *argv):
+        self.sock.sendall(encode_req(*argv))
+        data = b''
+        while len(data) < 4 or len(data) < 4 + struct.unpack('<I', data[:4])[0]:
+            chunk = self.sock.recv(1 << 16)
+            assert chunk, 'connection closed'
+            data += chunk
+        return decode(data, 4)[0]
+
+
+def is_err(res, code=None):
+    return isinstance(res, tuple) and res[0] == 'err' and (code is None or res[1] == code)
+
+
+def wait_port(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), 0.1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError(f'server not listening on {port}')
+
+
+servers = [subprocess.Popen([args.server, '--port', str(p), '--cluster-enabled', 'yes'],
+    stderr=subprocess.DEVNULL) for p in PORTS]
+try:
+    for p in PORTS:
+        wait_port(p)
+    a, b = Node(PORTS[0]), Node(PORTS[1])
+    nodes = {ADDRS[0]: a, ADDRS[1]: b}
+
+    # a follows redirects like a cluster client
+    def call(node, *argv):
+        for _ in range(3):
+            res = node(*argv)
+            if is_err(res, ERR_MOVED):
+                node = nodes[res[2].split()[2]]
+            elif is_err(res, ERR_ASK):
+                node = nodes[res[2].split()[2]]
+                assert node(b'asking') is None
+                return node(*argv)
+            else:
+                return res
+        raise AssertionError('redirect loop')
+
+    # a owns the lower half, b the upper one, both know it
+    assert is_err(a(b'set', b'foo', b'1'))
+    assert a(b'cluster', b'addslotsrange', b'0', b'8191') is None
+    assert a(b'cluster', b'setslot', b'8192-16383', b'node', ADDRS[1]) is None
+    assert b(b'cluster', b'addslotsrange', b'8192', b'16383') is None
+    assert b(b'cluster', b'setslot', b'0-8191', b'node', ADDRS[0]) is None
+    assert is_err(a(b'cluster', b'addslotsrange', b'100', b'100'))
+    assert a(b'cluster', b'slots') == [[0, 8191, ADDRS[0]], [8192, 16383, ADDRS[1]]]
+    assert b(b'cluster', b'slots') == a(b'cluster', b'slots')
+
+    # keys go to the owner of their slot, others send clients there
+    assert a(b'cluster', b'keyslot', b'foo') == 12182
+    res = a(b'set', b'foo', b'1')
+    assert res == ('err', ERR_MOVED, b'MOVED 12182 ' + ADDRS[1]), res
+    assert b(b'set', b'foo', b'1') is None
+    n = 1000
+    for i in range(n):
+        assert call(a, b'set', b'key:%d' % i, b'%d' % i) is None
+    count = [0, 0]
+    for i in range(n):
+        slot = a(b'cluster', b'keyslot', b'key:%d' % i)
+        count[slot >= 8192] += 1
+        node = a if slot < 8192 else b
+        assert node(b'get', b'key:%d' % i) == b'%d' % i
+    assert 0 < count[0] < n
+    assert sum(a(b'cluster', b'countkeysinslot', b'%d' % s) for s in range(8192)) == count[0]
+
+    # multi-key commands need one slot, hash tags make that possible
+    assert is_err(call(a, b'mset', b'x1', b'1', b'x2', b'2'))
+    assert call(a, b'mset', b'{u1}x', b'1', b'{u1}y', b'2') is None
+    assert call(a, b'mget', b'{u1}x', b'{u1}y') == [b'1', b'2']
+
+    # move the slot of {m} from a to b, keys of every type
+    slot = a(b'cluster', b'keyslot', b'{m}')
+    src, dst = (a, b) if slot < 8192 else (b, a)
+    src_addr, dst_addr = (ADDRS[0], ADDRS[1]) if src is a else (ADDRS[1], ADDRS[0])
+    for i in range(50):
+        assert src(b'set', b'{m}s%d' % i, b'v%d' % i) is None
+    assert src(b'rpush', b'{m}list', b'a', b'b', b'c') == 3
+    assert src(b'hset', b'{m}hash', b'f1', b'v1', b'f2', b'v2') == 2
+    assert src(b'sadd', b'{m}set', b'1', b'2', b'x') == 3
+    assert src(b'zadd', b'{m}zset', b'0.1', b'z1') == 1
+    assert src(b'zadd', b'{m}zset', b'-2.5', b'z2') == 1
+    assert src(b'pexpire', b'{m}hash', b'100000') == 1
+    total = 54
+    assert src(b'cluster', b'countkeysinslot', b'%d' % slot) == total
+
+    assert dst(b'cluster', b'setslot', b'%d' % slot, b'importing', src_addr) is None
+    assert src(b'cluster', b'setslot', b'%d' % slot, b'migrating', dst_addr) is None
+    # the target only serves the slot to ASKING clients
+    res = dst(b'get', b'{m}s0')
+    assert is_err(res, ERR_MOVED), res
+
+    keys = src(b'cluster', b'getkeysinslot', b'%d' % slot, b'10')
+    assert len(keys) == 10
+    assert src(b'migrate', b'127.0.0.1', dst_addr.split(b':')[1], b'1000', *keys) == 10
+    # moved keys and new keys are asked for at the target
+    res = src(b'get', keys[0])
+    assert res == ('err', ERR_ASK, b'ASK %d ' % slot + dst_addr), res
+    assert call(src, b'get', keys[0]) is not None
+    assert is_err(src(b'set', b'{m}new', b'x'), ERR_ASK)
+    assert call(src, b'set', b'{m}new', b'x') is None
+    # the rest is still served here
+    remaining = [k for k in (b'{m}s%d' % i for i in range(50)) if k not in keys]
+    assert src(b'get', remaining[0]) is not None
+    # some keys here, some there: retry later
+    assert src(b'mget', keys[0], remaining[0])[1] == 7
+
+    while True:
+        keys = src(b'cluster', b'getkeysinslot', b'%d' % slot, b'10')
+        if not keys:
+            break
+        assert src(b'migrate', b'127.0.0.1', dst_addr.split(b':')[1], b'1000', *keys) == len(keys)
+    # the slot has no keys left, it can change owner
+    assert src(b'cluster', b'setslot', b'%d' % slot, b'node', dst_addr) is None
+    assert dst(b'cluster', b'setslot', b'%d' % slot, b'node', dst_addr) is None
+    assert src(b'cluster', b'countkeysinslot', b'%d' % slot) == 0
+    assert dst(b'cluster', b'countkeysinslot', b'%d' % slot) == total + 1
+
+    res = src(b'get', b'{m}s1')
+    assert res == ('err', ERR_MOVED, b'MOVED %d ' % slot + dst_addr), res
+    for i in range(50):
+        assert dst(b'get', b'{m}s%d' % i) == b'v%d' % i
+    assert dst(b'lrange', b'{m}list', b'0', b'-1') == [b'a', b'b', b'c']
+    assert sorted(dst(b'hgetall', b'{m}hash')) == [b'f1', b'f2', b'v1', b'v2']
+    assert 0 < dst(b'pttl', b'{m}hash') <= 100000
+    assert dst(b'pttl', b'{m}list') == -1
+    assert sorted(dst(b'smembers', b'{m}set')) == [b'1', b'2', b'x']
+    assert dst(b'zquery', b'{m}zset', b'-inf', b'', b'0', b'10') == [b'z2', -2.5, b'z1', 0.1]
+
+    # a node cannot give away a slot it still has keys in
+    slot = a(b'cluster', b'keyslot', b'{u1}')
+    owner = a if slot < 8192 else b
+    assert is_err(owner(b'cluster', b'setslot', b'%d' % slot, b'node', ADDRS[owner is a]))
+finally:
+    for s in servers:
+        s.terminate()
+        s.wait()
@@ -39,11 +39,285 @@ $ ./client zquery zset 1 "" 0 10
 (str) n2
 (dbl) 2
 (arr) end
+$ ./client config get slowlog-max-len
+(arr) len=2
+(str) slowlog-max-len
+(str) 128
+(arr) end
+$ ./client config set slowlog-max-len -1
+(err) 3 invalid value
+$ ./client set cnt 42
+(nil)
+$ ./client object encoding cnt
+(str) int
+$ ./client get cnt
+(str) 42
+$ ./client set cnt 042
+(nil)
+$ ./client object encoding cnt
+(str) embstr
+$ ./client get cnt
+(str) 042
+$ ./client set big xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+(nil)
+$ ./client object encoding big
+(str) raw
+$ ./client incr hits
+(int) 1
+$ ./client incrby hits 10
+(int) 11
+$ ./client decr hits
+(int) 10
+$ ./client decrby hits 20
+(int) -10
+$ ./client incrbyfloat hits 10.5
+(dbl) 0.5
+$ ./client get hits
+(str) 0.5
+$ ./client incr hits
+(err) 3 value is not an integer
+$ ./client incrbyfloat hits 0.5
+(dbl) 1
+$ ./client object encoding hits
+(str) int
+$ ./client incrby hits 9223372036854775807
+(err) 3 increment would overflow
+$ ./client incr big
+(err) 3 value is not an integer
+$ ./client mset k1 v1 k2 v2 k1 v3
+(nil)
+$ ./client mget k1 k2 nokey zset
+(arr) len=4
+(str) v3
+(str) v2
+(nil)
+(nil)
+(arr) end
+$ ./client mset k1 v1 k2
+(err) 3 expect key value pairs
+$ ./client mset k1 v1 zset v2
+(err) 3 expected string
+$ ./client del k1 k2 nokey
+(int) 2
+$ ./client del nokey
+(int) 0
+$ ./client hset user name alice age 30
+(int) 2
+$ ./client hset user name bob
+(int) 0
+$ ./client hget user name
+(str) bob
+$ ./client hget user nofield
+(nil)
+$ ./client hmget user age nofield
+(arr) len=2
+(str) 30
+(nil)
+(arr) end
+$ ./client hincrby user age 5
+(int) 35
+$ ./client hincrby user name 1
+(err) 3 hash value is not an integer
+$ ./client hgetall user
+(arr) len=4
+(str) name
+(str) bob
+(str) age
+(str) 35
+(arr) end
+$ ./client object encoding user
+(str) packed
+$ ./client hget zset n1
+(err) 3 expected hash
+$ ./client hdel user name nofield
+(int) 1
+$ ./client hlen user
+(int) 1
+$ ./client hdel user age
+(int) 1
+$ ./client hlen user
+(int) 0
+$ ./client rpush queue b c
+(int) 2
+$ ./client lpush queue a
+(int) 3
+$ ./client lrange queue 0 -1
+(arr) len=3
+(str) a
+(str) b
+(str) c
+(arr) end
+$ ./client lrange queue -2 10
+(arr) len=2
+(str) b
+(str) c
+(arr) end
+$ ./client lrange queue 2 1
+(arr) len=0
+(arr) end
+$ ./client lindex queue -1
+(str) c
+$ ./client lindex queue 3
+(nil)
+$ ./client object encoding queue
+(str) quicklist
+$ ./client lpop queue
+(str) a
+$ ./client rpop queue
+(str) c
+$ ./client llen queue
+(int) 1
+$ ./client rpop queue
+(str) b
+$ ./client rpop queue
+(nil)
+$ ./client llen queue
+(int) 0
+$ ./client lpush zset x
+(err) 3 expected list
+$ ./client rpush queue a
+(int) 1
+$ ./client brpop nokey queue 0
+(arr) len=2
+(str) queue
+(str) a
+(arr) end
+$ ./client blpop queue 0.1
+(nil)
+$ ./client blpop queue -1
+(err) 3 expect timeout in seconds
+$ ./client blpop queue 1e300
+(err) 3 timeout is out of range
+$ ./client brpop queue inf
+(err) 3 timeout is out of range
+$ ./client sadd tags:a 1 2 3 5 8
+(int) 5
+$ ./client sadd tags:a 3
+(int) 0
+$ ./client sadd tags:b 2 3 5 7 11
+(int) 5
+$ ./client object encoding tags:a
+(str) intset
+$ ./client sinter tags:a tags:b
+(arr) len=3
+(str) 2
+(str) 3
+(str) 5
+(arr) end
+$ ./client sinter tags:a nokey
+(arr) len=0
+(arr) end
+$ ./client sismember tags:a 8
+(int) 1
+$ ./client sismember tags:a 08
+(int) 0
+$ ./client sadd tags:b red
+(int) 1
+$ ./client object encoding tags:b
+(str) hashtable
+$ ./client sinter tags:b tags:a
+(arr) len=3
+(str) 2
+(str) 3
+(str) 5
+(arr) end
+$ ./client srem tags:a 1 2 3 4
+(int) 3
+$ ./client sunion tags:a
+(arr) len=2
+(str) 5
+(str) 8
+(arr) end
+$ ./client scard tags:b
+(int) 6
+$ ./client srem tags:a 5 8
+(int) 2
+$ ./client scard tags:a
+(int) 0
+$ ./client sadd zset 1
+(err) 3 expected set
+$ ./client config set maxmemory 1mb
+(nil)
+$ ./client config get maxmemory
+(arr) len=2
+(str) maxmemory
+(str) 1048576
+(arr) end
+$ ./client config set maxmemory 0
+(nil)
+$ ./client config set maxmemory-policy allkeys-lfu
+(nil)
+$ ./client config set maxmemory-policy lru
+(err) 3 invalid value
+$ ./client publish news hi
+(int) 0
+$ ./client subscribe news sport
+(arr) len=2
+(arr) len=3
+(str) subscribe
+(str) news
+(int) 1
+(arr) end
+(arr) len=3
+(str) subscribe
+(str) sport
+(int) 2
+(arr) end
+(arr) end
+$ ./client unsubscribe
+(arr) len=1
+(arr) len=3
+(str) unsubscribe
+(nil)
+(int) 0
+(arr) end
+(arr) end
 '''
 
 
+import argparse
 import shlex
+import socket
+import struct
 import subprocess
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--server', help='start this server binary for the run')
+parser.add_argument('--client', default='./client')
+parser.add_argument('--server-args', default='', help='extra server flags, e.g. "--io-backend uring"')
+args = parser.parse_args()
+
+
+def encode_req(*args):
+    body = struct.pack('<I', len(args))
+    for a in args:
+        body += struct.pack('<I', len(a)) + a
+    return struct.pack('<I', len(body)) + body
+
+
+def read_res(sock):
+    def read_n(n):
+        data = b''
+        while len(data) < n:
+            chunk = sock.recv(n - len(data))
+            assert chunk, 'connection closed'
+            data += chunk
+        return data
+    (n,) = struct.unpack('<I', read_n(4))
+    return read_n(n)
+
+
+def wait_port(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), 0.1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError(f'server not listening on {port}')
+
 
 cmds = []
 outputs = []
@@ -59,6 +333,524 @@ for x in lines:
         outputs[-1] = outputs[-1] + x + '\n'
 
 assert len(cmds) == len(outputs)
-for cmd, expect in zip(cmds, outputs):
-    out = subprocess.check_output(shlex.split(cmd)).decode('utf-8')
-    assert out == expect, f'cmd:{cmd} out:{out} expect:{expect}'
\ No newline at end of file
+server = None
+if args.server:
+    server = subprocess.Popen([args.server] + shlex.split(args.server_args),
+        stderr=subprocess.DEVNULL)
+    wait_port(1234)
+try:
+    for cmd, expect in zip(cmds, outputs):
+        argv = shlex.split(cmd)
+        argv[0] = args.client
+        out = subprocess.check_output(argv).decode('utf-8')
+        assert out == expect, f'cmd:{cmd} out:{out} expect:{expect}'
+
+    # blocked clients are served in arrival order
+    waiters = []
+    for _ in range(2):
+        waiters.append(subprocess.Popen(
+            [args.client, 'blpop', 'nokey', 'jobs', '5'], stdout=subprocess.PIPE))
+        time.sleep(0.2)
+    out = subprocess.check_output([args.client, 'rpush', 'jobs', 'j1', 'j2', 'j3'])
+    assert out == b'(int) 3\n', out
+    for w, job in zip(waiters, ['j1', 'j2']):
+        out = w.communicate(timeout=5)[0].decode('utf-8')
+        expect = f'(arr) len=2\n(str) jobs\n(str) {job}\n(arr) end\n'
+        assert out == expect, f'blpop out:{out} expect:{expect}'
+    out = subprocess.check_output([args.client, 'lrange', 'jobs', '0', '-1'])
+    assert out == b'(arr) len=1\n(str) j3\n(arr) end\n', out
+
+    # one message reaches channel and pattern subscribers
+    subs = [
+        subprocess.Popen([args.client, '-r', '1', 'subscribe', 'news'], stdout=subprocess.PIPE),
+        subprocess.Popen([args.client, '-r', '1', 'psubscribe', 'n*'], stdout=subprocess.PIPE),
+    ]
+    time.sleep(0.2)
+    out = subprocess.check_output([args.client, 'publish', 'news', 'hello'])
+    assert out == b'(int) 2\n', out
+    expects = [
+        '(arr) len=3\n(str) message\n(str) news\n(str) hello\n(arr) end\n',
+        '(arr) len=4\n(str) pmessage\n(str) n*\n(str) news\n(str) hello\n(arr) end\n',
+    ]
+    for sub, expect in zip(subs, expects):
+        out = sub.communicate(timeout=5)[0].decode('utf-8')
+        assert out.endswith(expect), f'subscriber out:{out} expect:{expect}'
+    time.sleep(0.1)  # the subscribers' disconnects
+    out = subprocess.check_output([args.client, 'info', 'stats']).decode('utf-8')
+    assert 'pubsub_channels:0\n' in out and 'pubsub_patterns:0\n' in out, out
+
+    # large values are referenced by the reply; overwriting the key while
+    # the reply is queued must not change what is sent
+    big_a, big_b = b'a' * (1 << 20), b'b' * (1 << 20)
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        sock.sendall(encode_req(b'set', b'big', big_a))
+        assert read_res(sock) == b'\x00'
+        sock.sendall(encode_req(b'get', b'big') + encode_req(b'set', b'big', big_b)
+            + encode_req(b'mget', b'big', b'big') + encode_req(b'del', b'big'))
+        str_a = b'\x03' + struct.pack('<I', len(big_a)) + big_a
+        str_b = b'\x03' + struct.pack('<I', len(big_b)) + big_b
+        assert read_res(sock) == str_a
+        assert read_res(sock) == b'\x00'
+        assert read_res(sock) == b'\x05' + struct.pack('<I', 2) + str_b + str_b
+        assert read_res(sock) == b'\x02' + struct.pack('<q', 1)
+
+    # a reply of referenced values past the message limit is an error,
+    # and the connection stays in sync
+    huge = b'h' * (12 << 20)
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        for i in range(3):
+            sock.sendall(encode_req(b'set', b'huge%d' % i, huge))
+            assert read_res(sock) == b'\x00'
+        sock.sendall(encode_req(b'mget', b'huge0', b'huge1', b'huge2')
+            + encode_req(b'mget', b'huge0', b'huge1'))
+        res = read_res(sock)
+        assert res[0] == 1 and struct.unpack('<I', res[1:5])[0] == 2, res[:32]
+        assert read_res(sock) == (b'\x05' + struct.pack('<I', 2)
+            + (b'\x03' + struct.pack('<I', len(huge)) + huge) * 2)
+        sock.sendall(encode_req(b'del', b'huge0', b'huge1', b'huge2'))
+        assert read_res(sock) == b'\x02' + struct.pack('<q', 3)
+
+    def info_field(section, name):
+        out = subprocess.check_output([args.client, 'info', section]).decode('utf-8')
+        for line in out.splitlines():
+            if line.startswith(name + ':'):
+                return int(line.split(':')[1])
+        raise KeyError(name)
+
+    # past the soft limit a client's requests wait until it reads
+    subprocess.check_output([args.client, 'config', 'set', 'client-output-soft-limit-normal', '256kb'])
+    val = b'v' * 100000
+    reply = b'\x03' + struct.pack('<I', len(val)) + val
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        sock.sendall(encode_req(b'set', b'bigval', val))
+        assert read_res(sock) == b'\x00'
+        sock.sendall(encode_req(b'get', b'bigval') * 300)
+        time.sleep(0.3)
+        assert info_field('clients', 'throttled_clients') == 1
+        assert info_field('stats', 'client_output_throttled') >= 1
+        for _ in range(300):
+            assert read_res(sock) == reply
+    assert info_field('clients', 'throttled_clients') == 0
+
+    # a throttled client is not read from: its unread request stays in
+    # the socket, not in the server's input buffer
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        body = 24 << 20
+        sock.sendall(encode_req(b'get', b'bigval') * 100)
+        sock.sendall(struct.pack('<II', 4 + 4 + 3 + 4 + 2 + 4 + body, 3)
+            + struct.pack('<I', 3) + b'set' + struct.pack('<I', 2) + b'bk'
+            + struct.pack('<I', body))
+        time.sleep(0.3)
+        assert info_field('clients', 'throttled_clients') == 1
+        sock.setblocking(False)
+        chunk = b'x' * (1 << 20)
+        sent = 0
+        deadline = time.time() + 1.0
+        while sent < body and time.time() < deadline:
+            try:
+                sent += sock.send(chunk[:body - sent])
+            except BlockingIOError:
+                time.sleep(0.01)
+        time.sleep(0.3)
+        out = subprocess.check_output([args.client, 'client', 'list']).decode('utf-8')
+        qbuf = max(int(f[5:]) for f in out.split() if f.startswith('qbuf='))
+        assert qbuf < (4 << 20), qbuf
+    time.sleep(0.1)
+    assert info_field('clients', 'throttled_clients') == 0
+    subprocess.check_output([args.client, 'config', 'set', 'client-output-soft-limit-normal', '1mb'])
+
+    # past the hard limit a subscriber that does not read is dropped
+    subprocess.check_output([args.client, 'config', 'set', 'client-output-hard-limit-pubsub', '1mb'])
+    with socket.create_connection(('127.0.0.1', 1234)) as sub, \
+            socket.create_connection(('127.0.0.1', 1234)) as pub:
+        sub.sendall(encode_req(b'subscribe', b'flood'))
+        read_res(sub)
+        for _ in range(300):
+            pub.sendall(encode_req(b'publish', b'flood', val))
+            read_res(pub)
+        assert info_field('stats', 'client_output_disconnects') == 1
+        assert info_field('stats', 'pubsub_channels') == 0
+        sub.settimeout(5)
+        while sub.recv(1 << 20):
+            pass
+    subprocess.check_output([args.client, 'config', 'set', 'client-output-hard-limit-pubsub', '32mb'])
+
+    # a pipeline longer than the request budget runs over several
+    # iterations, replies still in order
+    subprocess.check_output([args.client, 'config', 'set', 'client-request-budget', '4'])
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        sock.sendall(b''.join(encode_req(b'incr', b'budget') for _ in range(100)))
+        for i in range(100):
+            assert read_res(sock) == b'\x02' + struct.pack('<q', i + 1)
+    assert info_field('stats', 'client_budget_exhausted') >= 1
+    subprocess.check_output([args.client, 'config', 'set', 'client-request-budget', '64'])
+
+    # big KEYS and ZQUERY replies come as TAG_CHUNK messages ending in a
+    # TAG_ARR, and the next reply only after them
+    def read_stream(sock):
+        elems, chunks = [], 0
+        while True:
+            res = read_res(sock)
+            (n,) = struct.unpack('<I', res[1:5])
+            pos = 5
+            for _ in range(n):
+                if res[pos] == 3:
+                    (size,) = struct.unpack('<I', res[pos + 1:pos + 5])
+                    elems.append(res[pos + 5:pos + 5 + size])
+                    pos += 5 + size
+                else:
+                    assert res[pos] == 4
+                    elems.append(struct.unpack('<d', res[pos + 1:pos + 9])[0])
+                    pos += 9
+            assert pos == len(res)
+            if res[0] == 5:
+                return elems, chunks
+            assert res[0] == 6
+            chunks += 1
+
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        n = 20000
+        sock.sendall(b''.join(encode_req(b'set', b'stream:%05d' % i, b'v') for i in range(n)))
+        sock.sendall(b''.join(encode_req(b'zadd', b'streamz', b'%d' % i, b'm%05d' % i)
+            for i in range(n)))
+        for _ in range(2 * n):
+            read_res(sock)
+        sock.sendall(encode_req(b'keys') + encode_req(b'get', b'stream:00000'))
+        keys, chunks = read_stream(sock)
+        assert chunks > 1 and len(keys) == len(set(keys))
+        assert set(b'stream:%05d' % i for i in range(n)) <= set(keys)
+        assert read_res(sock) == b'\x03' + struct.pack('<I', 1) + b'v'
+        sock.sendall(encode_req(b'zquery', b'streamz', b'10', b'', b'5', b'30000'))
+        elems, chunks = read_stream(sock)
+        assert chunks > 1 and len(elems) == 30000
+        assert elems[0::2] == [b'm%05d' % i for i in range(15, 15015)]
+        assert elems[1::2] == [float(i) for i in range(15, 15015)]
+
+    # KEYS and ZQUERY pause after their time slice and go on later, the
+    # reply is the same; a pattern filters KEYS
+    subprocess.check_output([args.client, 'config', 'set', 'client-request-budget-us', '1'])
+    yields = info_field('stats', 'command_yields')
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        sock.sendall(encode_req(b'keys', b'stream:0001?') + encode_req(b'keys', b'nomatch*')
+            + encode_req(b'zquery', b'streamz', b'0', b'', b'0', b'4'))
+        keys, _ = read_stream(sock)
+        assert sorted(keys) == [b'stream:%05d' % i for i in range(10, 20)]
+        assert read_stream(sock) == ([], 0)
+        assert read_stream(sock) == ([b'm00000', 0.0, b'm00001', 1.0], 0)
+    assert info_field('stats', 'command_yields') > yields
+    subprocess.check_output([args.client, 'config', 'set', 'client-request-budget-us', '1000'])
+
+    # MULTI queues, EXEC runs the queue and replies with an array
+    def rint(n):
+        return b'\x02' + struct.pack('<q', n)
+    nil, queued = b'\x00', b'\x03' + struct.pack('<I', 6) + b'QUEUED'
+    with socket.create_connection(('127.0.0.1', 1234)) as a, \
+            socket.create_connection(('127.0.0.1', 1234)) as b:
+        def call(sock, *argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        assert call(a, b'multi') == nil
+        assert call(a, b'set', b'tx:n', b'1') == queued
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'zadd', b'tx:board', b'2', b'alice') == queued
+        assert call(a, b'blpop', b'tx:nolist', b'0') == queued
+        assert call(b, b'get', b'tx:n')[0] == 1
+        assert call(a, b'exec') == (b'\x05' + struct.pack('<I', 4) + nil + rint(2) + rint(1)
+            + nil)
+        # DISCARD drops the queue, a bad command makes EXEC fail
+        assert call(a, b'multi') == nil
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'discard') == nil
+        assert call(a, b'multi') == nil
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'nosuchcmd')[0] == 1
+        assert call(a, b'exec')[0] == 1
+        assert call(a, b'exec')[0] == 1
+        assert call(a, b'get', b'tx:n') == b'\x03' + struct.pack('<I', 1) + b'2'
+        # a write to a WATCHed key fails EXEC, the retry goes through
+        assert call(a, b'watch', b'tx:n', b'tx:new') == nil
+        assert call(b, b'incrby', b'tx:n', b'10') == rint(12)
+        assert call(a, b'multi') == nil
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'exec') == nil
+        assert call(a, b'watch', b'tx:n', b'tx:new') == nil
+        assert call(a, b'multi') == nil
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'exec') == b'\x05' + struct.pack('<I', 1) + rint(13)
+        # so does creating a key that was missing
+        assert call(a, b'watch', b'tx:new') == nil
+        assert call(b, b'set', b'tx:new', b'x') == nil
+        assert call(a, b'multi') == nil
+        assert call(a, b'del', b'tx:new') == queued
+        assert call(a, b'exec') == nil
+        # and creating then deleting one, though it is missing again
+        assert call(a, b'watch', b'tx:gone') == nil
+        assert call(b, b'set', b'tx:gone', b'x') == nil
+        assert call(b, b'del', b'tx:gone') == rint(1)
+        assert call(a, b'multi') == nil
+        assert call(a, b'incr', b'tx:n') == queued
+        assert call(a, b'exec') == nil
+        assert call(a, b'watch', b'tx:n') == nil
+        assert info_field('clients', 'watched_keys') == 1
+    time.sleep(0.1)  # the disconnects
+    assert info_field('clients', 'watched_keys') == 0
+    assert subprocess.check_output([args.client, 'del', 'tx:n', 'tx:new', 'tx:board']) == b'(int) 3\n'
+
+    # CLIENT TRACKING: a key read by a tracking client is invalidated by
+    # a TAG_PUSH message when it changes, once, until read again
+    def rstr(v):
+        return b'\x03' + struct.pack('<I', len(v)) + v
+
+    def push(*keys):
+        return (b'\x07' + struct.pack('<I', 2) + rstr(b'invalidate') + b'\x05'
+            + struct.pack('<I', len(keys)) + b''.join(rstr(k) for k in keys))
+
+    with socket.create_connection(('127.0.0.1', 1234)) as a, \
+            socket.create_connection(('127.0.0.1', 1234)) as b, \
+            socket.create_connection(('127.0.0.1', 1234)) as c:
+        def call(sock, *argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        assert call(a, b'client', b'tracking', b'on') == nil
+        assert info_field('clients', 'tracking_clients') == 1
+        assert call(b, b'mset', b'tk:1', b'x', b'tk:2', b'x') == nil
+        assert call(a, b'get', b'tk:1') == rstr(b'x')
+        assert call(a, b'mget', b'tk:2', b'tk:3')[0] == 5
+        assert call(b, b'set', b'tk:1', b'y') == nil
+        assert read_res(a) == push(b'tk:1')
+        assert call(b, b'set', b'tk:1', b'z') == nil
+        assert call(b, b'del', b'tk:2', b'tk:3') == rint(1)
+        assert read_res(a) == push(b'tk:2', b'tk:3')
+        assert call(a, b'get', b'tk:1') == rstr(b'z')
+        # its own writes too, after the reply, unless NOLOOP
+        assert call(a, b'set', b'tk:1', b'w') == nil
+        assert read_res(a) == push(b'tk:1')
+        assert call(a, b'client', b'tracking', b'on', b'noloop') == nil
+        assert call(a, b'get', b'tk:1') == rstr(b'w')
+        assert call(a, b'set', b'tk:1', b'v') == nil
+        # and expiry
+        assert call(b, b'set', b'tk:e', b'x') == nil
+        assert call(b, b'pexpire', b'tk:e', b'100') == rint(1)
+        assert call(a, b'get', b'tk:e') == rstr(b'x')
+        assert read_res(a) == push(b'tk:e')
+        # broadcast: every key under a prefix, without reading it
+        assert call(c, b'client', b'tracking', b'on', b'bcast', b'prefix', b'tk:b',
+            b'prefix', b'tk:c', b'noloop') == nil
+        assert call(b, b'set', b'tk:b1', b'x') == nil
+        assert call(b, b'set', b'tk:x', b'x') == nil
+        assert read_res(c) == push(b'tk:b1')
+        assert call(c, b'set', b'tk:c1', b'x') == nil
+        assert call(b, b'set', b'tk:c2', b'x') == nil
+        assert read_res(c) == push(b'tk:c2')
+        assert info_field('stats', 'tracking_total_prefixes') == 2
+        assert call(c, b'client', b'tracking', b'on', b'prefix', b'tk:')[0] == 1
+        # the table stays under its limit, a forgotten key is invalidated
+        assert call(a, b'config', b'set', b'tracking-table-max-keys', b'2') == nil
+        assert call(a, b'mget', b'tk:m1', b'tk:m2', b'tk:m3')[0] == 5
+        res = read_res(a)
+        assert res in (push(b'tk:m1'), push(b'tk:m2'), push(b'tk:1')), res
+        assert info_field('stats', 'tracking_total_keys') == 2
+        assert info_field('stats', 'tracking_evicted_keys') >= 1
+        assert call(a, b'config', b'set', b'tracking-table-max-keys', b'1000000') == nil
+        # off: no more messages
+        assert call(a, b'client', b'tracking', b'off') == nil
+        assert call(b, b'set', b'tk:m3', b'x') == nil
+        assert call(a, b'get', b'tk:m3') == rstr(b'x')
+    time.sleep(0.1)  # the disconnects
+    assert info_field('clients', 'tracking_clients') == 0
+    assert info_field('stats', 'tracking_total_keys') == 0
+
+    # keyspace notifications: the enabled classes are published on
+    # __keyspace@0__:<key> and __keyevent@0__:<event>
+    def rarr(*items):
+        return b'\x05' + struct.pack('<I', len(items)) + b''.join(items)
+
+    def msg(channel, data):
+        return rarr(rstr(b'message'), rstr(channel), rstr(data))
+
+    out = subprocess.check_output([args.client, 'config', 'set', 'notify-keyspace-events', 'Exg$'])
+    assert out == b'(nil)\n', out
+    out = subprocess.check_output([args.client, 'config', 'get', 'notify-keyspace-events'])
+    assert out == b'(arr) len=2\n(str) notify-keyspace-events\n(str) Eg$x\n(arr) end\n', out
+    out = subprocess.check_output([args.client, 'config', 'set', 'notify-keyspace-events', 'Q'])
+    assert out == b'(err) 3 invalid value\n', out
+    with socket.create_connection(('127.0.0.1', 1234)) as sub, \
+            socket.create_connection(('127.0.0.1', 1234)) as a:
+        def call(sock, *argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        assert call(sub, b'subscribe', b'__keyevent@0__:expired', b'__keyevent@0__:set',
+            b'__keyevent@0__:del', b'__keyevent@0__:zadd')[0] == 5
+        assert call(a, b'set', b'nk:1', b'x') == nil
+        assert call(a, b'zadd', b'nk:z', b'1', b'm') == rint(1)
+        assert call(a, b'del', b'nk:1', b'nk:none') == rint(1)
+        assert call(a, b'set', b'nk:e', b'x') == nil
+        assert call(a, b'pexpire', b'nk:e', b'50') == rint(1)
+        # z is not enabled, the other events are
+        assert read_res(sub) == msg(b'__keyevent@0__:set', b'nk:1')
+        assert read_res(sub) == msg(b'__keyevent@0__:del', b'nk:1')
+        assert read_res(sub) == msg(b'__keyevent@0__:set', b'nk:e')
+        assert read_res(sub) == msg(b'__keyevent@0__:expired', b'nk:e')
+        # by key, to a pattern subscriber
+        assert call(a, b'config', b'set', b'notify-keyspace-events', b'Kz') == nil
+        assert call(sub, b'psubscribe', b'__keyspace@0__:nk:*')[0] == 5
+        assert call(a, b'set', b'nk:1', b'x') == nil
+        assert call(a, b'zadd', b'nk:z', b'2', b'm') == rint(0)
+        assert read_res(sub) == rarr(rstr(b'pmessage'), rstr(b'__keyspace@0__:nk:*'),
+            rstr(b'__keyspace@0__:nk:z'), rstr(b'zadd'))
+        assert call(a, b'config', b'set', b'notify-keyspace-events', b'') == nil
+    assert subprocess.check_output([args.client, 'del', 'nk:1', 'nk:z']) == b'(int) 2\n'
+
+    # key-index: KEYS goes straight to the prefix of the pattern and
+    # returns keys in order, through writes, deletes and expiry
+    out = subprocess.check_output([args.client, 'config', 'set', 'key-index', 'yes'])
+    assert out == b'(nil)\n', out
+    assert info_field('memory', 'used_memory_key_index') > 0
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        def call(*argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        names = [b'ki:u:%d' % i for i in range(1000)]
+        for name in names:
+            assert call(b'set', name, b'x') == nil
+        assert call(b'set', b'ki:u', b'x') == nil
+        assert call(b'set', b'ki:v', b'x') == nil
+        assert call(b'del', b'ki:u:7') == rint(1)
+        assert call(b'pexpire', b'ki:u:8', b'1') == rint(1)
+        time.sleep(0.1)
+        names = sorted(set(names) - {b'ki:u:7', b'ki:u:8'})
+        sock.sendall(encode_req(b'keys', b'ki:u:*'))
+        assert read_stream(sock)[0] == names
+        sock.sendall(encode_req(b'keys', b'ki:u:1?'))
+        assert read_stream(sock)[0] == [b'ki:u:1%d' % i for i in range(10)]
+        sock.sendall(encode_req(b'keys', b'ki:*'))
+        assert read_stream(sock)[0] == sorted(names + [b'ki:u', b'ki:v'])
+        sock.sendall(encode_req(b'keys'))
+        keys = read_stream(sock)[0]
+        assert keys == sorted(keys) and len(keys) == info_field('keyspace', 'keys')
+        assert call(b'del', b'ki:u', b'ki:v', *names) == rint(1000)
+        # paused between batches while the client does not read: the walk
+        # goes on after the last key it returned, so another client's
+        # writes ahead of it show up, and nothing comes twice
+        pad = b'.' * 1000
+        wide = [b'ki:w:%05d' % i + pad for i in range(30000)]
+        for i in range(0, len(wide), 500):
+            argv = [b'mset']
+            for name in wide[i:i + 500]:
+                argv += [name, b'x']
+            assert call(*argv) == nil
+        sock.sendall(encode_req(b'keys', b'ki:w:*'))
+        time.sleep(0.3)
+        with socket.create_connection(('127.0.0.1', 1234)) as other:
+            other.sendall(encode_req(b'del', *wide[-1000:]))
+            assert read_res(other) == rint(1000)
+            other.sendall(encode_req(b'set', wide[0], b'y'))
+            assert read_res(other) == nil
+            other.sendall(encode_req(b'set', b'ki:w:99999' + pad, b'x'))
+            assert read_res(other) == nil
+        keys = read_stream(sock)[0]
+        assert keys == sorted(keys) and len(keys) == len(set(keys))
+        assert keys == wide[:-1000] + [b'ki:w:99999' + pad]
+        assert call(b'del', b'ki:w:99999' + pad) == rint(1)
+        for i in range(0, len(wide) - 1000, 1000):
+            assert call(b'del', *wide[i:i + 1000]) == rint(1000)
+    subprocess.check_output([args.client, 'config', 'set', 'key-index', 'no'])
+    assert info_field('memory', 'used_memory_key_index') == 0
+
+    # past maxmemory: noeviction refuses writes, the allkeys policies drop
+    # keys to make room and stay about at the limit
+    limit = info_field('memory', 'used_memory') + (256 << 10)
+    subprocess.check_output([args.client, 'config', 'set', 'maxmemory-policy', 'noeviction'])
+    subprocess.check_output([args.client, 'config', 'set', 'maxmemory', str(limit)])
+    evicted = info_field('stats', 'evicted_keys')
+    ev = b'e' * 4096
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        def call(*argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        res = [call(b'set', b'ev:%d' % i, ev) for i in range(200)]
+        assert res[0] == nil
+        assert res[-1][:5] == b'\x01' + struct.pack('<I', 4)
+        assert info_field('stats', 'evicted_keys') == evicted
+        for policy in (b'allkeys-lru', b'allkeys-lfu'):
+            assert call(b'config', b'set', b'maxmemory-policy', policy) == nil
+            for i in range(200):
+                assert call(b'set', b'ev:%s:%d' % (policy, i), ev) == nil
+            assert info_field('stats', 'evicted_keys') > evicted
+            evicted = info_field('stats', 'evicted_keys')
+            assert info_field('memory', 'used_memory') <= limit + (64 << 10)
+        assert call(b'config', b'set', b'maxmemory', b'0') == nil
+        assert call(b'config', b'set', b'maxmemory-policy', b'noeviction') == nil
+
+    # SLOWLOG: at slowlog-log-slower-than 0 every command is logged after
+    # it ran, newest first, capped at slowlog-max-len; long arguments are cut
+    def decode(buf, pos=0):
+        tag = buf[pos]
+        if tag == 2:
+            return struct.unpack_from('<q', buf, pos + 1)[0], pos + 9
+        n = struct.unpack_from('<I', buf, pos + 1)[0]
+        if tag == 3:
+            return buf[pos + 5:pos + 5 + n], pos + 5 + n
+        assert tag == 5
+        items, pos = [], pos + 5
+        for _ in range(n):
+            item, pos = decode(buf, pos)
+            items.append(item)
+        return items, pos
+
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        def call(*argv):
+            sock.sendall(encode_req(*argv))
+            return read_res(sock)
+        assert call(b'config', b'set', b'slowlog-log-slower-than', b'0') == nil
+        assert call(b'slowlog', b'reset') == nil
+        assert call(b'set', b'sl:k', b'v' * 200) == nil
+        entries = decode(call(b'slowlog', b'get', b'2'))[0]
+        assert [e[4][:2] for e in entries] == [[b'set', b'sl:k'], [b'slowlog', b'reset']]
+        eid, ts, dur, fd, argv = entries[0]
+        assert argv[2] == b'v' * 128 + b'... (72 more bytes)'
+        assert eid == entries[1][0] + 1 and abs(ts - time.time()) < 5
+        assert 0 <= dur < 1000000
+        # under the threshold nothing is logged, the CONFIG SET included
+        assert call(b'config', b'set', b'slowlog-log-slower-than', b'1000000') == nil
+        assert call(b'get', b'sl:k') == rstr(b'v' * 200)
+        assert decode(call(b'slowlog', b'get', b'1'))[0][0][4] == [b'slowlog', b'get', b'2']
+        assert call(b'config', b'set', b'slowlog-log-slower-than', b'0') == nil
+        assert call(b'config', b'set', b'slowlog-max-len', b'3') == nil
+        for _ in range(10):
+            assert call(b'get', b'sl:k') == rstr(b'v' * 200)
+        assert call(b'slowlog', b'len') == rint(3)
+        entries = decode(call(b'slowlog', b'get', b'10'))[0]
+        assert [e[4][:2] for e in entries] == [[b'slowlog', b'len'], [b'get', b'sl:k'], [b'get', b'sl:k']]
+        assert call(b'slowlog', b'reset') == nil
+        # the RESET itself is the only entry left
+        assert call(b'slowlog', b'len') == rint(1)
+        assert call(b'config', b'set', b'slowlog-max-len', b'128') == nil
+        assert call(b'config', b'set', b'slowlog-log-slower-than', b'10000') == nil
+        assert call(b'del', b'sl:k') == rint(1)
+
+    # INFO commandstats / latencystats: a command's calls and time, and
+    # the percentiles of its latency histogram
+    def info_stats(section, name):
+        out = subprocess.check_output([args.client, 'info', section]).decode('utf-8')
+        for line in out.splitlines():
+            if line.startswith(name + ':'):
+                return {k: float(v) for k, v in
+                    (f.split('=') for f in line.split(':', 1)[1].split(','))}
+        return None
+
+    before = info_stats('commandstats', 'cmdstat_hlen') or {'calls': 0, 'usec': 0}
+    with socket.create_connection(('127.0.0.1', 1234)) as sock:
+        sock.sendall(encode_req(b'hlen', b'cs:nokey') * 100)
+        for _ in range(100):
+            assert read_res(sock) == rint(0)
+    after = info_stats('commandstats', 'cmdstat_hlen')
+    assert after['calls'] == before['calls'] + 100
+    assert after['usec'] >= before['usec']
+    assert after['usec_per_call'] == round(after['usec_per_call'], 2) >= 0
+    lat = info_stats('latencystats', 'latency_percentiles_usec_hlen')
+    assert 0 < lat['p50'] <= lat['p99'] <= lat['p99.9'] <= lat['max']
+finally:
+    if server:
+        server.terminate()
+        server.wait()
\ No newline at end of file
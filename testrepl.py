@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+# Replication between two local servers: a full sync, the live stream,
+# reads on the replica, and resyncs after the link drops. The replica
+# reaches the primary through a proxy here, so that the test can cut the
+# link without the primary noticing anything else.
+
+import argparse
+import socket
+import struct
+import subprocess
+import threading
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--server', required=True)
+args = parser.parse_args()
+
+PRIMARY, REPLICA, PROXY = 7003, 7004, 7005
+
+TAG_NIL, TAG_ERR, TAG_INT, TAG_STR, TAG_DBL, TAG_ARR = range(6)
+
+
+def encode_req(*argv):
+    body = struct.pack('<I', len(argv))
+    for a in argv:
+        body += struct.pack('<I', len(a)) + a
+    return struct.pack('<I', len(body)) + body
+
+
+def decode(data, pos=0):
+    tag = data[pos]
+    pos += 1
+    if tag == TAG_NIL:
+        return None, pos
+    if tag == TAG_ERR:
+        code, size = struct.unpack('<II', data[pos:pos + 8])
+        return ('err', code, data[pos + 8:pos + 8 + size]), pos + 8 + size
+    if tag == TAG_INT:
+        return struct.unpack('<q', data[pos:pos + 8])[0], pos + 8
+    if tag == TAG_STR:
+        (size,) = struct.unpack('<I', data[pos:pos + 4])
+        return data[pos + 4:pos + 4 + size], pos + 4 + size
+    if tag == TAG_DBL:
+        return struct.unpack('<d', data[pos:pos + 8])[0], pos + 8
+    assert tag == TAG_ARR, tag
+    (n,) = struct.unpack('<I', data[pos:pos + 4])
+    pos += 4
+    items = []
+    for _ in range(n):
+        item, pos = decode(data, pos)
+        items.append(item)
+    return items, pos
+
+
+class Node:
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port))
+
+    def send(self, *argv):
+        self.sock.sendall(encode_req(*argv))
+
+    def recv(self):
+        data = b''
+        while len(data) < 4 or len(data) < 4 + struct.unpack('<I', data[:4])[0]:
+            chunk = self.sock.recv(1 << 16)
+            assert chunk, 'connection closed'
+            data += chunk
+        return decode(data, 4)[0]
+
+    def __call__(self, *argv):
+        self.send(*argv)
+        return self.recv()
+
+    def info(self, section):
+        text = self(b'info', section).decode()
+        return dict(line.split(':', 1) for line in text.splitlines() if ':' in line)
+
+
+def is_err(res):
+    return isinstance(res, tuple) and res[0] == 'err'
+
+
+def wait_port(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port), 0.1).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError(f'server not listening on {port}')
+
+
+def wait_for(cond, what, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if cond():
+            return
+        time.sleep(0.02)
+    raise AssertionError(f'timed out waiting for {what}')
+
+
+class Proxy:
+    # forwards PROXY to PRIMARY, cut() drops the connections
+    def __init__(self):
+        self.lsock = socket.socket()
+        self.lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.lsock.bind(('127.0.0.1', PROXY))
+        self.lsock.listen()
+        self.socks = []
+        self.lock = threading.Lock()
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def accept(self):
+        while True:
+            try:
+                a, _ = self.lsock.accept()
+            except OSError:
+                return
+            b = socket.create_connection(('127.0.0.1', PRIMARY))
+            with self.lock:
+                self.socks += [a, b]
+            threading.Thread(target=self.pump, args=(a, b), daemon=True).start()
+            threading.Thread(target=self.pump, args=(b, a), daemon=True).start()
+
+    def pump(self, src, dst):
+        try:
+            while True:
+                data = src.recv(1 << 16)
+                if not data:
+                    break
+                dst.sendall(data)
+        except OSError:
+            pass
+        for s in (src, dst):
+            try:
+                s.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+
+    def cut(self):
+        with self.lock:
+            socks, self.socks = self.socks, []
+        for s in socks:
+            try:
+                s.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            s.close()
+
+
+servers = [subprocess.Popen([args.server, '--port', str(p)], stderr=subprocess.DEVNULL)
+    for p in (PRIMARY, REPLICA)]
+try:
+    for p in (PRIMARY, REPLICA):
+        wait_port(p)
+    proxy = Proxy()
+    m, r = Node(PRIMARY), Node(REPLICA)
+
+    def synced():
+        link = r.info(b'replication')
+        return (link['master_link_status'] == 'up' and link['master_sync_in_progress'] == '0'
+            and link['slave_repl_offset'] == m.info(b'replication')['master_repl_offset'])
+
+    def same(*argv):
+        return m(*argv) == r(*argv)
+
+    # data from before the replica came, of every type
+    for i in range(500):
+        assert m(b'set', b'k%d' % i, b'v%d' % i) is None
+    assert m(b'rpush', b'list', b'a', b'b', b'c') == 3
+    assert m(b'hset', b'hash', b'f1', b'v1', b'f2', b'v2') == 2
+    assert m(b'sadd', b'set', b'1', b'2', b'x') == 3
+    assert m(b'zadd', b'zset', b'1.5', b'z1') == 1
+    assert m(b'zadd', b'zset', b'-2', b'z2') == 1
+    assert m(b'pexpire', b'hash', b'100000') == 1
+    assert r(b'set', b'stale', b'x') is None
+
+    assert m.info(b'replication')['role'] == 'master'
+    assert r(b'replicaof', b'127.0.0.1', b'%d' % PROXY) is None
+    wait_for(synced, 'the first sync')
+    assert r.info(b'replication')['role'] == 'slave'
+    assert m.info(b'replication')['connected_slaves'] == '1'
+    assert m.info(b'stats')['sync_full'] == '1'
+    # a full sync replaces what was there
+    assert is_err(r(b'get', b'stale'))
+
+    # reads are served, writes are not
+    assert r(b'get', b'k42') == b'v42'
+    assert r(b'zscore', b'zset', b'z1') == 1.5
+    assert r(b'zquery', b'zset', b'-inf', b'', b'0', b'10') == [b'z2', -2.0, b'z1', 1.5]
+    assert 0 < r(b'pttl', b'hash') <= 100000
+    assert r(b'pttl', b'list') == -1
+    assert same(b'lrange', b'list', b'0', b'-1')
+    assert sorted(r(b'hgetall', b'hash')) == sorted(m(b'hgetall', b'hash'))
+    assert sorted(r(b'smembers', b'set')) == sorted(m(b'smembers', b'set'))
+    res = r(b'set', b'k1', b'x')
+    assert is_err(res) and res[2].startswith(b'READONLY'), res
+    assert is_err(r(b'del', b'k1'))
+    assert r(b'multi') is None
+    assert is_err(r(b'incr', b'n'))
+    assert is_err(r(b'exec'))
+
+    # the stream: writes as they happen
+    assert m(b'set', b'k1', b'changed') is None
+    assert m(b'del', b'k2') == 1
+    assert m(b'incrbyfloat', b'f', b'1.25') == 1.25
+    assert m(b'zadd', b'zset', b'3', b'z3') == 1
+    assert m(b'zrem', b'zset', b'z2') == 1
+    assert m(b'multi') is None
+    assert m(b'incr', b'n') == b'QUEUED'
+    assert m(b'incr', b'n') == b'QUEUED'
+    assert m(b'exec') == [1, 2]
+    # pops: served now, and served later to a client that waited
+    assert m(b'rpush', b'q', b'a', b'b') == 2
+    assert m(b'blpop', b'q', b'1') == [b'q', b'a']
+    waiter = Node(PRIMARY)
+    waiter.send(b'brpop', b'q2', b'5')
+    time.sleep(0.1)
+    assert m(b'lpush', b'q2', b'x', b'y') == 2
+    assert waiter.recv() == [b'q2', b'x']
+    # expired and evicted keys go away on the replica too
+    assert m(b'set', b'short', b'1') is None
+    assert m(b'pexpire', b'short', b'50') == 1
+    wait_for(lambda: is_err(m(b'get', b'short')), 'expiry')
+    wait_for(synced, 'the stream')
+    for key in (b'k1', b'k2', b'f', b'n', b'short'):
+        assert same(b'get', key), key
+    assert r(b'get', b'n') == b'2'
+    assert same(b'zquery', b'zset', b'-inf', b'', b'0', b'10')
+    assert r(b'lrange', b'q', b'0', b'-1') == [b'b']
+    assert r(b'lrange', b'q2', b'0', b'-1') == [b'y']
+
+    # the link drops and comes back: the backlog covers the gap
+    proxy.cut()
+    wait_for(lambda: r.info(b'replication')['master_link_status'] == 'down', 'link down')
+    for i in range(100):
+        assert m(b'set', b'gap%d' % i, b'%d' % i) is None
+    wait_for(synced, 'a partial resync')
+    stats = m.info(b'stats')
+    assert stats['sync_full'] == '1' and stats['sync_partial_ok'] == '1', stats
+    assert r(b'get', b'gap99') == b'99'
+    assert r(b'get', b'k42') == b'v42'
+
+    # a gap bigger than the backlog needs a full sync again
+    assert m(b'config', b'set', b'repl-backlog-size', b'16kb') is None
+    proxy.cut()
+    wait_for(lambda: r.info(b'replication')['master_link_status'] == 'down', 'link down')
+    for i in range(1000):
+        assert m(b'set', b'big%d' % i, b'x' * 100) is None
+    assert m(b'del', b'k3') == 1
+    wait_for(synced, 'a full resync')
+    stats = m.info(b'stats')
+    assert stats['sync_full'] == '2' and stats['sync_partial_err'] == '1', stats
+    assert r(b'get', b'big999') == b'x' * 100
+    assert is_err(r(b'get', b'k3'))
+    assert r.info(b'keyspace')['keys'] == m.info(b'keyspace')['keys']
+
+    # promoted, it takes writes
+    assert r(b'replicaof', b'no', b'one') is None
+    assert r.info(b'replication')['role'] == 'master'
+    assert r(b'set', b'k1', b'mine') is None
+    wait_for(lambda: m.info(b'replication')['connected_slaves'] == '0', 'replica gone')
+finally:
+    for s in servers:
+        s.terminate()
+        s.wait()
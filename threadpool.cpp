@@ -37,4 +37,11 @@ void threadPoolQueue(ThreadPool *pool, void (*f)(void *), void *arg) {
     // Send signal to worker and release thread.
     pthread_cond_signal(&pool->notEmpty);
     pthread_mutex_unlock(&pool->mu);
+}
+
+size_t threadPoolQueueDepth(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mu);
+    size_t n = pool->work.size();
+    pthread_mutex_unlock(&pool->mu);
+    return n;
 }
\ No newline at end of file
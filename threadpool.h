@@ -18,4 +18,5 @@ struct ThreadPool {
 };
 
 void threadPoolInit(ThreadPool *pool, size_t numThreads);
-void threadPoolQueue(ThreadPool *pool, void (*f)(void *), void *arg);
\ No newline at end of file
+void threadPoolQueue(ThreadPool *pool, void (*f)(void *), void *arg);
+size_t threadPoolQueueDepth(ThreadPool *pool);
\ No newline at end of file
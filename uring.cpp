@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// proj
+#include "uring.h"
+
+static int sysSetup(uint32_t entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags,
+    const void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argsz);
+}
+
+static int sysRegister(int fd, uint32_t op, const void *arg, uint32_t nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+// the ops the event loop submits
+static bool probeOps(int fd) {
+    const uint32_t nops = 64;
+    size_t size = sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    if (!probe) {
+        return false;
+    }
+    bool ok = sysRegister(fd, IORING_REGISTER_PROBE, probe, nops) == 0;
+    const uint8_t ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_WRITEV};
+    for (uint8_t op : ops) {
+        ok = ok && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+bool uringInit(Uring *ring, uint32_t entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sysSetup(entries, &p);
+    if (fd < 0) {
+        return false;
+    }
+    ring->fd = fd;
+    ring->features = p.features;
+    // timeouts ride on io_uring_enter(), completions must never be dropped
+    uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & need) != need || !probeOps(fd)) {
+        uringDestroy(ring);
+        return false;
+    }
+    size_t sqLen = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    size_t cqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // one mapping holds both rings
+    ring->sqMapLen = sqLen > cqLen ? sqLen : cqLen;
+    void *sq = mmap(NULL, ring->sqMapLen, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        uringDestroy(ring);
+        return false;
+    }
+    ring->sqMap = sq;
+    ring->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        uringDestroy(ring);
+        return false;
+    }
+    uint8_t *base = (uint8_t *)sq;
+    ring->sqHead = (uint32_t *)(base + p.sq_off.head);
+    ring->sqTailShared = (uint32_t *)(base + p.sq_off.tail);
+    ring->sqArray = (uint32_t *)(base + p.sq_off.array);
+    ring->sqMask = *(uint32_t *)(base + p.sq_off.ring_mask);
+    ring->sqEntries = p.sq_entries;
+    ring->sqTail = *ring->sqTailShared;
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    ring->cqHead = (uint32_t *)(base + p.cq_off.head);
+    ring->cqTail = (uint32_t *)(base + p.cq_off.tail);
+    ring->cqMask = *(uint32_t *)(base + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    return true;
+}
+
+void uringDestroy(Uring *ring) {
+    if (ring->bufRing) {
+        munmap(ring->bufRing, ring->bufCount * sizeof(struct io_uring_buf));
+        free(ring->bufBase);
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqesLen);
+    }
+    if (ring->sqMap) {
+        munmap(ring->sqMap, ring->sqMapLen);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    *ring = Uring();
+}
+
+struct io_uring_sqe *uringGetSqe(Uring *ring) {
+    uint32_t head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqTail - head >= ring->sqEntries) {
+        return NULL;
+    }
+    uint32_t idx = ring->sqTail & ring->sqMask;
+    ring->sqArray[idx] = idx;
+    ring->sqTail++;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uringSubmitAndWait(Uring *ring, uint32_t waitNr, int32_t timeoutMs) {
+    uint32_t toSubmit = ring->sqTail - *ring->sqTailShared;
+    // publish the new entries before the kernel looks at the tail
+    __atomic_store_n(ring->sqTailShared, ring->sqTail, __ATOMIC_RELEASE);
+    uint32_t flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = {timeoutMs / 1000, (long long)(timeoutMs % 1000) * 1000000};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    if (waitNr && timeoutMs >= 0) {
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int rv = sysEnter(ring->fd, toSubmit, waitNr, flags,
+        (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+        (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : _NSIG / 8);
+    return rv < 0 ? -errno : rv;
+}
+
+struct io_uring_cqe *uringPeekCqe(Uring *ring) {
+    uint32_t head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cqMask];
+}
+
+void uringCqeSeen(Uring *ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool uringSetupBufRing(Uring *ring, uint16_t group, uint32_t count, uint32_t size) {
+    if (count == 0 || (count & (count - 1)) || count > 32768) {
+        return false;
+    }
+    size_t ringLen = count * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, ringLen, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    uint8_t *base = (uint8_t *)malloc((size_t)count * size);
+    if (!base) {
+        munmap(mem, ringLen);
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(mem, ringLen);
+        free(base);
+        return false;
+    }
+    ring->bufRing = (struct io_uring_buf_ring *)mem;
+    ring->bufBase = base;
+    ring->bufCount = count;
+    ring->bufSize = size;
+    ring->bufTail = 0;
+    ring->bufGroup = group;
+    for (uint32_t i = 0; i < count; i++) {
+        uringBufReturn(ring, (uint16_t)i);
+    }
+    return true;
+}
+
+uint8_t *uringBuf(Uring *ring, uint16_t bid) {
+    return ring->bufBase + (size_t)bid * ring->bufSize;
+}
+
+void uringBufReturn(Uring *ring, uint16_t bid) {
+    // Not bufRing->bufs: in C++ the header's flex array macro puts a
+    // 1-byte empty struct in front of it, shifting the array by 8.
+    struct io_uring_buf *bufs = (struct io_uring_buf *)ring->bufRing;
+    struct io_uring_buf *buf = &bufs[ring->bufTail & (ring->bufCount - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uringBuf(ring, bid);
+    buf->len = ring->bufSize;
+    buf->bid = bid;
+    ring->bufTail++;
+    // the tail overlays bufs[0].resv, published after the entry
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+void uringPrepAcceptMultishot(struct io_uring_sqe *sqe, int fd, uint64_t userData) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = userData;
+}
+
+void uringPrepRecvMultishot(struct io_uring_sqe *sqe, int fd, uint16_t group, uint64_t userData) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = userData;
+}
+
+void uringPrepWritev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov,
+    uint32_t n, uint64_t userData)
+{
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = n;
+    sqe->user_data = userData;
+}
+
+void uringPrepCancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t userData) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+}
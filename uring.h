@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// A small io_uring binding on the raw syscalls, no liburing: the
+// submission and completion rings, one ring of provided buffers for
+// multishot receives, and prep helpers for the ops the server uses.
+// Single-threaded, like the event loop that owns it.
+struct Uring {
+    int fd = -1;
+    uint32_t features = 0;
+    // submission ring; sqTail runs ahead of the shared tail until submit
+    uint32_t *sqHead = NULL;
+    uint32_t *sqTailShared = NULL;
+    uint32_t *sqArray = NULL;
+    uint32_t sqMask = 0;
+    uint32_t sqEntries = 0;
+    uint32_t sqTail = 0;
+    struct io_uring_sqe *sqes = NULL;
+    // completion ring
+    uint32_t *cqHead = NULL;
+    uint32_t *cqTail = NULL;
+    uint32_t cqMask = 0;
+    struct io_uring_cqe *cqes = NULL;
+    // mappings, for uringDestroy(); both rings share sqMap
+    void *sqMap = NULL;
+    size_t sqMapLen = 0;
+    size_t sqesLen = 0;
+    // provided buffers, see uringSetupBufRing()
+    struct io_uring_buf_ring *bufRing = NULL;
+    uint8_t *bufBase = NULL;
+    uint32_t bufCount = 0;
+    uint32_t bufSize = 0;
+    uint16_t bufTail = 0;
+    uint16_t bufGroup = 0;
+};
+
+// false if the kernel lacks io_uring or a feature the server relies on
+bool uringInit(Uring *ring, uint32_t entries);
+void uringDestroy(Uring *ring);
+// NULL when the submission ring is full, submit first
+struct io_uring_sqe *uringGetSqe(Uring *ring);
+// Submit what is queued, then wait for `waitNr` completions or until
+// `timeoutMs` passes (-1: no limit). Returns -errno on failure; -ETIME
+// and -EINTR are not errors for the caller.
+int uringSubmitAndWait(Uring *ring, uint32_t waitNr, int32_t timeoutMs);
+// the oldest unseen completion, or NULL
+struct io_uring_cqe *uringPeekCqe(Uring *ring);
+void uringCqeSeen(Uring *ring);
+
+// `count` (a power of 2) buffers of `size` bytes for IOSQE_BUFFER_SELECT
+// in buffer group `group`
+bool uringSetupBufRing(Uring *ring, uint16_t group, uint32_t count, uint32_t size);
+// the buffer a completion picked, by id
+uint8_t *uringBuf(Uring *ring, uint16_t bid);
+// hand a buffer back to the kernel once its data is consumed
+void uringBufReturn(Uring *ring, uint16_t bid);
+
+void uringPrepAcceptMultishot(struct io_uring_sqe *sqe, int fd, uint64_t userData);
+void uringPrepRecvMultishot(struct io_uring_sqe *sqe, int fd, uint16_t group, uint64_t userData);
+void uringPrepWritev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov,
+    uint32_t n, uint64_t userData);
+// cancels the request submitted with user_data `target`
+void uringPrepCancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t userData);
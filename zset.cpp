@@ -67,6 +67,11 @@ void zsetClear(ZSet *zset) {
     treeDispose(zset->root);
     hmClear(&zset->hmap);
     zset->root = NULL;
+    zset->nodeBytes = 0;
+}
+
+size_t zsetMemUsage(ZSet *zset) {
+    return zset->nodeBytes + hmMemUsage(&zset->hmap);
 }
 
 // compare by the (score, name) tuple
@@ -118,6 +123,7 @@ bool zsetInsert(ZSet *zset, const char *name, size_t len, double score) {
         return false;
     } else {
         node = znodeNew(name, len, score);
+        zset->nodeBytes += sizeof(ZNode) + len;
         hmInsert(&zset->hmap, &node->hmap);
         treeInsert(zset, node);
         return true;
@@ -134,6 +140,7 @@ void zsetDelete(ZSet *zset, ZNode *node) {
     // remove from tree
     zset->root = avlDel(&node->tree);
     // deallocate node
+    zset->nodeBytes -= sizeof(ZNode) + node->len;
     znodeDel(node);
 }
 
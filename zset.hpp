@@ -7,6 +7,8 @@
 struct ZSet {
     AVLNode *root = NULL;
     HMap hmap;
+    // bytes allocated for the nodes
+    size_t nodeBytes = 0;
 };
 
 struct ZNode {
@@ -24,4 +26,5 @@ ZNode  *zsetLookup(ZSet *zset, const char *name, size_t len);
 void   zsetDelete(ZSet *zset, ZNode *node);
 ZNode  *zsetSeekge(ZSet *zset, double score, const char *name, size_t len);
 ZNode  *znodeOffset(ZNode *znode, int64_t offset);
-void zsetClear(ZSet *zset);
\ No newline at end of file
+void zsetClear(ZSet *zset);
+size_t zsetMemUsage(ZSet *zset);
\ No newline at end of file